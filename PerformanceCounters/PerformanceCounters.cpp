@@ -9,19 +9,33 @@
  */
 
 #include "PerformanceCounters.h"
+#include "PerformanceCountersClock.h"
+#include "PerformanceCountersKernels.h"
+#include "PerformanceCountersNuma.h"
+#include "PerformanceCountersPerCpu.h"
 #include "PerformanceCountersPrivate.h"
+#include "PerformanceCountersRequests.h"
+#include "PerformanceCountersSlowCalls.h"
+#include "PerformanceCountersTrace.h"
+#include "PerformanceCountersWorkers.h"
 #include "ScopedTimer.h"
 
 #include <algorithm>
 #include <atomic>
 #include <chrono>
+#include <cmath>
 #include <cstring>
+#include <functional>
 #include <iostream>
+#include <limits>
 #include <memory>
 #include <mutex>
+#include <shared_mutex>
 #include <sstream>
 #include <string>
+#include <thread>
 #include <unordered_map>
+#include <vector>
 
 #ifdef _WIN32
 #ifndef WIN32_LEAN_AND_MEAN
@@ -30,15 +44,141 @@
 #include <windows.h>
 #endif
 
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/membarrier.h>)
+#include <linux/membarrier.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#define PERFORMANCE_COUNTERS_HAVE_MEMBARRIER 1
+#endif
+#endif
+
 //----------------------------------------------------------------------------
 // Internal types (not exposed in any header)
 //----------------------------------------------------------------------------
 
-/// Global atomic counters for a single function's timing statistics.
-struct FunctionCounters
+/// Global counters of AccumulatorChunkSize consecutive function IDs on one
+/// NUMA node, as arrays like the accumulator chunks.
+/// Times are in ScopeClock ticks, converted when read.
+struct GlobalCounterChunk
+{
+    std::atomic<int64_t> TotalTicks[AccumulatorChunkSize];
+    std::atomic<int64_t> CallCount[AccumulatorChunkSize];
+};
+
+/// A registered function. Stored in chunks that never move, so readers need
+/// no lock once the ID is below the published count.
+struct FunctionEntry
+{
+    std::string Name;
+};
+
+/// Second level of an accumulator's counter table.
+///
+/// Dirty bits form a hierarchy mirroring the table: bit i of DirtyIds[c] is
+/// set when ID i of chunk c changed, bit c of DirtyChunks while DirtyIds[c]
+/// may be non-zero, and a bit of AccumulatorSlot::DirtyDirectories while
+/// DirtyChunks may be. Flushes claim and clear them, so they visit only IDs
+/// that changed since the previous flush.
+struct AccumulatorDirectory
+{
+    std::atomic<LocalCounterChunk*> Chunks[AccumulatorDirectorySize] = {};
+    std::atomic<uint64_t> DirtyIds[AccumulatorDirectorySize] = {};
+    std::atomic<uint64_t> DirtyChunks{ 0 };
+    /// Dirty bits claimed by a flush but not yet flushed (under the slot's FlushMutex).
+    uint64_t ClaimedIds[AccumulatorDirectorySize] = {};
+    uint64_t ClaimedChunks = 0;
+};
+
+static_assert(AccumulatorDirectorySize == 64 && AccumulatorMaxDirectories == 64 &&
+    AccumulatorChunkSize == 64,
+  "dirty bitmaps are single 64-bit words");
+
+/// Index of the lowest set bit of a non-zero @p bits.
+static inline int LowestBit(uint64_t bits)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, bits);
+    return static_cast<int>(index);
+#else
+    return __builtin_ctzll(bits);
+#endif
+}
+
+/// Number of set bits in @p bits.
+static inline int CountBits(uint64_t bits)
+{
+#ifdef _MSC_VER
+    return static_cast<int>(__popcnt64(bits));
+#else
+    return __builtin_popcountll(bits);
+#endif
+}
+
+/// Changed IDs in a chunk from which a flush diffs the whole chunk in one
+/// loop rather than visiting the IDs one by one.
+static constexpr int WholeChunkMinIds = 4;
+
+/// Named measurement window over the global counters (see StartSession()).
+/// Arrays are indexed by function ID and grow a chunk at a time.
+struct CounterSession
+{
+    bool Active = false;
+    std::vector<int64_t> BaselineElapsed;  ///< Global totals when last updated.
+    std::vector<int64_t> BaselineCalls;
+    std::vector<int64_t> Elapsed;  ///< Gathered while running, in nanoseconds.
+    std::vector<int64_t> Calls;
+
+    /// Wall time of the repetitions run through BeginROI()/EndROI().
+    int64_t Began = 0;  ///< Last start, in ScopeClock ticks.
+    int64_t Repetitions = 0;
+    double WallNanoseconds = 0.0;
+    double WallSquares = 0.0;  ///< Sum of squared repetition times, for the deviation.
+    double MinWallNanoseconds = 0.0;
+    double MaxWallNanoseconds = 0.0;
+};
+
+/// Registry-owned counter storage for one thread at a time.
+///
+/// Slots are pushed onto the head of the registry's slot list with CAS, and
+/// pooled slots stay there until the registry is destroyed. Unpooled slots
+/// are unlinked on thread exit and freed once no collector can still be
+/// walking past them (see Impl::SlotListReader), so collectors never lock the
+/// list while threads start and exit.
+struct AccumulatorSlot
 {
-    std::atomic<int64_t> TotalNanoseconds{ 0 };
-    std::atomic<int> CallCount{ 0 };
+    /// Directory pages indexed by ID >> AccumulatorDirectoryShift. Pages and
+    /// their chunks are written only by the owning thread (or on retire,
+    /// under FlushMutex).
+    std::atomic<AccumulatorDirectory*> Directories[AccumulatorMaxDirectories] = {};
+    std::atomic<uint64_t> DirtyDirectories{ 0 };  ///< Top of the dirty bit hierarchy.
+    uint64_t ClaimedDirectories = 0;               ///< Under FlushMutex.
+    std::atomic<size_t> Bytes{ sizeof(AccumulatorSlot) };  ///< Heap bytes incl. pages.
+    int Node = 0;                         ///< NUMA node whose pool the slot belongs to.
+    std::mutex FlushMutex;                ///< Serializes owner and collector flushes.
+    std::atomic<bool> InUse{ false };     ///< True while bound to a live thread.
+    std::atomic<AccumulatorSlot*> Next{ nullptr };  ///< Next slot in the registry list.
+    AccumulatorSlot* NextFree = nullptr;            ///< Next slot in the free list.
+    uint64_t RetireEpoch = 0;  ///< Epoch the slot was unlinked in (under RetireMutex).
+    /// Registry reset epoch the Flushed* baselines are current with. Written
+    /// under FlushMutex, read by the owner to notice a reset.
+    std::atomic<uint64_t> ResetEpoch{ 0 };
+    /// Taken by the owner for scopes above their slow call threshold, and by
+    /// flushes to move the calls out. Taken after FlushMutex.
+    std::mutex SlowCallMutex;
+    SlowCallHeaps SlowCalls;  ///< Under SlowCallMutex.
+
+    ~AccumulatorSlot();
+    void ReleaseChunks();
+
+    /// Move dirty bits to the claimed bits, clearing them if @p clear.
+    /// Caller holds FlushMutex.
+    void ClaimDirty(bool clear);
 };
 
 /// Internal implementation of FunctionRegistry (PIMPL pattern).
@@ -46,25 +186,151 @@ struct FunctionRegistry::Impl
 {
     std::mutex Mutex;
     std::unordered_map<std::string, int> NameToId;
-    std::vector<std::string> Names;
-    std::vector<std::unique_ptr<FunctionCounters>> Counters;
+    /// Entry chunks indexed like accumulator chunks; written under Mutex.
+    std::atomic<FunctionEntry*> Entries[AccumulatorMaxChunks] = {};
     std::atomic<int> Count{ 0 };
+    int MaxFunctions = AccumulatorMaxFunctions;  ///< Under Mutex.
+    int OverflowId = -1;                         ///< "<overflow>" once registered; under Mutex.
+
+    std::atomic<int> RefCount{ 1 };                  ///< Singleton + live accumulators.
+    std::atomic<AccumulatorSlot*> Slots{ nullptr };  ///< Live and pooled slots.
+    /// Retired slots for reuse, per NUMA node so pooled pages stay local.
+    std::atomic<AccumulatorSlot*> FreeSlots[NumaMaxNodes] = {};
+    std::atomic<int> SlotCount{ 0 };
+    std::atomic<bool> Pooling{ true };  ///< Keep retired slot storage for reuse.
+    /// Collectors may clear dirty bits; needs a process-wide memory barrier.
+    const bool ClearDirtyOnCollect;
+
+    /// Epoch-based reclamation of unlinked slots. Walkers of the slot list
+    /// count themselves in Readers[Epoch & 1]; the epoch advances only when
+    /// no walker of the previous epoch remains, so a slot unlinked in epoch
+    /// E is unreachable once the epoch reaches E + 2.
+    std::atomic<uint64_t> Epoch{ 0 };
+    std::atomic<int> Readers[2] = {};
+    std::mutex RetireMutex;                   ///< Serializes unlinking and reclamation.
+    std::vector<AccumulatorSlot*> Unlinked;  ///< Awaiting reclamation (under RetireMutex).
+
+    /// Measurement sessions by name. Taken before any per-CPU FlushMutex.
+    std::mutex SessionsMutex;
+    std::unordered_map<std::string, CounterSession> Sessions;
+    int ActiveSessions = 0;             ///< Under SessionsMutex.
+    bool RecordOutsideSessions = true;  ///< Under SessionsMutex.
+    /// False while scopes are ignored: no session is running and
+    /// RecordOutsideSessions is off. Checked by every timed scope.
+    std::atomic<bool> Recording{ true };
+
+    /// Threads used by CollectAll() and report generation; null when serial.
+    std::mutex WorkersMutex;
+    std::shared_ptr<WorkerPool> Workers;
+
+    /// Per-CPU tables, created under Mutex on first use and kept until destruction.
+    std::atomic<PerCpuCounters*> PerCpu{ nullptr };
+    /// Equal to PerCpu while the per-CPU backend is selected, else nullptr.
+    std::atomic<PerCpuCounters*> ActivePerCpu{ nullptr };
+    /// Incremented by every reset. Slots whose ResetEpoch lags behind still
+    /// hold data recorded before the reset, which their next flush discards.
+    std::atomic<uint64_t> ResetEpoch{ 0 };
+    /// Shared by flushes from their epoch check until their last add to the
+    /// global counters, exclusive for a reset, so no flush that saw the old
+    /// epoch adds after the zeroing. Taken after SessionsMutex, before any
+    /// FlushMutex.
+    std::shared_timed_mutex ResetMutex;
+
+    /// Trace streaming, created under Mutex on first use and kept until destruction.
+    std::atomic<TraceSink*> Trace{ nullptr };
+    std::atomic<bool> Tracing{ false };  ///< A trace is running; checked by every timed scope.
+    std::atomic<uint32_t> NextFlow{ 0 };  ///< Last link issued by TraceFlowBegin().
+
+    /// Slowest request breakdowns; cleared by resets.
+    RequestRetainer Requests;
+
+    /// Slow calls kept per function; 0 while capture is off.
+    std::atomic<int> SlowCallCapacity{ 0 };
+    /// Slow calls of all threads, merged by flushes. Taken after slot mutexes.
+    mutable std::mutex SlowCallsMutex;
+    SlowCallHeaps SlowCalls;  ///< Under SlowCallsMutex.
+
+    /// Global counter shards per NUMA node, indexed by
+    /// node * AccumulatorMaxChunks + chunk. A chunk is allocated by the first
+    /// flush on its node, so it is placed there. Readers sum all nodes.
+    int NodeCount = 1;
+    std::unique_ptr<std::atomic<GlobalCounterChunk*>[]> NodeCounters;
+    std::atomic<size_t> NodeCounterBytes{ 0 };
+
+    Impl();
+    ~Impl();
+
+    FunctionEntry& GetEntry(int id) const;
+    GlobalCounterChunk* FindNodeChunk(int chunk, int node) const;
+    GlobalCounterChunk& GetNodeChunk(int chunk, int node);
+    int GetCallCount(int id) const;
+    int64_t GetTotalNanoseconds(int id) const;
+    void ResetCounters();
+    void ReadTotals(int chunk, int64_t* elapsed, int64_t* calls) const;
+    void UpdateSession(CounterSession& session, bool gather);
+    bool StartSession(const char* name);
+    bool StopSession(const char* name, const int64_t* ended);
+    void UpdateRecording();
+    const std::string& GetName(int id) const;
+    std::vector<std::string> GetNames() const;
+    TraceSink& GetTraceSink();
+
+    AccumulatorSlot* AcquireSlot();
+    void RetireSlot(AccumulatorSlot* slot);
+    void PushFreeSlots(AccumulatorSlot* first, AccumulatorSlot* last);
+    void UnlinkSlot(AccumulatorSlot* slot);
+    void ReclaimSlots();
+    void ClaimSlot(AccumulatorSlot* slot);
+    void FlushSlot(AccumulatorSlot* slot, bool claim);
+    void DiscardPending(AccumulatorSlot* slot);
+    void FlushChunk(LocalCounterChunk& local, int chunk, uint64_t ids, int node);
+    void FlushPerCpu();
+    int64_t GetInitialSlowThreshold() const;
+    void ResetSlowThresholds(AccumulatorSlot* slot);
+    void MoveSlowCalls(AccumulatorSlot* slot);
+    void SetSlowCallCapacity(int capacity);
+    size_t GetRegistryBytes();
+    std::shared_ptr<WorkerPool> GetWorkers();
+    void FormatResults(int first, int last, std::ostream& out) const;
+
+    /// Read-side critical section over the slot list. Slots reachable from
+    /// the list stay allocated until the section ends.
+    class SlotListReader
+    {
+      public:
+        explicit SlotListReader(Impl& impl)
+          : Counter(impl.Readers[impl.Epoch.load(std::memory_order_relaxed) & 1])
+        {
+            this->Counter.fetch_add(1, std::memory_order_relaxed);
+            // Pairs with the fences in ReclaimSlots(): either the reclaimer
+            // sees this reader, or this reader sees the list without the slot.
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
 
-    std::mutex AccumulatorMutex;
-    std::vector<ThreadAccumulator*> Accumulators;
-    std::atomic<bool> Destroyed{ false };  ///< Guards against static destruction order fiasco.
+        ~SlotListReader() { this->Counter.fetch_sub(1, std::memory_order_release); }
 
-    FunctionCounters& GetCounter(int id);
-    const std::string& GetName(int id) const;
-    std::mutex& GetAccumulatorMutex();
-    std::vector<ThreadAccumulator*>& GetAccumulators();
-    std::atomic<bool>& GetDestroyed();
+      private:
+        std::atomic<int>& Counter;
+    };
 };
 
-#ifdef _WIN32
-/// Convert Windows performance counter ticks to nanoseconds.
-static int64_t TicksToNanoseconds(int64_t ticks);
-#endif
+/// Function IDs per task when a report is formatted in parallel.
+static constexpr int ReportBlockSize = 1024;
+
+/// Upper bound for SetCollectThreads().
+static constexpr int MaxCollectThreads = 64;
+
+/// Two-sided 95% Student t quantiles for 1 to 30 degrees of freedom.
+static const double StudentT95[30] = { 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365,
+    2.306, 2.262, 2.228, 2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+    2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042 };
+
+/// Prepare ProcessBarrier(); false if the platform has no such barrier.
+static bool InitializeProcessBarrier();
+
+/// Execute a memory barrier on every thread of the process, so stores any
+/// thread made before are visible to the caller afterwards.
+static void ProcessBarrier();
 
 //----------------------------------------------------------------------------
 // The PerformanceCounters singleton pointer.
@@ -92,6 +358,43 @@ PerformanceCounters* PerformanceCountersInstance;
 // pointer before creating a new singleton.
 unsigned int PerformanceCountersInitializeCount;
 
+//----------------------------------------------------------------------------
+// Virtual clock state (see PerformanceCounters::SetVirtualClock()).
+//
+// File-scope globals with default binding, like PerformanceCountersInstance,
+// so every module that links the library statically reads the same clock.
+// Zero-initialized: off, at time 0.
+std::atomic<bool> PerformanceCountersVirtualClock;
+std::atomic<int64_t> PerformanceCountersVirtualTime;
+
+/// Clock of timed scopes, regions and Bench(): TimerClock, or the virtual
+/// clock while it is selected. Virtual ticks are nanoseconds.
+struct ScopeClock
+{
+    static int64_t Now()
+    {
+        if (PerformanceCountersVirtualClock.load(std::memory_order_relaxed))
+        {
+            return PerformanceCountersVirtualTime.load(std::memory_order_relaxed);
+        }
+        return TimerClock::Now();
+    }
+
+    static int64_t ToNanoseconds(int64_t ticks)
+    {
+        if (PerformanceCountersVirtualClock.load(std::memory_order_relaxed))
+        {
+            return ticks;
+        }
+        return TimerClock::ToNanoseconds(ticks);
+    }
+
+    static bool IsVirtual()
+    {
+        return PerformanceCountersVirtualClock.load(std::memory_order_relaxed);
+    }
+};
+
 //----------------------------------------------------------------------------
 PerformanceCountersInitialize::PerformanceCountersInitialize()
 {
@@ -133,61 +436,112 @@ PerformanceCounters& PerformanceCounters::GetInstance()
 }
 
 //----------------------------------------------------------------------------
-PerformanceCounters::PerformanceCounters() = default;
+// Created eagerly so concurrent first uses of Instance() cannot race.
+// Can't use make_unique here - FunctionRegistry has private ctor,
+// accessible only to friend class PerformanceCounters.
+PerformanceCounters::PerformanceCounters()
+  : Registry(new FunctionRegistry())
+{
+}
 
 //----------------------------------------------------------------------------
-PerformanceCounters::~PerformanceCounters() = default;
+PerformanceCounters::~PerformanceCounters()
+{
+    // Threads still running may hold references; the last one frees the registry.
+    this->Registry->Release();
+}
 
 //----------------------------------------------------------------------------
 FunctionRegistry& PerformanceCounters::GetRegistry()
 {
-    if (!this->Registry)
-    {
-        // Can't use make_unique here - FunctionRegistry has private ctor,
-        // accessible only to friend class PerformanceCounters.
-        this->Registry.reset(new FunctionRegistry());
-    }
     return *this->Registry;
 }
 
 //----------------------------------------------------------------------------
 void PerformanceCounters::CollectAll()
 {
-    auto& reg = FunctionRegistry::Instance();
-    std::lock_guard<std::mutex> lock(reg.pImpl->GetAccumulatorMutex());
-    for (auto* acc : reg.pImpl->GetAccumulators())
+    auto& impl = *FunctionRegistry::Instance().pImpl;
+    std::shared_ptr<WorkerPool> workers = impl.GetWorkers();
     {
-        acc->Flush();
+        FunctionRegistry::Impl::SlotListReader reader(impl);
+        std::vector<AccumulatorSlot*> live;
+        auto* slot = impl.Slots.load(std::memory_order_acquire);
+        for (; slot; slot = slot->Next.load(std::memory_order_acquire))
+        {
+            // Retired slots were flushed by their owner on thread exit.
+            if (slot->InUse.load(std::memory_order_acquire))
+            {
+                impl.ClaimSlot(slot);
+                live.push_back(slot);
+            }
+        }
+        // Owners check their dirty bits after storing the counters. Once the
+        // claimed bits are cleared, one barrier makes every such store
+        // visible; an owner that saw a bit still set wrote before it.
+        if (impl.ClearDirtyOnCollect && !live.empty())
+        {
+            ProcessBarrier();
+        }
+        // Slots are flushed whole by one thread each: their flush mutexes
+        // are then taken once per collect, and slots stay alive until the
+        // reader section ends.
+        if (workers)
+        {
+            workers->Run(static_cast<int>(live.size()), [&impl, &live](int part)
+              { impl.FlushSlot(live[part], false); });
+        }
+        else
+        {
+            for (auto* claimed : live)
+            {
+                impl.FlushSlot(claimed, false);
+            }
+        }
     }
+    impl.FlushPerCpu();
+    impl.ReclaimSlots();
 }
 
 //----------------------------------------------------------------------------
 std::string PerformanceCounters::GetResultsAsString()
 {
-    auto& reg = FunctionRegistry::Instance();
-    int count = reg.GetFunctionCount();
-
-    std::ostringstream oss;
-    oss << "\n=== Function Timing Results ===\n\n";
+    auto& impl = *FunctionRegistry::Instance().pImpl;
+    int count = FunctionRegistry::Instance().GetFunctionCount();
+    const std::string header = "\n=== Function Timing Results ===\n\n";
 
-    for (int i = 0; i < count; ++i)
+    std::shared_ptr<WorkerPool> workers = impl.GetWorkers();
+    if (!workers || count < 2 * ReportBlockSize)
     {
-        int calls = reg.pImpl->GetCounter(i).CallCount.load();
-        int64_t totalNs = reg.pImpl->GetCounter(i).TotalNanoseconds.load();
-        double totalSec = totalNs / 1e9;
-
-        oss << reg.pImpl->GetName(i) << ":\n"
-            << "  Total calls:   " << calls << "\n"
-            << "  Total time:    " << totalSec << " s\n";
-
-        if (calls > 0)
-        {
-            oss << "  Avg per call:  " << (totalNs / calls) << " ns\n";
-        }
-        oss << "\n";
+        std::ostringstream oss;
+        oss << header;
+        impl.FormatResults(0, count, oss);
+        return oss.str();
     }
 
-    return oss.str();
+    // Format blocks of IDs in parallel and join them in ID order.
+    const int blocks = (count + ReportBlockSize - 1) / ReportBlockSize;
+    std::vector<std::string> parts(blocks);
+    workers->Run(blocks,
+      [&impl, &parts, count](int block)
+      {
+          std::ostringstream oss;
+          int first = block * ReportBlockSize;
+          impl.FormatResults(first, std::min(count, first + ReportBlockSize), oss);
+          parts[block] = oss.str();
+      });
+    size_t size = header.size();
+    for (const auto& part : parts)
+    {
+        size += part.size();
+    }
+    std::string result;
+    result.reserve(size);
+    result += header;
+    for (const auto& part : parts)
+    {
+        result += part;
+    }
+    return result;
 }
 
 //----------------------------------------------------------------------------
@@ -213,14 +567,287 @@ int PerformanceCounters::GetResults(char* buffer, int bufferSize)
 //----------------------------------------------------------------------------
 void PerformanceCounters::ResetAllCounters()
 {
-    auto& reg = FunctionRegistry::Instance();
-    int count = reg.GetFunctionCount();
+    FunctionRegistry::Instance().pImpl->ResetCounters();
+}
 
-    for (int i = 0; i < count; ++i)
+//----------------------------------------------------------------------------
+bool PerformanceCounters::StartSession(const char* name)
+{
+    this->CollectAll();
+    return FunctionRegistry::Instance().pImpl->StartSession(name);
+}
+
+//----------------------------------------------------------------------------
+bool PerformanceCounters::StopSession(const char* name)
+{
+    this->CollectAll();
+    return FunctionRegistry::Instance().pImpl->StopSession(name, nullptr);
+}
+
+//----------------------------------------------------------------------------
+void PerformanceCounters::RemoveSession(const char* name)
+{
+    auto& impl = *FunctionRegistry::Instance().pImpl;
+    std::lock_guard<std::mutex> lock(impl.SessionsMutex);
+    auto it = impl.Sessions.find(name);
+    if (it != impl.Sessions.end())
+    {
+        impl.ActiveSessions -= it->second.Active;
+        impl.Sessions.erase(it);
+        impl.UpdateRecording();
+    }
+}
+
+//----------------------------------------------------------------------------
+PerformanceCounters::SessionSnapshot PerformanceCounters::GetSessionSnapshot(const char* name)
+{
+    this->CollectAll();
+    auto& impl = *FunctionRegistry::Instance().pImpl;
+    SessionSnapshot snapshot;
+    std::lock_guard<std::mutex> lock(impl.SessionsMutex);
+    auto it = impl.Sessions.find(name);
+    if (it != impl.Sessions.end())
+    {
+        CounterSession& session = it->second;
+        if (session.Active)
+        {
+            impl.UpdateSession(session, true);
+        }
+        snapshot.Active = session.Active;
+        snapshot.CallCount = session.Calls;
+        snapshot.TotalNanoseconds = session.Elapsed;
+    }
+    return snapshot;
+}
+
+//----------------------------------------------------------------------------
+std::string PerformanceCounters::GetSessionResultsAsString(const char* name)
+{
+    auto& impl = *FunctionRegistry::Instance().pImpl;
+    SessionSnapshot snapshot = this->GetSessionSnapshot(name);
+    std::ostringstream oss;
+    oss << "\n=== Session " << name << " ===\n\n";
+    for (int i = 0; i < static_cast<int>(snapshot.CallCount.size()); ++i)
+    {
+        int64_t calls = snapshot.CallCount[i];
+        if (calls == 0)
+        {
+            continue;
+        }
+        int64_t totalNs = snapshot.TotalNanoseconds[i];
+        oss << impl.GetName(i) << ":\n"
+            << "  Total calls:   " << calls << "\n"
+            << "  Total time:    " << totalNs / 1e9 << " s\n"
+            << "  Avg per call:  " << (totalNs / calls) << " ns\n\n";
+    }
+    return oss.str();
+}
+
+//----------------------------------------------------------------------------
+bool PerformanceCounters::BeginROI(const char* name)
+{
+    this->CollectAll();
+    return FunctionRegistry::Instance().pImpl->StartSession(name);
+}
+
+//----------------------------------------------------------------------------
+bool PerformanceCounters::EndROI(const char* name)
+{
+    // Scopes still pending when the region ends belong to it, the time
+    // spent collecting them does not.
+    int64_t ended = ScopeClock::Now();
+    this->CollectAll();
+    return FunctionRegistry::Instance().pImpl->StopSession(name, &ended);
+}
+
+//----------------------------------------------------------------------------
+void PerformanceCounters::SetRecordOutsideROI(bool enabled)
+{
+    auto& impl = *FunctionRegistry::Instance().pImpl;
+    std::lock_guard<std::mutex> lock(impl.SessionsMutex);
+    impl.RecordOutsideSessions = enabled;
+    impl.UpdateRecording();
+}
+
+//----------------------------------------------------------------------------
+bool PerformanceCounters::GetRecordOutsideROI()
+{
+    auto& impl = *FunctionRegistry::Instance().pImpl;
+    std::lock_guard<std::mutex> lock(impl.SessionsMutex);
+    return impl.RecordOutsideSessions;
+}
+
+//----------------------------------------------------------------------------
+PerformanceCounters::ROISnapshot PerformanceCounters::GetROISnapshot(const char* name)
+{
+    ROISnapshot snapshot;
+    snapshot.Counters = this->GetSessionSnapshot(name);
+    auto& impl = *FunctionRegistry::Instance().pImpl;
+    std::lock_guard<std::mutex> lock(impl.SessionsMutex);
+    auto it = impl.Sessions.find(name);
+    if (it != impl.Sessions.end() && it->second.Repetitions > 0)
+    {
+        const CounterSession& session = it->second;
+        const double n = static_cast<double>(session.Repetitions);
+        const double mean = session.WallNanoseconds / n;
+        snapshot.Repetitions = session.Repetitions;
+        snapshot.WallTime = session.WallNanoseconds / 1e9;
+        snapshot.MinWallTime = session.MinWallNanoseconds / 1e9;
+        snapshot.MaxWallTime = session.MaxWallNanoseconds / 1e9;
+        snapshot.StdDevWallTime =
+          std::sqrt(std::max(0.0, session.WallSquares / n - mean * mean)) / 1e9;
+    }
+    return snapshot;
+}
+
+//----------------------------------------------------------------------------
+std::string PerformanceCounters::GetROIResultsAsString(const char* name)
+{
+    auto& impl = *FunctionRegistry::Instance().pImpl;
+    ROISnapshot roi = this->GetROISnapshot(name);
+    std::ostringstream oss;
+    oss << "\n=== ROI " << name << " ===\n\n"
+        << "Repetitions:     " << roi.Repetitions << "\n"
+        << "Wall time:       " << roi.WallTime << " s\n";
+    if (roi.Repetitions > 0)
+    {
+        oss << "Per repetition:  " << roi.GetMeanWallTime() * 1e9 << " ns (min "
+            << roi.MinWallTime * 1e9 << ", max " << roi.MaxWallTime * 1e9 << ", stddev "
+            << roi.StdDevWallTime * 1e9 << ")\n";
+    }
+    oss << "\n";
+    for (int i = 0; i < static_cast<int>(roi.Counters.CallCount.size()); ++i)
+    {
+        int64_t calls = roi.Counters.CallCount[i];
+        if (calls == 0)
+        {
+            continue;
+        }
+        int64_t totalNs = roi.Counters.TotalNanoseconds[i];
+        oss << impl.GetName(i) << ":\n"
+            << "  Total calls:   " << calls << "\n"
+            << "  Total time:    " << totalNs / 1e9 << " s\n"
+            << "  Avg per call:  " << (totalNs / calls) << " ns\n";
+        if (roi.Repetitions > 0)
+        {
+            oss << "  Per iteration: " << roi.GetCallsPerIteration(i) << " calls, "
+                << roi.GetTimePerIteration(i) * 1e9 << " ns\n";
+        }
+        oss << "\n";
+    }
+    return oss.str();
+}
+
+//----------------------------------------------------------------------------
+PerformanceCounters::BenchResult PerformanceCounters::RunBench(
+  const char* name, const std::function<void(int64_t)>& batch, const BenchOptions& options)
+{
+    BenchResult result;
+    result.Name = name;
+    result.Id = FunctionRegistry::Instance().RegisterFunction(name);
+    const int64_t maxIterations = std::max<int64_t>(1, options.MaxIterations);
+    auto timeBatch = [&batch](int64_t iterations)
+    {
+        int64_t start = ScopeClock::Now();
+        batch(iterations);
+        return ScopeClock::Now() - start;
+    };
+
+    // Warm up caches, branch predictors and CPU frequency. A largest batch
+    // that takes no time (virtual clock) would never finish it.
+    const double warmupNs = options.WarmupTime * 1e9;
+    for (int64_t iterations = 1, spent = 0; spent < warmupNs;
+         iterations = std::min(2 * iterations, maxIterations))
+    {
+        int64_t ns = ScopeClock::ToNanoseconds(timeBatch(iterations));
+        spent += ns;
+        if (ns <= 0 && iterations >= maxIterations)
+        {
+            break;
+        }
+    }
+
+    // Grow the batch until one takes MinTime, aiming 20% above it.
+    const double minNs = options.MinTime * 1e9;
+    int64_t iterations = 1;
+    for (;;)
+    {
+        int64_t ns = ScopeClock::ToNanoseconds(timeBatch(iterations));
+        if (ns >= minNs || iterations >= maxIterations)
+        {
+            break;
+        }
+        double scale = ns > 0 ? std::min(100.0, 1.2 * minNs / ns) : 100.0;
+        iterations = std::min(maxIterations,
+          std::max(iterations + 1, static_cast<int64_t>(static_cast<double>(iterations) * scale)));
+    }
+    result.Iterations = iterations;
+
+    const int repetitions = std::max(1, options.Repetitions);
+    std::vector<int64_t> elapsed(repetitions);  // Ticks, as recorded.
+    for (int r = 0; r < repetitions; ++r)
+    {
+        elapsed[r] = timeBatch(iterations);
+        result.Samples.push_back(
+          static_cast<double>(ScopeClock::ToNanoseconds(elapsed[r])) / iterations);
+    }
+
+    // Reject samples further than OutlierThreshold scaled median absolute
+    // deviations from the median (1.4826 MAD estimates sigma for normal data).
+    auto median = [](std::vector<double> values)
+    {
+        std::sort(values.begin(), values.end());
+        size_t n = values.size();
+        return n % 2 ? values[n / 2] : 0.5 * (values[n / 2 - 1] + values[n / 2]);
+    };
+    const double center = median(result.Samples);
+    std::vector<double> deviations;
+    for (double sample : result.Samples)
+    {
+        deviations.push_back(std::abs(sample - center));
+    }
+    const double limit = options.OutlierThreshold * 1.4826 * median(deviations);
+    std::vector<double> kept;
+    // Recorded like timed scopes: not outside every region when those are ignored.
+    const bool record = TlsAccum.IsRecording();
+    for (int r = 0; r < repetitions; ++r)
+    {
+        if (limit > 0.0 && std::abs(result.Samples[r] - center) > limit)
+        {
+            ++result.Outliers;
+            continue;
+        }
+        kept.push_back(result.Samples[r]);
+        if (record)
+        {
+            TlsAccum.Record(result.Id, elapsed[r], iterations);
+        }
+    }
+
+    const size_t n = kept.size();
+    double sum = 0.0;
+    for (double sample : kept)
+    {
+        sum += sample;
+    }
+    result.Mean = sum / n;
+    result.Median = median(kept);
+    result.Min = *std::min_element(kept.begin(), kept.end());
+    result.Max = *std::max_element(kept.begin(), kept.end());
+    if (n > 1)
     {
-        reg.pImpl->GetCounter(i).TotalNanoseconds.store(0, std::memory_order_relaxed);
-        reg.pImpl->GetCounter(i).CallCount.store(0, std::memory_order_relaxed);
+        double squares = 0.0;
+        for (double sample : kept)
+        {
+            squares += (sample - result.Mean) * (sample - result.Mean);
+        }
+        result.StdDev = std::sqrt(squares / (n - 1));
     }
+    const double t = n - 1 <= 30 ? StudentT95[std::max<size_t>(n, 2) - 2] : 1.96;
+    const double margin = n > 1 ? t * result.StdDev / std::sqrt(static_cast<double>(n)) : 0.0;
+    result.ConfidenceLow = result.Mean - margin;
+    result.ConfidenceHigh = result.Mean + margin;
+    return result;
 }
 
 //----------------------------------------------------------------------------
@@ -235,6 +862,22 @@ int PerformanceCounters::GetFunctionCount()
     return FunctionRegistry::Instance().GetFunctionCount();
 }
 
+//----------------------------------------------------------------------------
+void PerformanceCounters::SetMaxFunctions(int count)
+{
+    auto& impl = *FunctionRegistry::Instance().pImpl;
+    std::lock_guard<std::mutex> lock(impl.Mutex);
+    impl.MaxFunctions = std::max(1, std::min(count, AccumulatorMaxFunctions));
+}
+
+//----------------------------------------------------------------------------
+int PerformanceCounters::GetMaxFunctions()
+{
+    auto& impl = *FunctionRegistry::Instance().pImpl;
+    std::lock_guard<std::mutex> lock(impl.Mutex);
+    return impl.MaxFunctions;
+}
+
 //----------------------------------------------------------------------------
 std::string PerformanceCounters::GetFunctionName(int id)
 {
@@ -260,7 +903,7 @@ int PerformanceCounters::GetFunctionCallCount(int id)
     {
         return 0;
     }
-    return reg.pImpl->GetCounter(id).CallCount.load();
+    return reg.pImpl->GetCallCount(id);
 }
 
 //----------------------------------------------------------------------------
@@ -278,7 +921,7 @@ double PerformanceCounters::GetFunctionTotalTime(int id)
     {
         return 0.0;
     }
-    int64_t totalNs = reg.pImpl->GetCounter(id).TotalNanoseconds.load();
+    int64_t totalNs = reg.pImpl->GetTotalNanoseconds(id);
     return totalNs / 1e9;
 }
 
@@ -297,12 +940,12 @@ double PerformanceCounters::GetFunctionAverageTime(int id)
     {
         return 0.0;
     }
-    int calls = reg.pImpl->GetCounter(id).CallCount.load();
+    int calls = reg.pImpl->GetCallCount(id);
     if (calls == 0)
     {
         return 0.0;
     }
-    int64_t totalNs = reg.pImpl->GetCounter(id).TotalNanoseconds.load();
+    int64_t totalNs = reg.pImpl->GetTotalNanoseconds(id);
     return static_cast<double>(totalNs) / calls;
 }
 
@@ -314,192 +957,1521 @@ double PerformanceCounters::GetFunctionAverageTime(const char* name)
 }
 
 //----------------------------------------------------------------------------
-// FunctionRegistry::Impl internal methods
-//----------------------------------------------------------------------------
-
-FunctionCounters& FunctionRegistry::Impl::GetCounter(int id)
+int PerformanceCounters::GetAccumulatorCount()
 {
-    return *this->Counters[id];
+    return FunctionRegistry::Instance().pImpl->SlotCount.load(std::memory_order_relaxed);
 }
 
-const std::string& FunctionRegistry::Impl::GetName(int id) const
+//----------------------------------------------------------------------------
+void PerformanceCounters::SetAccumulatorPooling(bool enabled)
 {
-    return this->Names[id];
+    FunctionRegistry::Instance().pImpl->Pooling.store(enabled, std::memory_order_relaxed);
 }
 
-std::mutex& FunctionRegistry::Impl::GetAccumulatorMutex()
+//----------------------------------------------------------------------------
+bool PerformanceCounters::GetAccumulatorPooling()
 {
-    return this->AccumulatorMutex;
+    return FunctionRegistry::Instance().pImpl->Pooling.load(std::memory_order_relaxed);
 }
 
-std::vector<ThreadAccumulator*>& FunctionRegistry::Impl::GetAccumulators()
+//----------------------------------------------------------------------------
+PerformanceCounters::AccumulationBackend PerformanceCounters::SetAccumulationBackend(
+  AccumulationBackend backend)
 {
-    return this->Accumulators;
+    auto& impl = *FunctionRegistry::Instance().pImpl;
+    if (backend == AccumulationBackend::PerCpu && PerCpuCounters::IsSupported())
+    {
+        std::lock_guard<std::mutex> lock(impl.Mutex);
+        PerCpuCounters* perCpu = impl.PerCpu.load(std::memory_order_relaxed);
+        if (!perCpu)
+        {
+            perCpu = new PerCpuCounters;
+            impl.PerCpu.store(perCpu, std::memory_order_release);
+        }
+        impl.ActivePerCpu.store(perCpu, std::memory_order_release);
+        return AccumulationBackend::PerCpu;
+    }
+    // Values already in the per-CPU tables are still picked up by CollectAll().
+    impl.ActivePerCpu.store(nullptr, std::memory_order_release);
+    return AccumulationBackend::PerThread;
 }
 
-std::atomic<bool>& FunctionRegistry::Impl::GetDestroyed()
+//----------------------------------------------------------------------------
+PerformanceCounters::AccumulationBackend PerformanceCounters::GetAccumulationBackend()
 {
-    return this->Destroyed;
+    return FunctionRegistry::Instance().pImpl->ActivePerCpu.load(std::memory_order_relaxed)
+      ? AccumulationBackend::PerCpu
+      : AccumulationBackend::PerThread;
 }
 
 //----------------------------------------------------------------------------
-// FunctionRegistry (public interface with PIMPL)
-//----------------------------------------------------------------------------
-
-FunctionRegistry& FunctionRegistry::Instance()
+void PerformanceCounters::SetCollectThreads(int threads)
 {
-    return PerformanceCounters::GetInstance().GetRegistry();
-}
+    if (threads <= 0)
+    {
+        threads = static_cast<int>(std::thread::hardware_concurrency());
+    }
+    threads = std::max(1, std::min(threads, MaxCollectThreads));
 
-FunctionRegistry::FunctionRegistry()
-  : pImpl(std::make_unique<Impl>())
-{
+    auto& impl = *FunctionRegistry::Instance().pImpl;
+    std::shared_ptr<WorkerPool> old;
+    {
+        std::lock_guard<std::mutex> lock(impl.WorkersMutex);
+        if (threads == (impl.Workers ? impl.Workers->GetThreadCount() : 1))
+        {
+            return;
+        }
+        old = std::move(impl.Workers);
+        if (threads > 1)
+        {
+            impl.Workers = std::make_shared<WorkerPool>(threads);
+        }
+    }
+    // A collect still running on the old pool keeps it alive until it returns.
 }
 
-FunctionRegistry::~FunctionRegistry()
+//----------------------------------------------------------------------------
+int PerformanceCounters::GetCollectThreads()
 {
-    pImpl->Destroyed.store(true, std::memory_order_release);
+    std::shared_ptr<WorkerPool> workers = FunctionRegistry::Instance().pImpl->GetWorkers();
+    return workers ? workers->GetThreadCount() : 1;
 }
 
-int FunctionRegistry::RegisterFunction(const char* name)
+//----------------------------------------------------------------------------
+void PerformanceCounters::SetVirtualClock(bool enabled)
 {
-    std::lock_guard<std::mutex> lock(pImpl->Mutex);
-
-    auto it = pImpl->NameToId.find(name);
-    if (it != pImpl->NameToId.end())
+    if (enabled == PerformanceCountersVirtualClock.load(std::memory_order_relaxed))
     {
-        return it->second;
+        return;
     }
-
-    int id = static_cast<int>(pImpl->Names.size());
-    pImpl->Names.emplace_back(name);
-    pImpl->NameToId[name] = id;
-    pImpl->Counters.push_back(std::make_unique<FunctionCounters>());
-    pImpl->Count.store(id + 1, std::memory_order_release);
-    return id;
+    this->ResetAllCounters();
+    PerformanceCountersVirtualClock.store(enabled, std::memory_order_relaxed);
 }
 
-int FunctionRegistry::FindFunction(const char* name) const
+//----------------------------------------------------------------------------
+bool PerformanceCounters::GetVirtualClock()
 {
-    std::lock_guard<std::mutex> lock(pImpl->Mutex);
-    auto it = pImpl->NameToId.find(name);
-    if (it != pImpl->NameToId.end())
-    {
-        return it->second;
-    }
-    return -1;
+    return PerformanceCountersVirtualClock.load(std::memory_order_relaxed);
 }
 
-int FunctionRegistry::GetFunctionCount() const
+//----------------------------------------------------------------------------
+void PerformanceCounters::AdvanceVirtualClock(int64_t nanoseconds)
 {
-    return pImpl->Count.load(std::memory_order_acquire);
+    PerformanceCountersVirtualTime.fetch_add(nanoseconds, std::memory_order_relaxed);
 }
 
 //----------------------------------------------------------------------------
-// ThreadAccumulator
+bool PerformanceCounters::StartTrace(const char* path)
+{
+    return this->StartTrace(path, TraceOptions());
+}
+
+//----------------------------------------------------------------------------
+bool PerformanceCounters::StartTrace(const char* path, const TraceOptions& options)
+{
+    auto& impl = *FunctionRegistry::Instance().pImpl;
+    const double nsPerTick = ScopeClock::ToNanoseconds(1000000000) / 1e9;
+    if (!impl.GetTraceSink().Start(path, options, nsPerTick))
+    {
+        return false;
+    }
+    impl.Tracing.store(true, std::memory_order_relaxed);
+    return true;
+}
+
+//----------------------------------------------------------------------------
+bool PerformanceCounters::StopTrace()
+{
+    auto& impl = *FunctionRegistry::Instance().pImpl;
+    TraceSink* sink = impl.Trace.load(std::memory_order_acquire);
+    if (!sink)
+    {
+        return false;
+    }
+    impl.Tracing.store(false, std::memory_order_relaxed);
+    return sink->Stop(impl.GetNames());
+}
+
+//----------------------------------------------------------------------------
+uint32_t PerformanceCounters::TraceFlowBegin()
+{
+    auto& impl = *FunctionRegistry::Instance().pImpl;
+    uint32_t flow = impl.NextFlow.fetch_add(1, std::memory_order_relaxed) + 1;
+    if (flow == 0)
+    {
+        // Wrapped; 0 marks events without a link.
+        flow = impl.NextFlow.fetch_add(1, std::memory_order_relaxed) + 1;
+    }
+    if (TlsAccum.IsRecording() && TlsAccum.IsTracing())
+    {
+        const int64_t now = ScopeClock::Now();
+        TlsAccum.Trace(TraceFlowOut, now, now, flow);
+    }
+    return flow;
+}
+
+//----------------------------------------------------------------------------
+void PerformanceCounters::TraceFlowEnd(uint32_t flow)
+{
+    if (flow != 0 && TlsAccum.IsRecording() && TlsAccum.IsTracing())
+    {
+        const int64_t now = ScopeClock::Now();
+        TlsAccum.Trace(TraceFlowIn, now, now, flow);
+    }
+}
+
+//----------------------------------------------------------------------------
+bool PerformanceCounters::BeginRequest(uint64_t request)
+{
+    if (TlsAccum.Request)
+    {
+        return false;
+    }
+    if (!TlsAccum.RequestStorage)
+    {
+        TlsAccum.RequestStorage = new RequestContext;
+    }
+    TlsAccum.RequestStorage->Begin(request, ScopeClock::Now());
+    TlsAccum.Request = TlsAccum.RequestStorage;
+    return true;
+}
+
+//----------------------------------------------------------------------------
+const PerformanceCounters::RequestBreakdown* PerformanceCounters::EndRequest()
+{
+    RequestContext* context = TlsAccum.Request;
+    if (!context)
+    {
+        return nullptr;
+    }
+    TlsAccum.Request = nullptr;
+    const RequestBreakdown& breakdown = context->End(ScopeClock::Now(), &ScopeClock::ToNanoseconds);
+    FunctionRegistry::Instance().pImpl->Requests.Offer(breakdown);
+    return &breakdown;
+}
+
+//----------------------------------------------------------------------------
+void PerformanceCounters::SetRequestRetention(const RequestRetention& retention)
+{
+    FunctionRegistry::Instance().pImpl->Requests.SetRetention(retention);
+}
+
+//----------------------------------------------------------------------------
+PerformanceCounters::RequestRetention PerformanceCounters::GetRequestRetention()
+{
+    return FunctionRegistry::Instance().pImpl->Requests.GetRetention();
+}
+
+//----------------------------------------------------------------------------
+std::vector<PerformanceCounters::RequestBreakdown> PerformanceCounters::GetSlowRequests()
+{
+    int64_t completed;
+    return FunctionRegistry::Instance().pImpl->Requests.GetSlowest(completed);
+}
+
+//----------------------------------------------------------------------------
+std::string PerformanceCounters::GetSlowRequestsAsString()
+{
+    auto& impl = *FunctionRegistry::Instance().pImpl;
+    int64_t completed;
+    std::vector<RequestBreakdown> slowest = impl.Requests.GetSlowest(completed);
+    std::ostringstream oss;
+    oss << "\n=== Slowest requests ===\n\n"
+        << "Completed:       " << completed << "\n"
+        << "Shown:           " << slowest.size() << "\n\n";
+    for (const RequestBreakdown& request : slowest)
+    {
+        oss << "Request " << request.Request << ": " << request.Nanoseconds << " ns\n";
+        for (const RequestFunction& function : request.Functions)
+        {
+            oss << "  " << impl.GetName(function.Id) << ": " << function.Calls << " calls, "
+                << function.Nanoseconds << " ns\n";
+        }
+        oss << "\n";
+    }
+    return oss.str();
+}
+
+//----------------------------------------------------------------------------
+void PerformanceCounters::SetSlowCallCapture(int perFunction)
+{
+    FunctionRegistry::Instance().pImpl->SetSlowCallCapacity(std::max(0, perFunction));
+}
+
+//----------------------------------------------------------------------------
+int PerformanceCounters::GetSlowCallCapture()
+{
+    return FunctionRegistry::Instance().pImpl->SlowCallCapacity.load(std::memory_order_relaxed);
+}
+
+//----------------------------------------------------------------------------
+void PerformanceCounters::SetSlowCallContext(uint64_t context)
+{
+    TlsAccum.SlowCallContext = context;
+}
+
+//----------------------------------------------------------------------------
+std::vector<PerformanceCounters::SlowCall> PerformanceCounters::GetSlowCalls(int id)
+{
+    auto& impl = *FunctionRegistry::Instance().pImpl;
+    std::lock_guard<std::mutex> lock(impl.SlowCallsMutex);
+    return impl.SlowCalls.Get(id);
+}
+
+//----------------------------------------------------------------------------
+PerformanceCounters::TraceStatistics PerformanceCounters::GetTraceStatistics()
+{
+    TraceSink* sink = FunctionRegistry::Instance().pImpl->Trace.load(std::memory_order_acquire);
+    return sink ? sink->GetStatistics() : TraceStatistics();
+}
+
+//----------------------------------------------------------------------------
+PerformanceCounters::MemoryUsage PerformanceCounters::GetMemoryUsage()
+{
+    auto& impl = *FunctionRegistry::Instance().pImpl;
+    MemoryUsage usage;
+    usage.Registry = impl.GetRegistryBytes();
+    usage.CurrentThread = TlsAccum.Slot->Bytes.load(std::memory_order_relaxed);
+    FunctionRegistry::Impl::SlotListReader reader(impl);
+    for (auto* slot = impl.Slots.load(std::memory_order_acquire); slot;
+         slot = slot->Next.load(std::memory_order_acquire))
+    {
+        size_t bytes = slot->Bytes.load(std::memory_order_relaxed);
+        usage.Accumulators += bytes;
+        usage.LargestAccumulator = std::max(usage.LargestAccumulator, bytes);
+        ++usage.AccumulatorCount;
+    }
+    if (PerCpuCounters* perCpu = impl.PerCpu.load(std::memory_order_acquire))
+    {
+        usage.PerCpu = perCpu->GetMemoryUsage();
+    }
+    return usage;
+}
+
+//----------------------------------------------------------------------------
+// FunctionRegistry::Impl internal methods
+//----------------------------------------------------------------------------
+
+FunctionRegistry::Impl::Impl()
+  : ClearDirtyOnCollect(InitializeProcessBarrier())
+  , NodeCount(NumaNodeCount())
+{
+    const size_t chunks = static_cast<size_t>(this->NodeCount) * AccumulatorMaxChunks;
+    this->NodeCounters.reset(new std::atomic<GlobalCounterChunk*>[chunks]);
+    for (size_t i = 0; i < chunks; ++i)
+    {
+        this->NodeCounters[i].store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+FunctionRegistry::Impl::~Impl()
+{
+    // A running trace still needs the function names.
+    if (TraceSink* sink = this->Trace.load(std::memory_order_relaxed))
+    {
+        sink->Stop(this->GetNames());
+        delete sink;
+    }
+    // No accumulator references remain, so no thread can touch the slots.
+    auto* slot = this->Slots.load(std::memory_order_acquire);
+    while (slot)
+    {
+        auto* next = slot->Next.load(std::memory_order_relaxed);
+        delete slot;
+        slot = next;
+    }
+    for (auto* unlinked : this->Unlinked)
+    {
+        delete unlinked;
+    }
+    for (auto& chunk : this->Entries)
+    {
+        delete[] chunk.load(std::memory_order_relaxed);
+    }
+    delete this->PerCpu.load(std::memory_order_relaxed);
+    const size_t nodeChunks = static_cast<size_t>(this->NodeCount) * AccumulatorMaxChunks;
+    for (size_t i = 0; i < nodeChunks; ++i)
+    {
+        DeleteAccumulatorArray(this->NodeCounters[i].load(std::memory_order_relaxed), 1);
+    }
+}
+
+FunctionEntry& FunctionRegistry::Impl::GetEntry(int id) const
+{
+    FunctionEntry* chunk =
+      this->Entries[id >> AccumulatorChunkBits].load(std::memory_order_acquire);
+    return chunk[id & AccumulatorChunkMask];
+}
+
+GlobalCounterChunk* FunctionRegistry::Impl::FindNodeChunk(int chunk, int node) const
+{
+    return this->NodeCounters[node * AccumulatorMaxChunks + chunk].load(std::memory_order_acquire);
+}
+
+GlobalCounterChunk& FunctionRegistry::Impl::GetNodeChunk(int chunk, int node)
+{
+    auto& slot = this->NodeCounters[node * AccumulatorMaxChunks + chunk];
+    GlobalCounterChunk* counters = slot.load(std::memory_order_acquire);
+    if (!counters)
+    {
+        // Zeroed by the flushing thread, which runs on this node.
+        auto* fresh = NewAccumulatorArray<GlobalCounterChunk>(1);
+        if (slot.compare_exchange_strong(
+              counters, fresh, std::memory_order_acq_rel, std::memory_order_acquire))
+        {
+            counters = fresh;
+            this->NodeCounterBytes.fetch_add(
+              sizeof(GlobalCounterChunk), std::memory_order_relaxed);
+        }
+        else
+        {
+            DeleteAccumulatorArray(fresh, 1);
+        }
+    }
+    return *counters;
+}
+
+int FunctionRegistry::Impl::GetCallCount(int id) const
+{
+    int64_t calls = 0;
+    for (int node = 0; node < this->NodeCount; ++node)
+    {
+        if (GlobalCounterChunk* chunk = this->FindNodeChunk(id >> AccumulatorChunkBits, node))
+        {
+            calls += chunk->CallCount[id & AccumulatorChunkMask].load(std::memory_order_relaxed);
+        }
+    }
+    return static_cast<int>(calls);
+}
+
+int64_t FunctionRegistry::Impl::GetTotalNanoseconds(int id) const
+{
+    int64_t ticks = 0;
+    for (int node = 0; node < this->NodeCount; ++node)
+    {
+        if (GlobalCounterChunk* chunk = this->FindNodeChunk(id >> AccumulatorChunkBits, node))
+        {
+            ticks += chunk->TotalTicks[id & AccumulatorChunkMask].load(std::memory_order_relaxed);
+        }
+    }
+    return ScopeClock::ToNanoseconds(ticks);
+}
+
+void FunctionRegistry::Impl::ResetCounters()
+{
+    // Running sessions keep what was collected before the reset and
+    // count from zero afterwards.
+    std::lock_guard<std::mutex> sessionsLock(this->SessionsMutex);
+    // Flushes in progress finish first; later ones see the new epoch.
+    std::lock_guard<std::shared_timed_mutex> resetLock(this->ResetMutex);
+    for (auto& entry : this->Sessions)
+    {
+        if (entry.second.Active)
+        {
+            this->UpdateSession(entry.second, true);
+        }
+    }
+
+    this->Requests.Reset();
+
+    // Thread-local data is discarded lazily: by the owner on its next
+    // record, or by the next flush of the slot, whichever comes first.
+    this->ResetEpoch.fetch_add(1, std::memory_order_acq_rel);
+    {
+        std::lock_guard<std::mutex> lock(this->SlowCallsMutex);
+        this->SlowCalls.Clear();
+    }
+    int count = this->Count.load(std::memory_order_acquire);
+    int chunks = (count + AccumulatorChunkMask) >> AccumulatorChunkBits;
+    for (int node = 0; node < this->NodeCount; ++node)
+    {
+        for (int c = 0; c < chunks; ++c)
+        {
+            if (GlobalCounterChunk* chunk = this->FindNodeChunk(c, node))
+            {
+                ZeroCounters(chunk->TotalTicks, AccumulatorChunkSize);
+                ZeroCounters(chunk->CallCount, AccumulatorChunkSize);
+            }
+        }
+    }
+
+    for (auto& entry : this->Sessions)
+    {
+        CounterSession& session = entry.second;
+        std::fill(session.BaselineElapsed.begin(), session.BaselineElapsed.end(), 0);
+        std::fill(session.BaselineCalls.begin(), session.BaselineCalls.end(), 0);
+    }
+
+    // The per-CPU tables belong to the registry: rebase them right away.
+    if (PerCpuCounters* perCpu = this->PerCpu.load(std::memory_order_acquire))
+    {
+        std::lock_guard<std::mutex> lock(perCpu->FlushMutex);
+        for (int cpu = 0; cpu < perCpu->GetCpuCount(); ++cpu)
+        {
+            for (int c = 0; c < chunks; ++c)
+            {
+                if (PerCpuCell* chunk = perCpu->GetChunk(cpu, c))
+                {
+                    int end = std::min(AccumulatorChunkSize, count - (c << AccumulatorChunkBits));
+                    for (int i = 0; i < end; ++i)
+                    {
+                        PerCpuCell& cell = chunk[i];
+                        cell.Flushed[PerCpuCounters::Elapsed] =
+                          PerCpuCounters::Read(cell, PerCpuCounters::Elapsed);
+                        cell.Flushed[PerCpuCounters::Calls] =
+                          PerCpuCounters::Read(cell, PerCpuCounters::Calls);
+                    }
+                }
+            }
+        }
+    }
+}
+
+void FunctionRegistry::Impl::ReadTotals(int chunk, int64_t* elapsed, int64_t* calls) const
+{
+    std::fill(elapsed, elapsed + AccumulatorChunkSize, 0);
+    std::fill(calls, calls + AccumulatorChunkSize, 0);
+    for (int node = 0; node < this->NodeCount; ++node)
+    {
+        if (GlobalCounterChunk* global = this->FindNodeChunk(chunk, node))
+        {
+            for (int i = 0; i < AccumulatorChunkSize; ++i)
+            {
+                elapsed[i] += global->TotalTicks[i].load(std::memory_order_relaxed);
+                calls[i] += global->CallCount[i].load(std::memory_order_relaxed);
+            }
+        }
+    }
+}
+
+void FunctionRegistry::Impl::UpdateSession(CounterSession& session, bool gather)
+{
+    // Caller holds SessionsMutex. Move the baselines up to the current
+    // totals, adding the difference to the session if @p gather.
+    int chunks = (this->Count.load(std::memory_order_acquire) + AccumulatorChunkMask) >>
+      AccumulatorChunkBits;
+    const size_t size = static_cast<size_t>(chunks) * AccumulatorChunkSize;
+    if (session.BaselineElapsed.size() < size)
+    {
+        session.BaselineElapsed.resize(size, 0);
+        session.BaselineCalls.resize(size, 0);
+        session.Elapsed.resize(size, 0);
+        session.Calls.resize(size, 0);
+    }
+    int64_t elapsed[AccumulatorChunkSize];
+    int64_t calls[AccumulatorChunkSize];
+    int64_t elapsedDelta[AccumulatorChunkSize];
+    int64_t callsDelta[AccumulatorChunkSize];
+    for (int c = 0; c < chunks; ++c)
+    {
+        const size_t base = static_cast<size_t>(c) * AccumulatorChunkSize;
+        this->ReadTotals(c, elapsed, calls);
+        uint64_t changed = DiffCounters(
+          elapsed, &session.BaselineElapsed[base], elapsedDelta, AccumulatorChunkSize);
+        changed |=
+          DiffCounters(calls, &session.BaselineCalls[base], callsDelta, AccumulatorChunkSize);
+        for (; gather && changed; changed &= changed - 1)
+        {
+            int i = LowestBit(changed);
+            session.Elapsed[base + i] += ScopeClock::ToNanoseconds(elapsedDelta[i]);
+            session.Calls[base + i] += callsDelta[i];
+        }
+    }
+}
+
+bool FunctionRegistry::Impl::StartSession(const char* name)
+{
+    // The caller has collected, so earlier scopes stay out of the session.
+    std::lock_guard<std::mutex> lock(this->SessionsMutex);
+    CounterSession& session = this->Sessions[name];
+    if (session.Active)
+    {
+        return false;
+    }
+    this->UpdateSession(session, false);
+    session.Active = true;
+    ++this->ActiveSessions;
+    this->UpdateRecording();
+    session.Began = ScopeClock::Now();
+    return true;
+}
+
+bool FunctionRegistry::Impl::StopSession(
+  const char* name, const int64_t* ended)
+{
+    // The caller has collected. @p ended is the end of a region repetition.
+    std::lock_guard<std::mutex> lock(this->SessionsMutex);
+    auto it = this->Sessions.find(name);
+    if (it == this->Sessions.end() || !it->second.Active)
+    {
+        return false;
+    }
+    CounterSession& session = it->second;
+    this->UpdateSession(session, true);
+    session.Active = false;
+    --this->ActiveSessions;
+    this->UpdateRecording();
+    if (ended)
+    {
+        double wall = static_cast<double>(ScopeClock::ToNanoseconds(*ended - session.Began));
+        session.MinWallNanoseconds =
+          session.Repetitions ? std::min(session.MinWallNanoseconds, wall) : wall;
+        session.MaxWallNanoseconds = std::max(session.MaxWallNanoseconds, wall);
+        session.WallNanoseconds += wall;
+        session.WallSquares += wall * wall;
+        ++session.Repetitions;
+    }
+    return true;
+}
+
+void FunctionRegistry::Impl::UpdateRecording()
+{
+    // Caller holds SessionsMutex.
+    this->Recording.store(
+      this->RecordOutsideSessions || this->ActiveSessions > 0, std::memory_order_relaxed);
+}
+
+const std::string& FunctionRegistry::Impl::GetName(int id) const
+{
+    return this->GetEntry(id).Name;
+}
+
+std::vector<std::string> FunctionRegistry::Impl::GetNames() const
+{
+    std::vector<std::string> names;
+    const int count = this->Count.load(std::memory_order_acquire);
+    names.reserve(count);
+    for (int i = 0; i < count; ++i)
+    {
+        names.push_back(this->GetName(i));
+    }
+    return names;
+}
+
+TraceSink& FunctionRegistry::Impl::GetTraceSink()
+{
+    TraceSink* sink = this->Trace.load(std::memory_order_acquire);
+    if (!sink)
+    {
+        std::lock_guard<std::mutex> lock(this->Mutex);
+        sink = this->Trace.load(std::memory_order_relaxed);
+        if (!sink)
+        {
+            sink = new TraceSink;
+            this->Trace.store(sink, std::memory_order_release);
+        }
+    }
+    return *sink;
+}
+
+std::shared_ptr<WorkerPool> FunctionRegistry::Impl::GetWorkers()
+{
+    std::lock_guard<std::mutex> lock(this->WorkersMutex);
+    return this->Workers;
+}
+
+void FunctionRegistry::Impl::FormatResults(int first, int last, std::ostream& out) const
+{
+    for (int i = first; i < last; ++i)
+    {
+        int calls = this->GetCallCount(i);
+        int64_t totalNs = this->GetTotalNanoseconds(i);
+        double totalSec = totalNs / 1e9;
+
+        out << this->GetName(i) << ":\n"
+            << "  Total calls:   " << calls << "\n"
+            << "  Total time:    " << totalSec << " s\n";
+
+        if (calls > 0)
+        {
+            out << "  Avg per call:  " << (totalNs / calls) << " ns\n";
+        }
+        std::vector<PerformanceCounters::SlowCall> slowest;
+        if (this->SlowCallCapacity.load(std::memory_order_relaxed) > 0)
+        {
+            std::lock_guard<std::mutex> lock(this->SlowCallsMutex);
+            slowest = this->SlowCalls.Get(i);
+        }
+        for (const PerformanceCounters::SlowCall& call : slowest)
+        {
+            out << "  Slow call:     " << call.Nanoseconds << " ns at " << call.Timestamp
+                << " ns, thread " << call.Thread << ", context " << call.Context << "\n";
+        }
+        out << "\n";
+    }
+}
+
+size_t FunctionRegistry::Impl::GetRegistryBytes()
+{
+    std::lock_guard<std::mutex> lock(this->Mutex);
+    int count = this->Count.load(std::memory_order_relaxed);
+    int chunks = (count + AccumulatorChunkMask) >> AccumulatorChunkBits;
+    size_t bytes = sizeof(FunctionRegistry) + sizeof(Impl) +
+      static_cast<size_t>(chunks) * AccumulatorChunkSize * sizeof(FunctionEntry) +
+      static_cast<size_t>(this->NodeCount) * AccumulatorMaxChunks *
+        sizeof(std::atomic<GlobalCounterChunk*>) +
+      this->NodeCounterBytes.load(std::memory_order_relaxed);
+    for (int id = 0; id < count; ++id)
+    {
+        bytes += this->GetName(id).capacity();
+    }
+    // Hash map: bucket array plus one node per name holding a copy of the key.
+    bytes += this->NameToId.bucket_count() * sizeof(void*);
+    for (const auto& item : this->NameToId)
+    {
+        bytes += sizeof(item) + 2 * sizeof(void*) + item.first.capacity();
+    }
+    return bytes;
+}
+
+AccumulatorSlot* FunctionRegistry::Impl::AcquireSlot()
+{
+    // Detach the whole free list rather than popping one node with CAS: an
+    // exchange cannot suffer from ABA when a slot is retired and reused
+    // between the load and the compare.
+    const int node = NumaCurrentNode();
+    auto& freeSlots = this->FreeSlots[node];
+    AccumulatorSlot* slot = freeSlots.exchange(nullptr, std::memory_order_acquire);
+    if (slot)
+    {
+        // Threads starting meanwhile find the list empty and allocate, so
+        // put the rest back at once if nothing was pushed since; walk to
+        // its end only otherwise.
+        AccumulatorSlot* rest = slot->NextFree;
+        AccumulatorSlot* empty = nullptr;
+        if (rest &&
+          !freeSlots.compare_exchange_strong(
+            empty, rest, std::memory_order_release, std::memory_order_relaxed))
+        {
+            AccumulatorSlot* last = rest;
+            while (last->NextFree)
+            {
+                last = last->NextFree;
+            }
+            this->PushFreeSlots(rest, last);
+        }
+        slot->NextFree = nullptr;
+        slot->InUse.store(true, std::memory_order_release);
+        return slot;
+    }
+
+    slot = new AccumulatorSlot;
+    slot->Node = node;
+    slot->InUse.store(true, std::memory_order_relaxed);
+    AccumulatorSlot* head = this->Slots.load(std::memory_order_relaxed);
+    do
+    {
+        slot->Next.store(head, std::memory_order_relaxed);
+    } while (!this->Slots.compare_exchange_weak(
+      head, slot, std::memory_order_release, std::memory_order_relaxed));
+    this->SlotCount.fetch_add(1, std::memory_order_relaxed);
+    return slot;
+}
+
+void FunctionRegistry::Impl::RetireSlot(AccumulatorSlot* slot)
+{
+    this->FlushSlot(slot, true);
+    if (this->Pooling.load(std::memory_order_relaxed))
+    {
+        slot->InUse.store(false, std::memory_order_release);
+        this->PushFreeSlots(slot, slot);
+        return;
+    }
+    {
+        // A collector may still be flushing it; wait for that to finish.
+        std::lock_guard<std::mutex> lock(slot->FlushMutex);
+        slot->InUse.store(false, std::memory_order_release);
+    }
+    this->UnlinkSlot(slot);
+    this->ReclaimSlots();
+}
+
+void FunctionRegistry::Impl::UnlinkSlot(AccumulatorSlot* slot)
+{
+    std::lock_guard<std::mutex> lock(this->RetireMutex);
+    AccumulatorSlot* next = slot->Next.load(std::memory_order_relaxed);
+    AccumulatorSlot* head = slot;
+    if (!this->Slots.compare_exchange_strong(
+          head, next, std::memory_order_release, std::memory_order_acquire))
+    {
+        // Not the head: new slots are only pushed at the head and only this
+        // mutex unlinks, so the predecessor is reachable and stays linked.
+        AccumulatorSlot* prev = head;
+        while (prev->Next.load(std::memory_order_acquire) != slot)
+        {
+            prev = prev->Next.load(std::memory_order_acquire);
+        }
+        prev->Next.store(next, std::memory_order_release);
+    }
+    // Walkers already on the slot keep following its Next pointer.
+    slot->RetireEpoch = this->Epoch.load(std::memory_order_relaxed);
+    this->Unlinked.push_back(slot);
+    this->SlotCount.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void FunctionRegistry::Impl::ReclaimSlots()
+{
+    std::unique_lock<std::mutex> lock(this->RetireMutex, std::try_to_lock);
+    if (!lock.owns_lock() || this->Unlinked.empty())
+    {
+        return;
+    }
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    // Advance at most twice, each time only if no walker that may have
+    // started in the previous epoch is left.
+    uint64_t epoch = this->Epoch.load(std::memory_order_relaxed);
+    for (int step = 0; step < 2; ++step)
+    {
+        if (this->Readers[(epoch + 1) & 1].load(std::memory_order_acquire) != 0)
+        {
+            break;
+        }
+        this->Epoch.store(++epoch, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+
+    auto pending = std::partition(this->Unlinked.begin(), this->Unlinked.end(),
+      [epoch](AccumulatorSlot* slot) { return slot->RetireEpoch + 2 > epoch; });
+    for (auto it = pending; it != this->Unlinked.end(); ++it)
+    {
+        delete *it;
+    }
+    this->Unlinked.erase(pending, this->Unlinked.end());
+}
+
+void FunctionRegistry::Impl::PushFreeSlots(AccumulatorSlot* first, AccumulatorSlot* last)
+{
+    // Slots pushed together come from the same pool.
+    auto& freeSlots = this->FreeSlots[first->Node];
+    last->NextFree = freeSlots.load(std::memory_order_relaxed);
+    while (!freeSlots.compare_exchange_weak(
+      last->NextFree, first, std::memory_order_release, std::memory_order_relaxed))
+    {
+    }
+}
+
+void FunctionRegistry::Impl::ClaimSlot(AccumulatorSlot* slot)
+{
+    std::lock_guard<std::mutex> lock(slot->FlushMutex);
+    slot->ClaimDirty(this->ClearDirtyOnCollect);
+}
+
+void FunctionRegistry::Impl::FlushSlot(AccumulatorSlot* slot, bool claim)
+{
+    std::shared_lock<std::shared_timed_mutex> resetLock(this->ResetMutex);
+    std::lock_guard<std::mutex> lock(slot->FlushMutex);
+    if (claim)
+    {
+        // Only the owner claims here, and it sees its own stores.
+        slot->ClaimDirty(true);
+    }
+    if (slot->ResetEpoch.load(std::memory_order_relaxed) !=
+      this->ResetEpoch.load(std::memory_order_acquire))
+    {
+        // Everything pending predates the reset (or the owner would have
+        // discarded it already when recording).
+        this->DiscardPending(slot);
+        return;
+    }
+    this->MoveSlowCalls(slot);
+    const int node = NumaCurrentNode();
+    uint64_t directories = slot->ClaimedDirectories;
+    slot->ClaimedDirectories = 0;
+    while (directories)
+    {
+        int d = LowestBit(directories);
+        directories &= directories - 1;
+        AccumulatorDirectory* directory = slot->Directories[d].load(std::memory_order_acquire);
+        uint64_t chunks = directory->ClaimedChunks;
+        directory->ClaimedChunks = 0;
+        while (chunks)
+        {
+            int c = LowestBit(chunks);
+            chunks &= chunks - 1;
+            LocalCounterChunk* local = directory->Chunks[c].load(std::memory_order_acquire);
+            this->FlushChunk(*local, (d << AccumulatorDirectoryBits) + c, directory->ClaimedIds[c],
+              node);
+            directory->ClaimedIds[c] = 0;
+        }
+    }
+}
+
+void FunctionRegistry::Impl::DiscardPending(AccumulatorSlot* slot)
+{
+    // Caller holds FlushMutex. Move the baselines up to the current values
+    // of every chunk, so nothing recorded so far is flushed.
+    const uint64_t epoch = this->ResetEpoch.load(std::memory_order_acquire);
+    for (auto& page : slot->Directories)
+    {
+        AccumulatorDirectory* directory = page.load(std::memory_order_acquire);
+        if (!directory)
+        {
+            continue;
+        }
+        for (int c = 0; c < AccumulatorDirectorySize; ++c)
+        {
+            if (LocalCounterChunk* local = directory->Chunks[c].load(std::memory_order_acquire))
+            {
+                LoadCounters(local->Elapsed, local->FlushedElapsed, AccumulatorChunkSize);
+                LoadCounters(local->Calls, local->FlushedCalls, AccumulatorChunkSize);
+            }
+            directory->ClaimedIds[c] = 0;
+        }
+        directory->ClaimedChunks = 0;
+    }
+    slot->ClaimedDirectories = 0;
+    // Published after the baselines: an owner that sees the new epoch skips
+    // its own discard, so its next stores must not reach the loads above.
+    slot->ResetEpoch.store(epoch, std::memory_order_release);
+
+    std::lock_guard<std::mutex> lock(slot->SlowCallMutex);
+    slot->SlowCalls.Clear();
+    this->ResetSlowThresholds(slot);
+}
+
+void FunctionRegistry::Impl::FlushChunk(
+  LocalCounterChunk& local, int chunk, uint64_t ids, int node)
+{
+    int64_t elapsed[AccumulatorChunkSize];
+    int64_t calls[AccumulatorChunkSize];
+    uint64_t changed = 0;
+    if (CountBits(ids) >= WholeChunkMinIds)
+    {
+        // Diff the whole chunk: lanes that are not claimed are flushed
+        // early, which the Flushed* baselines make harmless.
+        changed = DiffCounters(local.Elapsed, local.FlushedElapsed, elapsed, AccumulatorChunkSize);
+        changed |= DiffCounters(local.Calls, local.FlushedCalls, calls, AccumulatorChunkSize);
+    }
+    else
+    {
+        for (uint64_t rest = ids; rest; rest &= rest - 1)
+        {
+            int i = LowestBit(rest);
+            int64_t e = local.Elapsed[i].load(std::memory_order_relaxed);
+            int64_t n = local.Calls[i].load(std::memory_order_relaxed);
+            elapsed[i] = e - local.FlushedElapsed[i];
+            calls[i] = n - local.FlushedCalls[i];
+            local.FlushedElapsed[i] = e;
+            local.FlushedCalls[i] = n;
+            changed |= uint64_t(elapsed[i] != 0 || calls[i] != 0) << i;
+        }
+    }
+    if (!changed)
+    {
+        return;
+    }
+    GlobalCounterChunk& global = this->GetNodeChunk(chunk, node);
+    for (; changed; changed &= changed - 1)
+    {
+        int i = LowestBit(changed);
+        global.TotalTicks[i].fetch_add(elapsed[i], std::memory_order_relaxed);
+        global.CallCount[i].fetch_add(calls[i], std::memory_order_relaxed);
+    }
+}
+
+void FunctionRegistry::Impl::FlushPerCpu()
+{
+    PerCpuCounters* perCpu = this->PerCpu.load(std::memory_order_acquire);
+    if (!perCpu)
+    {
+        return;
+    }
+    std::shared_lock<std::shared_timed_mutex> resetLock(this->ResetMutex);
+    std::lock_guard<std::mutex> lock(perCpu->FlushMutex);
+    const int node = NumaCurrentNode();
+    int count = this->Count.load(std::memory_order_acquire);
+    int chunks = (count + AccumulatorChunkMask) >> AccumulatorChunkBits;
+    for (int cpu = 0; cpu < perCpu->GetCpuCount(); ++cpu)
+    {
+        for (int c = 0; c < chunks; ++c)
+        {
+            PerCpuCell* chunk = perCpu->GetChunk(cpu, c);
+            if (!chunk)
+            {
+                continue;
+            }
+            int base = c << AccumulatorChunkBits;
+            int end = std::min(AccumulatorChunkSize, count - base);
+            for (int i = 0; i < end; ++i)
+            {
+                PerCpuCell& cell = chunk[i];
+                int64_t elapsed = PerCpuCounters::Read(cell, PerCpuCounters::Elapsed);
+                int64_t calls = PerCpuCounters::Read(cell, PerCpuCounters::Calls);
+                if (elapsed != cell.Flushed[PerCpuCounters::Elapsed] ||
+                  calls != cell.Flushed[PerCpuCounters::Calls])
+                {
+                    GlobalCounterChunk& global = this->GetNodeChunk(c, node);
+                    global.TotalTicks[i].fetch_add(
+                      elapsed - cell.Flushed[PerCpuCounters::Elapsed], std::memory_order_relaxed);
+                    global.CallCount[i].fetch_add(
+                      calls - cell.Flushed[PerCpuCounters::Calls], std::memory_order_relaxed);
+                    cell.Flushed[PerCpuCounters::Elapsed] = elapsed;
+                    cell.Flushed[PerCpuCounters::Calls] = calls;
+                }
+            }
+        }
+    }
+}
+
+//----------------------------------------------------------------------------
+// AccumulatorSlot
+//----------------------------------------------------------------------------
+
+int64_t FunctionRegistry::Impl::GetInitialSlowThreshold() const
+{
+    // Offer every scope until the thread keeps enough of the function.
+    return this->SlowCallCapacity.load(std::memory_order_relaxed) > 0
+      ? -1
+      : std::numeric_limits<int64_t>::max();
+}
+
+void FunctionRegistry::Impl::ResetSlowThresholds(AccumulatorSlot* slot)
+{
+    // Caller holds SlowCallMutex, so the owner neither allocates a chunk
+    // nor raises a threshold meanwhile.
+    const int64_t threshold = this->GetInitialSlowThreshold();
+    for (auto& page : slot->Directories)
+    {
+        AccumulatorDirectory* directory = page.load(std::memory_order_acquire);
+        if (!directory)
+        {
+            continue;
+        }
+        for (auto& chunk : directory->Chunks)
+        {
+            if (LocalCounterChunk* local = chunk.load(std::memory_order_acquire))
+            {
+                for (auto& limit : local->SlowThreshold)
+                {
+                    limit.store(threshold, std::memory_order_relaxed);
+                }
+            }
+        }
+    }
+}
+
+void FunctionRegistry::Impl::MoveSlowCalls(AccumulatorSlot* slot)
+{
+    // The thresholds stay: the merged heaps keep calls at least as slow.
+    std::lock_guard<std::mutex> lock(slot->SlowCallMutex);
+    std::lock_guard<std::mutex> merged(this->SlowCallsMutex);
+    slot->SlowCalls.MoveTo(this->SlowCalls, this->SlowCallCapacity.load(std::memory_order_relaxed));
+}
+
+void FunctionRegistry::Impl::SetSlowCallCapacity(int capacity)
+{
+    {
+        std::lock_guard<std::mutex> lock(this->SlowCallsMutex);
+        this->SlowCallCapacity.store(capacity, std::memory_order_relaxed);
+        this->SlowCalls.Trim(capacity);
+    }
+    // Slots read the capacity under their mutex, so each one either used
+    // the new capacity already or is brought up to date here.
+    SlotListReader reader(*this);
+    for (auto* slot = this->Slots.load(std::memory_order_acquire); slot;
+         slot = slot->Next.load(std::memory_order_acquire))
+    {
+        std::lock_guard<std::mutex> lock(slot->SlowCallMutex);
+        slot->SlowCalls.Trim(capacity);
+        this->ResetSlowThresholds(slot);
+    }
+}
+
+AccumulatorSlot::~AccumulatorSlot()
+{
+    this->ReleaseChunks();
+}
+
+void AccumulatorSlot::ClaimDirty(bool clear)
+{
+    auto take = [clear](std::atomic<uint64_t>& bits)
+    {
+        return clear ? bits.exchange(0, std::memory_order_acq_rel)
+                     : bits.load(std::memory_order_acquire);
+    };
+    // Top-down, the reverse of ThreadAccumulator::SetDirty(): a bit set
+    // meanwhile is either taken below or leaves its parents set for the
+    // next claim.
+    uint64_t directories = take(this->DirtyDirectories);
+    this->ClaimedDirectories |= directories;
+    while (directories)
+    {
+        int d = LowestBit(directories);
+        directories &= directories - 1;
+        AccumulatorDirectory* directory = this->Directories[d].load(std::memory_order_acquire);
+        uint64_t chunks = take(directory->DirtyChunks);
+        directory->ClaimedChunks |= chunks;
+        while (chunks)
+        {
+            int c = LowestBit(chunks);
+            chunks &= chunks - 1;
+            directory->ClaimedIds[c] |= take(directory->DirtyIds[c]);
+        }
+    }
+}
+
+void AccumulatorSlot::ReleaseChunks()
+{
+    for (auto& page : this->Directories)
+    {
+        AccumulatorDirectory* directory = page.exchange(nullptr, std::memory_order_relaxed);
+        if (directory)
+        {
+            for (auto& chunk : directory->Chunks)
+            {
+                DeleteAccumulatorArray(chunk.load(std::memory_order_relaxed), 1);
+            }
+            DeleteAccumulatorArray(directory, 1);
+        }
+    }
+    this->DirtyDirectories.store(0, std::memory_order_relaxed);
+    this->ClaimedDirectories = 0;
+    this->Bytes.store(sizeof(AccumulatorSlot), std::memory_order_relaxed);
+}
+
+//----------------------------------------------------------------------------
+// FunctionRegistry (public interface with PIMPL)
+//----------------------------------------------------------------------------
+
+FunctionRegistry& FunctionRegistry::Instance()
+{
+    return PerformanceCounters::GetInstance().GetRegistry();
+}
+
+FunctionRegistry::FunctionRegistry()
+  : pImpl(std::make_unique<Impl>())
+{
+}
+
+FunctionRegistry::~FunctionRegistry() = default;
+
+void FunctionRegistry::Retain()
+{
+    pImpl->RefCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+void FunctionRegistry::Release()
+{
+    if (pImpl->RefCount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+        delete this;
+    }
+}
+
+int FunctionRegistry::RegisterFunction(const char* name)
+{
+    std::lock_guard<std::mutex> lock(pImpl->Mutex);
+
+    auto it = pImpl->NameToId.find(name);
+    if (it != pImpl->NameToId.end())
+    {
+        return it->second;
+    }
+
+    int id = pImpl->Count.load(std::memory_order_relaxed);
+    if (id >= pImpl->MaxFunctions - 1 && pImpl->OverflowId < 0)
+    {
+        // The last ID below the limit goes to the entry all further names share.
+        std::cerr << "PerformanceCounters: more than " << pImpl->MaxFunctions - 1
+                  << " functions; new names are recorded as <overflow>\n";
+        pImpl->OverflowId = id;
+        pImpl->NameToId[name] = id;
+        name = "<overflow>";
+    }
+    else if (id >= pImpl->MaxFunctions - 1)
+    {
+        pImpl->NameToId[name] = pImpl->OverflowId;
+        return pImpl->OverflowId;
+    }
+
+    auto& chunk = pImpl->Entries[id >> AccumulatorChunkBits];
+    if (!chunk.load(std::memory_order_relaxed))
+    {
+        chunk.store(new FunctionEntry[AccumulatorChunkSize], std::memory_order_release);
+    }
+    chunk.load(std::memory_order_relaxed)[id & AccumulatorChunkMask].Name = name;
+    pImpl->NameToId[name] = id;
+    pImpl->Count.store(id + 1, std::memory_order_release);
+    return id;
+}
+
+int FunctionRegistry::FindFunction(const char* name) const
+{
+    std::lock_guard<std::mutex> lock(pImpl->Mutex);
+    auto it = pImpl->NameToId.find(name);
+    if (it != pImpl->NameToId.end())
+    {
+        return it->second;
+    }
+    return -1;
+}
+
+int FunctionRegistry::GetFunctionCount() const
+{
+    return pImpl->Count.load(std::memory_order_acquire);
+}
+
+//----------------------------------------------------------------------------
+// ThreadAccumulator
 //----------------------------------------------------------------------------
 
 thread_local ThreadAccumulator TlsAccum;
 
 ThreadAccumulator::ThreadAccumulator()
+  : Registry(&FunctionRegistry::Instance())
 {
-    auto& reg = FunctionRegistry::Instance();
-    std::lock_guard<std::mutex> lock(reg.pImpl->GetAccumulatorMutex());
-    reg.pImpl->GetAccumulators().push_back(this);
+    this->Registry->Retain();
+    this->Slot = this->Registry->pImpl->AcquireSlot();
 }
 
 ThreadAccumulator::~ThreadAccumulator()
 {
-    this->Flush();
+    // Only the registry captured at construction is touched here: the
+    // singleton may already be finalized when threads exit during shutdown,
+    // but our reference keeps the registry and its slots alive.
+    if (this->TraceEvents)
+    {
+        this->Registry->pImpl->Trace.load(std::memory_order_acquire)->Submit(this->TraceEvents);
+    }
+    delete this->RequestStorage;
+    this->Registry->pImpl->RetireSlot(this->Slot);
+    this->Registry->Release();
+}
 
-    // Registry may be destroyed before thread_local accumulators during shutdown.
-    auto& reg = FunctionRegistry::Instance();
-    if (!reg.pImpl->GetDestroyed().load(std::memory_order_acquire))
+inline LocalCounterChunk& ThreadAccumulator::GetChunk(int id)
+{
+    AccumulatorDirectory* directory =
+      this->Slot->Directories[id >> AccumulatorDirectoryShift].load(std::memory_order_relaxed);
+    if (directory)
     {
-        std::lock_guard<std::mutex> lock(reg.pImpl->GetAccumulatorMutex());
-        auto& v = reg.pImpl->GetAccumulators();
-        v.erase(std::remove(v.begin(), v.end(), this), v.end());
+        LocalCounterChunk* chunk =
+          directory->Chunks[(id >> AccumulatorChunkBits) & AccumulatorDirectoryMask].load(
+            std::memory_order_relaxed);
+        if (chunk)
+        {
+            return *chunk;
+        }
     }
+    return this->AllocateChunk(id);
 }
 
-void ThreadAccumulator::EnsureCapacity(int size)
+LocalCounterChunk& ThreadAccumulator::AllocateChunk(int id)
 {
-    if (static_cast<int>(this->Counters.size()) < size)
+    // Allocated and zeroed once by the owning thread, so pages are placed on
+    // its NUMA node; pooled slots keep their pages and stay in that node's pool.
+    auto& page = this->Slot->Directories[id >> AccumulatorDirectoryShift];
+    AccumulatorDirectory* directory = page.load(std::memory_order_relaxed);
+    if (!directory)
+    {
+        directory = NewAccumulatorArray<AccumulatorDirectory>(1);
+        page.store(directory, std::memory_order_release);
+        this->Slot->Bytes.fetch_add(sizeof(AccumulatorDirectory), std::memory_order_relaxed);
+    }
+    auto& chunk = directory->Chunks[(id >> AccumulatorChunkBits) & AccumulatorDirectoryMask];
+    LocalCounterChunk* counters = chunk.load(std::memory_order_relaxed);
+    if (!counters)
     {
-        this->Counters.resize(size);
+        counters = NewAccumulatorArray<LocalCounterChunk>(1);
+        // Published under the slow call mutex, so a change of the capacity
+        // either sees the chunk or happened before the thresholds are set.
+        std::lock_guard<std::mutex> lock(this->Slot->SlowCallMutex);
+        const int64_t threshold = this->Registry->pImpl->GetInitialSlowThreshold();
+        for (auto& limit : counters->SlowThreshold)
+        {
+            limit.store(threshold, std::memory_order_relaxed);
+        }
+        chunk.store(counters, std::memory_order_release);
+        this->Slot->Bytes.fetch_add(sizeof(LocalCounterChunk), std::memory_order_relaxed);
     }
+    return *counters;
 }
 
-void ThreadAccumulator::Flush()
+inline void ThreadAccumulator::Record(int id, int64_t elapsed, int64_t calls)
 {
-    auto& reg = FunctionRegistry::Instance();
-    int count = reg.GetFunctionCount();
-    for (int i = 0; i < count && i < static_cast<int>(this->Counters.size()); ++i)
+    auto& impl = *this->Registry->pImpl;
+    // Acquire: pairs with the release in DiscardPending() by a collector.
+    if (this->Slot->ResetEpoch.load(std::memory_order_acquire) !=
+      impl.ResetEpoch.load(std::memory_order_relaxed))
+    {
+        this->DiscardPending();
+    }
+    PerCpuCounters* perCpu = impl.ActivePerCpu.load(std::memory_order_relaxed);
+    bool elapsedDone = perCpu && perCpu->Add(id, PerCpuCounters::Elapsed, elapsed);
+    if (elapsedDone && perCpu->Add(id, PerCpuCounters::Calls, calls))
     {
-        if (this->Counters[i].Elapsed || this->Counters[i].Calls)
+        // The per-CPU tables have no per-thread state; allocate slot chunks
+        // for the thresholds only while slow calls are captured.
+        if (impl.SlowCallCapacity.load(std::memory_order_relaxed) > 0)
         {
-            reg.pImpl->GetCounter(i).TotalNanoseconds.fetch_add(
-              this->Counters[i].Elapsed, std::memory_order_relaxed);
-            reg.pImpl->GetCounter(i).CallCount.fetch_add(
-              this->Counters[i].Calls, std::memory_order_relaxed);
-            this->Counters[i].Elapsed = 0;
-            this->Counters[i].Calls = 0;
+            LocalCounterChunk& chunk = this->GetChunk(id);
+            const int i = id & AccumulatorChunkMask;
+            if (elapsed > chunk.SlowThreshold[i].load(std::memory_order_relaxed))
+            {
+                this->OfferSlowCall(chunk, id, elapsed, calls);
+            }
         }
+        return;
+    }
+
+    // Owner-only writes: relaxed load + store, no atomic read-modify-write.
+    LocalCounterChunk& chunk = this->GetChunk(id);
+    const int i = id & AccumulatorChunkMask;
+    if (!elapsedDone)
+    {
+        chunk.Elapsed[i].store(
+          chunk.Elapsed[i].load(std::memory_order_relaxed) + elapsed, std::memory_order_relaxed);
+    }
+    chunk.Calls[i].store(
+      chunk.Calls[i].load(std::memory_order_relaxed) + calls, std::memory_order_relaxed);
+    this->MarkDirty(id);
+    if (elapsed > chunk.SlowThreshold[i].load(std::memory_order_relaxed))
+    {
+        this->OfferSlowCall(chunk, id, elapsed, calls);
+    }
+}
+
+void ThreadAccumulator::OfferSlowCall(
+  LocalCounterChunk& chunk, int id, int64_t elapsed, int64_t calls)
+{
+    // Batches of Bench() are not single calls.
+    if (calls != 1)
+    {
+        return;
+    }
+    auto& impl = *this->Registry->pImpl;
+    const int64_t end = ScopeClock::Now();
+    std::lock_guard<std::mutex> lock(this->Slot->SlowCallMutex);
+    const int capacity = impl.SlowCallCapacity.load(std::memory_order_relaxed);
+    std::atomic<int64_t>& threshold = chunk.SlowThreshold[id & AccumulatorChunkMask];
+    if (capacity == 0)
+    {
+        threshold.store(std::numeric_limits<int64_t>::max(), std::memory_order_relaxed);
+        return;
+    }
+    SlowCallSample sample;
+    sample.Ticks = elapsed;
+    sample.Call.Nanoseconds = ScopeClock::ToNanoseconds(elapsed);
+    sample.Call.Timestamp = ScopeClock::ToNanoseconds(end);
+    sample.Call.Thread = SlowCallThreadId();
+    sample.Call.Context = this->SlowCallContext;
+    // Never lowered: calls moved to the registry still count.
+    const int64_t fastest = this->Slot->SlowCalls.Offer(id, sample, capacity);
+    if (fastest > threshold.load(std::memory_order_relaxed))
+    {
+        threshold.store(fastest, std::memory_order_relaxed);
+    }
+}
+
+void ThreadAccumulator::DiscardPending()
+{
+    // Counters reset since this thread last recorded: drop what it recorded
+    // before, so only scopes after the reset reach the global counters.
+    std::lock_guard<std::mutex> lock(this->Slot->FlushMutex);
+    this->Registry->pImpl->DiscardPending(this->Slot);
+}
+
+inline void ThreadAccumulator::MarkDirty(int id)
+{
+    // Checked after the counter stores, which only the compiler must not
+    // reorder: CollectAll() orders the hardware with ProcessBarrier().
+    // Without one, collectors never clear the bits and this stays a read.
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    AccumulatorDirectory* directory =
+      this->Slot->Directories[id >> AccumulatorDirectoryShift].load(std::memory_order_relaxed);
+    const uint64_t bit = uint64_t(1) << (id & AccumulatorChunkMask);
+    auto& ids = directory->DirtyIds[(id >> AccumulatorChunkBits) & AccumulatorDirectoryMask];
+    if (!(ids.load(std::memory_order_relaxed) & bit))
+    {
+        this->SetDirty(id);
+    }
+}
+
+void ThreadAccumulator::SetDirty(int id)
+{
+    // Bottom-up: a parent bit is set by the thread that made its child
+    // non-zero, after the child.
+    const int d = id >> AccumulatorDirectoryShift;
+    const int c = (id >> AccumulatorChunkBits) & AccumulatorDirectoryMask;
+    AccumulatorDirectory* directory = this->Slot->Directories[d].load(std::memory_order_relaxed);
+    if (directory->DirtyIds[c].fetch_or(
+          uint64_t(1) << (id & AccumulatorChunkMask), std::memory_order_release) != 0)
+    {
+        return;
     }
+    if (directory->DirtyChunks.fetch_or(uint64_t(1) << c, std::memory_order_release) != 0)
+    {
+        return;
+    }
+    this->Slot->DirtyDirectories.fetch_or(uint64_t(1) << d, std::memory_order_release);
+}
+
+bool ThreadAccumulator::IsRecording() const
+{
+    return this->Registry->pImpl->Recording.load(std::memory_order_relaxed);
+}
+
+bool ThreadAccumulator::IsTracing() const
+{
+    return this->Registry->pImpl->Tracing.load(std::memory_order_relaxed);
+}
+
+void ThreadAccumulator::Trace(int id, int64_t start, int64_t end, uint32_t flow)
+{
+    // Tracing is only set once the sink exists.
+    this->Registry->pImpl->Trace.load(std::memory_order_acquire)
+      ->Append(this->TraceEvents, this->TraceThread, id, start, end, flow);
+}
+
+void ThreadAccumulator::Flush()
+{
+    this->Registry->pImpl->FlushSlot(this->Slot, true);
 }
 
 //----------------------------------------------------------------------------
-// ScopedTimerHelper - PIMPL implementation
+// ScopedTimerHelper
 //----------------------------------------------------------------------------
 
-struct ScopedTimerHelper::Impl
-{
-    int Id;
-#ifdef _WIN32
-    LARGE_INTEGER Start;
-#else
-    std::chrono::steady_clock::time_point Start;
-#endif
-};
+/// Start of a scope that began while nothing was recorded; no clock was read.
+static const int64_t NotStarted = std::numeric_limits<int64_t>::min();
 
 ScopedTimerHelper::ScopedTimerHelper(int id)
-  : pImpl(std::make_unique<Impl>())
+  : Id(id)
+  , Start(TlsAccum.IsRecording() ? ScopeClock::Now() : NotStarted)
 {
-    pImpl->Id = id;
-    TlsAccum.EnsureCapacity(id + 1);
-#ifdef _WIN32
-    QueryPerformanceCounter(&pImpl->Start);
-#else
-    pImpl->Start = std::chrono::steady_clock::now();
-#endif
 }
 
 ScopedTimerHelper::~ScopedTimerHelper()
 {
-    auto& local = TlsAccum.Counters[pImpl->Id];
-#ifdef _WIN32
-    LARGE_INTEGER end;
-    QueryPerformanceCounter(&end);
-    local.Elapsed += TicksToNanoseconds(end.QuadPart - pImpl->Start.QuadPart);
-#else
-    auto end = std::chrono::steady_clock::now();
-    local.Elapsed +=
-      std::chrono::duration_cast<std::chrono::nanoseconds>(end - pImpl->Start).count();
+    if (this->Start == NotStarted || !TlsAccum.IsRecording())
+    {
+        return;
+    }
+    int64_t end = ScopeClock::Now();
+    TlsAccum.Record(this->Id, end - this->Start);
+    if (TlsAccum.Request)
+    {
+        TlsAccum.Request->Add(this->Id, end - this->Start);
+    }
+    if (TlsAccum.IsTracing())
+    {
+        TlsAccum.Trace(this->Id, this->Start, end);
+    }
+}
+
+//----------------------------------------------------------------------------
+// PreciseScopedTimerHelper
+//----------------------------------------------------------------------------
+
+PreciseScopedTimerHelper::PreciseScopedTimerHelper(int id)
+  : Id(id)
+  , Tsc(false)
+{
+    if (!TlsAccum.IsRecording())
+    {
+        this->Start = NotStarted;
+        return;
+    }
+    // The signal fences keep the compiler from moving memory accesses of
+    // the timed code across the reads; the reads hold back the CPU.
+#ifdef PERFORMANCE_COUNTERS_HAVE_TSC
+    if (TscInfo::Get().Invariant && !ScopeClock::IsVirtual())
+    {
+        this->Tsc = true;
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+        this->Start = static_cast<int64_t>(ReadTscStart());
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+        return;
+    }
 #endif
-    local.Calls++;
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    this->Start = ScopeClock::Now();
+    std::atomic_signal_fence(std::memory_order_seq_cst);
 }
 
-#ifdef _WIN32
-static int64_t TicksToNanoseconds(int64_t ticks)
+PreciseScopedTimerHelper::~PreciseScopedTimerHelper()
 {
-    static const int64_t freq = []()
+    if (this->Start == NotStarted)
+    {
+        return;
+    }
+    int64_t elapsed;
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+#ifdef PERFORMANCE_COUNTERS_HAVE_TSC
+    // The virtual clock may have been switched on since the start.
+    if (this->Tsc)
+    {
+        int64_t ticks = static_cast<int64_t>(ReadTscStop(TscInfo::Get().HasRdtscp)) - this->Start;
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+        // Counters are kept in TimerClock ticks.
+        elapsed = TimerClock::FromNanoseconds(TscClockSource::ToNanoseconds(ticks));
+    }
+    else
+#endif
     {
-        LARGE_INTEGER f;
-        QueryPerformanceFrequency(&f);
-        return f.QuadPart;
-    }();
-    const int64_t seconds = ticks / freq;
-    const int64_t remainder = ticks % freq;
-    return seconds * 1000000000LL + (remainder * 1000000000LL) / freq;
+        int64_t end = ScopeClock::Now();
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+        elapsed = end - this->Start;
+    }
+    if (TlsAccum.IsRecording())
+    {
+        TlsAccum.Record(this->Id, elapsed);
+        if (TlsAccum.Request)
+        {
+            TlsAccum.Request->Add(this->Id, elapsed);
+        }
+        if (TlsAccum.IsTracing())
+        {
+            // The start may be in TSC ticks; place the event just before now.
+            int64_t end = ScopeClock::Now();
+            TlsAccum.Trace(this->Id, end - elapsed, end);
+        }
+    }
+}
+
+bool PreciseScopedTimerHelper::UsesTimeStampCounter()
+{
+    return TscInfo::Get().Invariant;
+}
+
+//----------------------------------------------------------------------------
+// Process-wide memory barrier
+//----------------------------------------------------------------------------
+
+#if defined(PERFORMANCE_COUNTERS_HAVE_MEMBARRIER)
+
+static bool InitializeProcessBarrier()
+{
+    // Linux 4.14+; the private expedited command must be registered first.
+    return syscall(__NR_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0, 0) == 0;
+}
+
+static void ProcessBarrier()
+{
+    syscall(__NR_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0, 0);
 }
+
+#elif defined(_WIN32)
+
+static bool InitializeProcessBarrier()
+{
+    return true;
+}
+
+static void ProcessBarrier()
+{
+    FlushProcessWriteBuffers();
+}
+
+#else
+
+static bool InitializeProcessBarrier()
+{
+    return false;
+}
+
+static void ProcessBarrier()
+{
+}
+
 #endif
@@ -29,8 +29,12 @@
 
 #include "performancecounters_export.h"
 
+#include <cstddef>
+#include <cstdint>
+#include <functional>
 #include <memory>
 #include <string>
+#include <vector>
 
 // Forward declaration - internal class
 class FunctionRegistry;
@@ -43,9 +47,14 @@ class FunctionRegistry;
  * Use GetInstance() to access the singleton.
  *
  * @par Thread Safety
- * - CollectAll(): Thread-safe, call after work completes.
+ * - CollectAll(): Thread-safe, may run while other threads are timing,
+ *   starting or exiting; it never blocks thread start. See
+ *   SetCollectThreads() for collecting on several threads.
  * - GetResultsAsString(): Thread-safe for reading.
- * - ResetAllCounters(): Thread-safe, call when no timing active.
+ * - Sessions: Thread-safe; start, stop and snapshot collect like CollectAll().
+ * - ResetAllCounters(): Thread-safe and constant in the number of threads.
+ *   It waits for flushes in progress, so data recorded before it never
+ *   counts after it; scopes that end while it runs may count or not.
  */
 class PERFORMANCECOUNTERS_EXPORT PerformanceCounters
 {
@@ -59,8 +68,9 @@ class PERFORMANCECOUNTERS_EXPORT PerformanceCounters
     /**
      * @brief Flush all thread-local accumulators to global counters.
      *
-     * Call this after all timed work has completed or from a synchronization
-     * point where worker threads are idle.
+     * Safe to call while other threads are timing: no updates are lost, and
+     * data recorded after a thread was visited is picked up by the next call.
+     * For exact totals, call it after timed work has completed.
      */
     void CollectAll();
 
@@ -81,12 +91,205 @@ class PERFORMANCECOUNTERS_EXPORT PerformanceCounters
     int GetResults(char* buffer, int bufferSize);
 
     /**
-     * @brief Reset all global counters to zero.
+     * @brief Reset all counters to zero, including data not yet collected.
      *
-     * Call CollectAll() first if you want to capture pending data before reset.
+     * Data that threads recorded before the reset is discarded, so a later
+     * CollectAll() reports only scopes that ended after it. Call
+     * CollectAll() first if you want to capture pending data before reset.
      */
     void ResetAllCounters();
 
+    /**
+     * @brief Start or resume the named measurement session.
+     * @return false if the session is already running.
+     *
+     * A session gathers everything added to the global counters while it
+     * runs, i.e. the difference of the counters between its start and stop,
+     * so several sessions can run at once, overlapping or nested, without
+     * resetting anything or adding work to timed scopes. Starting collects
+     * first, so data recorded before belongs to no session. A stopped
+     * session keeps its counters, and starting it again adds to them.
+     * ResetAllCounters() does not clear sessions.
+     *
+     * Sessions are time windows: they see the scopes of all threads, so
+     * isolate work by running it alone or under distinct function names.
+     */
+    bool StartSession(const char* name);
+
+    /**
+     * @brief Stop the named session, keeping its counters.
+     * @return false if the session is not running.
+     */
+    bool StopSession(const char* name);
+
+    /// Forget the named session and its counters.
+    void RemoveSession(const char* name);
+
+    /// Counters gathered by one session, indexed by function ID.
+    struct SessionSnapshot
+    {
+        std::vector<int64_t> CallCount;
+        std::vector<int64_t> TotalNanoseconds;
+        bool Active = false;  ///< The session was running when the snapshot was taken.
+
+        int64_t GetCallCount(int id) const
+        {
+            return id >= 0 && id < static_cast<int>(this->CallCount.size()) ? this->CallCount[id]
+                                                                            : 0;
+        }
+        double GetTotalTime(int id) const
+        {
+            return id >= 0 && id < static_cast<int>(this->TotalNanoseconds.size())
+              ? this->TotalNanoseconds[id] / 1e9
+              : 0.0;
+        }
+    };
+
+    /**
+     * @brief Get the counters of the named session so far.
+     *
+     * Collects first; a running session keeps running. Unknown sessions
+     * yield an empty snapshot.
+     */
+    SessionSnapshot GetSessionSnapshot(const char* name);
+
+    /// Session results formatted like GetResultsAsString(), for functions with calls.
+    std::string GetSessionResultsAsString(const char* name);
+
+    /**
+     * @brief Begin a repetition of the named region of interest.
+     * @return false if the region is already active.
+     *
+     * A region of interest is a session (see StartSession()) that also
+     * measures its wall time per Begin/End pair, so a benchmark loop can
+     * report per-iteration figures:
+     * @code
+     * pc.SetRecordOutsideROI(false);  // optional: ignore setup and teardown
+     * for (int rep = 0; rep < 10; ++rep)
+     * {
+     *     pc.BeginROI("solve");
+     *     Solve();
+     *     pc.EndROI("solve");
+     * }
+     * std::cout << pc.GetROIResultsAsString("solve");
+     * @endcode
+     * Begin and End collect, so place them outside the timed work.
+     */
+    bool BeginROI(const char* name);
+
+    /**
+     * @brief End the current repetition of the named region of interest.
+     * @return false if the region is not active.
+     */
+    bool EndROI(const char* name);
+
+    /**
+     * @brief Record scopes that end while no region or session is active.
+     *
+     * Enabled by default. When disabled, scopes that start or end outside
+     * every active region or session are dropped. Those that start outside
+     * do not read the clock; checking costs a relaxed load at each end.
+     */
+    void SetRecordOutsideROI(bool enabled);
+    bool GetRecordOutsideROI();
+
+    /// Counters and wall-time statistics of a region of interest.
+    struct ROISnapshot
+    {
+        SessionSnapshot Counters;
+        int64_t Repetitions = 0;      ///< Completed BeginROI()/EndROI() pairs.
+        double WallTime = 0.0;        ///< Seconds inside the region, all repetitions.
+        double MinWallTime = 0.0;     ///< Shortest repetition in seconds.
+        double MaxWallTime = 0.0;     ///< Longest repetition in seconds.
+        double StdDevWallTime = 0.0;  ///< Standard deviation of the repetitions.
+
+        double GetMeanWallTime() const
+        {
+            return this->Repetitions ? this->WallTime / this->Repetitions : 0.0;
+        }
+        /// Calls of function @p id per repetition.
+        double GetCallsPerIteration(int id) const
+        {
+            return this->Repetitions
+              ? static_cast<double>(this->Counters.GetCallCount(id)) / this->Repetitions
+              : 0.0;
+        }
+        /// Seconds spent in function @p id per repetition.
+        double GetTimePerIteration(int id) const
+        {
+            return this->Repetitions ? this->Counters.GetTotalTime(id) / this->Repetitions : 0.0;
+        }
+    };
+
+    /// Collect and return the statistics of the named region so far.
+    ROISnapshot GetROISnapshot(const char* name);
+
+    /// Region statistics with per-iteration figures, for functions with calls.
+    std::string GetROIResultsAsString(const char* name);
+
+    /// Settings of Bench(). Times are in seconds.
+    struct BenchOptions
+    {
+        double WarmupTime = 0.01;         ///< Run the body this long before measuring.
+        double MinTime = 0.05;            ///< Calibrate batches to take at least this long.
+        int Repetitions = 10;             ///< Measured batches.
+        int64_t MaxIterations = 1 << 30;  ///< Upper bound of the batch size.
+        /// Reject repetitions further than this many scaled median absolute
+        /// deviations from the median; 0 keeps all.
+        double OutlierThreshold = 3.0;
+    };
+
+    /// Outcome of Bench(). Times are nanoseconds per iteration.
+    struct BenchResult
+    {
+        std::string Name;
+        int Id = -1;                  ///< Function ID the kept repetitions were recorded under.
+        int64_t Iterations = 0;       ///< Iterations per repetition after calibration.
+        std::vector<double> Samples;  ///< Every repetition, outliers included.
+        int Outliers = 0;             ///< Repetitions left out of the statistics below.
+        double Mean = 0.0;
+        double Median = 0.0;
+        double StdDev = 0.0;
+        double Min = 0.0;
+        double Max = 0.0;
+        double ConfidenceLow = 0.0;   ///< 95% confidence interval of the mean.
+        double ConfidenceHigh = 0.0;
+    };
+
+    /**
+     * @brief Micro-benchmark @p body under the function name @p name.
+     *
+     * Runs @p body for the warm-up time, calibrates a batch size that takes
+     * at least MinTime, then times Repetitions batches with the clock of
+     * ScopedTimerHelper. Outliers are rejected by median absolute deviation;
+     * the rest give mean, median, deviation and a 95% confidence interval
+     * (Student t). Kept repetitions are also added to the registry under
+     * @p name, one call per iteration, so benchmark figures read like those
+     * of instrumented production code; not while SetRecordOutsideROI() ignores
+     * scopes and no region or session is active. Use DoNotOptimize() and
+     * ClobberMemory() from PerformanceCountersBench.h to keep the compiler
+     * from discarding the work:
+     * @code
+     * auto result = pc.Bench("Hash", [&]() { DoNotOptimize(Hash(key)); });
+     * @endcode
+     * The body is inlined into the batch loop; one indirect call is made
+     * per batch.
+     */
+    template <class Body>
+    BenchResult Bench(const char* name, Body&& body, const BenchOptions& options = BenchOptions())
+    {
+        return this->RunBench(
+          name,
+          [&body](int64_t iterations)
+          {
+              for (int64_t i = 0; i < iterations; ++i)
+              {
+                  body();
+              }
+          },
+          options);
+    }
+
     /**
      * @brief Print timing results to stdout.
      */
@@ -97,6 +300,20 @@ class PERFORMANCECOUNTERS_EXPORT PerformanceCounters
      */
     int GetFunctionCount();
 
+    /**
+     * @brief Limit the number of function IDs.
+     * @param count Clamped to [1, 262144]; the default and maximum is 262144.
+     *
+     * The last ID below the limit is taken by the entry "<overflow>". Every
+     * name registered after it gets that ID, so its scopes are recorded as
+     * "<overflow>", and GetFunctionId() of the name returns the overflow ID.
+     * A message goes to stderr when the entry is created. Names registered
+     * before keep their IDs; raising the limit again gives new names their
+     * own IDs.
+     */
+    void SetMaxFunctions(int count);
+    int GetMaxFunctions();
+
     /**
      * @brief Get the name of a registered function.
      * @param id The function ID (0 to GetFunctionCount()-1).
@@ -135,6 +352,276 @@ class PERFORMANCECOUNTERS_EXPORT PerformanceCounters
     double GetFunctionAverageTime(int id);
     double GetFunctionAverageTime(const char* name);
 
+    /**
+     * @brief Get the number of per-thread accumulators currently allocated.
+     *
+     * Accumulators are recycled when threads exit (or freed, with pooling
+     * disabled), so this tracks the peak number of concurrently timing
+     * threads rather than the total spawned.
+     */
+    int GetAccumulatorCount();
+
+    /**
+     * @brief Enable or disable pooling of per-thread counter storage.
+     *
+     * When enabled (the default), an exiting thread keeps the counter chunks
+     * it allocated and hands them to the next thread that starts timing, so
+     * short-lived threads running the same code allocate nothing. When
+     * disabled, the accumulator is unlinked on thread exit and freed as soon
+     * as no concurrent CollectAll() can still be visiting it; new threads
+     * allocate fresh storage on first touch.
+     */
+    void SetAccumulatorPooling(bool enabled);
+    bool GetAccumulatorPooling();
+
+    /// Where timed scopes accumulate until CollectAll() adds them to the totals.
+    enum class AccumulationBackend
+    {
+        PerThread,  ///< One counter table per thread (default, portable).
+        PerCpu      ///< One counter table per CPU, updated with Linux rseq.
+    };
+
+    /**
+     * @brief Select the accumulation backend.
+     * @return The backend in use afterwards.
+     *
+     * PerCpu suits oversubscribed workloads with many more threads than
+     * cores: memory grows with CPUs x functions instead of threads x
+     * functions, and CollectAll() sums the per-CPU tables. It needs x86-64
+     * Linux with rseq registered by the C library (glibc 2.35+); where that
+     * is unavailable the request falls back to PerThread, which is returned.
+     * Switching is safe at any time; values recorded under either backend
+     * are kept.
+     */
+    AccumulationBackend SetAccumulationBackend(AccumulationBackend backend);
+    AccumulationBackend GetAccumulationBackend();
+
+    /**
+     * @brief Set the number of threads CollectAll() and report generation use.
+     * @param threads Thread count including the caller; 0 uses one per
+     * hardware thread. Clamped to [1, 64].
+     *
+     * With more than one, a pool of threads - 1 workers is kept. CollectAll()
+     * then flushes the per-thread accumulators in parallel, and reports for
+     * registries of a few thousand functions or more are formatted in
+     * blocks in parallel. This pays off for large registries with many
+     * timing threads. The default of 1 collects on the calling thread only.
+     */
+    void SetCollectThreads(int threads);
+    int GetCollectThreads();
+
+    /**
+     * @brief Time scopes with a virtual clock that only AdvanceVirtualClock() moves.
+     *
+     * Timed scopes, regions of interest and Bench() then measure virtual
+     * nanoseconds, so tests can assert exact totals and simulations run
+     * faster than real time while exercising the regular instrumentation:
+     * @code
+     *     pc.SetVirtualClock(true);
+     *     {
+     *         ScopedTimerNamed("step");
+     *         pc.AdvanceVirtualClock(250);
+     *     }
+     *     pc.CollectAll();  // "step": 1 call, exactly 250 ns
+     * @endcode
+     *
+     * Virtual time continues from where it stood (0 initially). Switching
+     * clocks resets all counters, as times of the two clocks do not mix;
+     * switch while no timed scope or region is running. Bench() bodies must
+     * advance the clock themselves.
+     */
+    void SetVirtualClock(bool enabled);
+    bool GetVirtualClock();
+
+    /// Advance the virtual clock by @p nanoseconds. Safe from any thread.
+    void AdvanceVirtualClock(int64_t nanoseconds);
+
+    /// Settings of StartTrace().
+    struct TraceOptions
+    {
+        /// Event buffers shared by all tracing threads, 4096 events (96 KiB) each.
+        int Buffers = 64;
+        size_t WriteBytes = 1 << 20;     ///< Size of the writes to the file.
+        double MaxBytesPerSecond = 0.0;  ///< Limit of the write rate; 0 is unlimited.
+        bool DirectIo = false;           ///< Bypass the page cache (O_DIRECT), if supported.
+        /// Delta-encode events (5-8 bytes each instead of 24).
+        bool Compact = true;
+        /// Compress event chunks with zstd, if the library was built with it.
+        bool Compress = false;
+    };
+
+    /// Progress of the current or last trace.
+    struct TraceStatistics
+    {
+        bool Active = false;
+        bool DirectIo = false;    ///< Writes bypass the page cache.
+        bool Compressed = false;  ///< Event chunks are zstd-compressed.
+        int64_t EventsWritten = 0;
+        int64_t EventsDropped = 0;  ///< No buffer was free: the writer fell behind.
+        int64_t BytesWritten = 0;
+        bool WriteFailed = false;
+    };
+
+    /**
+     * @brief Stream every timed scope to the trace file at @p path.
+     *
+     * Each thread records the start, end and function ID of its scopes in a
+     * buffer of 4096 events; full buffers go to a background writer thread
+     * that appends them to the file in large sequential writes, see
+     * PerformanceCountersTraceFormat.h. The TraceConvert tool turns the file
+     * into Chrome trace JSON for Perfetto. Timed threads never wait for I/O:
+     * when all Buffers are in use, events are dropped and counted. Scopes
+     * ignored by SetRecordOutsideROI() are not traced either.
+     * @return False if a trace is running or the file cannot be created.
+     */
+    bool StartTrace(const char* path);
+    bool StartTrace(const char* path, const TraceOptions& options);
+
+    /**
+     * @brief Write the buffered events, function names and statistics, and close the file.
+     *
+     * Scopes that end while the trace stops may be left out.
+     * @return False if no trace was running or a write failed.
+     */
+    bool StopTrace();
+
+    TraceStatistics GetTraceStatistics();
+
+    /**
+     * @brief Mark in the trace that the calling thread hands work to another.
+     * @return Link to pass along with the work, for TraceFlowEnd().
+     *
+     * Flows connect the threads a request or task passes through, so
+     * offline tools such as TraceCriticalPath can follow it:
+     * @code
+     *     uint32_t flow = pc.TraceFlowBegin();
+     *     queue.push([flow, &pc]() { pc.TraceFlowEnd(flow); ... });
+     * @endcode
+     * Links are issued whether or not a trace runs; records are only
+     * written while one does.
+     */
+    uint32_t TraceFlowBegin();
+
+    /// Mark that the calling thread resumes the work of link @p flow.
+    void TraceFlowEnd(uint32_t flow);
+
+    /// Time a request spent in one function.
+    struct RequestFunction
+    {
+        int Id = -1;
+        int64_t Calls = 0;
+        int64_t Nanoseconds = 0;  ///< Including nested scopes, like the totals.
+    };
+
+    /// Functions timed between BeginRequest() and EndRequest().
+    struct RequestBreakdown
+    {
+        uint64_t Request = 0;                    ///< ID passed to BeginRequest().
+        int64_t Nanoseconds = 0;                 ///< Latency of the request.
+        std::vector<RequestFunction> Functions;  ///< In order of first call.
+    };
+
+    /// Which request breakdowns are kept for GetSlowRequests().
+    struct RequestRetention
+    {
+        double SlowestFraction = 0.01;  ///< Share of all completed requests returned.
+        int MaxRetained = 1000;         ///< Breakdowns kept at most.
+    };
+
+    /**
+     * @brief Attribute the calling thread's timed scopes to @p request.
+     * @return False if the thread is already inside a request.
+     *
+     * Totals mix all requests; a breakdown shows what one request did:
+     * @code
+     *     pc.BeginRequest(requestId);
+     *     Handle(request);
+     *     const auto* breakdown = pc.EndRequest();  // time per function
+     * @endcode
+     * A request belongs to the thread that began it; scopes it runs on
+     * other threads are not included. The breakdown is built in per-thread
+     * storage that is reused, so steady-state requests do not allocate.
+     */
+    bool BeginRequest(uint64_t request);
+
+    /**
+     * @brief End the calling thread's request.
+     * @return Its breakdown, valid until the thread's next EndRequest(), or
+     * nullptr if no request was running.
+     *
+     * The breakdown is also kept if it is among the MaxRetained slowest so
+     * far, which costs a single compare for faster requests.
+     */
+    const RequestBreakdown* EndRequest();
+
+    void SetRequestRetention(const RequestRetention& retention);
+    RequestRetention GetRequestRetention();
+
+    /**
+     * @brief The slowest SlowestFraction of the requests completed since the last reset.
+     *
+     * Slowest first; at most MaxRetained. ResetAllCounters() clears them.
+     */
+    std::vector<RequestBreakdown> GetSlowRequests();
+
+    /// The slow requests with their functions, one line per function.
+    std::string GetSlowRequestsAsString();
+
+    /// One invocation kept by SetSlowCallCapture().
+    struct SlowCall
+    {
+        int64_t Nanoseconds = 0;  ///< Duration, including nested scopes.
+        int64_t Timestamp = 0;    ///< When it ended, in nanoseconds of the scope clock.
+        uint64_t Thread = 0;      ///< Operating system ID of the calling thread.
+        uint64_t Context = 0;     ///< SetSlowCallContext() of that thread at the time.
+    };
+
+    /**
+     * @brief Keep the @p perFunction slowest calls of every timed function.
+     *
+     * Averages hide rare slow calls; the slowest ones show when they
+     * happened, on which thread, and for what. Each thread compares a scope
+     * with the fastest call it keeps for the function, a single compare for
+     * faster scopes, and keeps slower ones in per-thread heaps that
+     * CollectAll() merges. 0 (the default) turns capture off. Changing the
+     * number discards the calls kept so far, as does ResetAllCounters().
+     */
+    void SetSlowCallCapture(int perFunction);
+    int GetSlowCallCapture();
+
+    /**
+     * @brief Tag the calling thread's slow calls from now on with @p context.
+     *
+     * Any value that explains a slow call, such as a request ID or the size
+     * of the input; 0 until set.
+     */
+    void SetSlowCallContext(uint64_t context);
+
+    /// The slowest calls of function @p id as of the last CollectAll(), slowest first.
+    std::vector<SlowCall> GetSlowCalls(int id);
+
+    /// Approximate heap memory held by the library, in bytes.
+    struct MemoryUsage
+    {
+        size_t Registry = 0;            ///< Names, name lookup and global counters.
+        size_t Accumulators = 0;        ///< All per-thread accumulators, pooled ones included.
+        size_t LargestAccumulator = 0;  ///< Largest single per-thread accumulator.
+        size_t CurrentThread = 0;       ///< Accumulator of the calling thread.
+        size_t PerCpu = 0;              ///< Per-CPU tables, once that backend was selected.
+        int AccumulatorCount = 0;       ///< Same as GetAccumulatorCount().
+
+        size_t Total() const { return this->Registry + this->Accumulators + this->PerCpu; }
+    };
+
+    /**
+     * @brief Report the memory used by the library, for budgeting.
+     *
+     * Per-thread storage is a paged sparse array: a thread pays for a small
+     * fixed header plus one page per 64 neighbouring IDs it has timed, not
+     * for every registered function. Safe to call while threads are timing.
+     */
+    MemoryUsage GetMemoryUsage();
+
     ~PerformanceCounters();
 
   protected:
@@ -150,9 +637,12 @@ class PERFORMANCECOUNTERS_EXPORT PerformanceCounters
     PerformanceCounters(const PerformanceCounters&) = delete;
     void operator=(const PerformanceCounters&) = delete;
 
+    BenchResult RunBench(
+      const char* name, const std::function<void(int64_t)>& batch, const BenchOptions& options);
+
     friend class FunctionRegistry;
     FunctionRegistry& GetRegistry();
-    std::unique_ptr<FunctionRegistry> Registry;
+    FunctionRegistry* Registry = nullptr;  ///< Referenced, see FunctionRegistry::Release().
 };
 
 /**
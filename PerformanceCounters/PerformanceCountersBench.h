@@ -0,0 +1,74 @@
+/**
+ * @file PerformanceCountersBench.h
+ * @brief Helpers for benchmark bodies run by PerformanceCounters::Bench().
+ *
+ * The compiler may drop work whose result is unused, or keep values in
+ * registers across iterations. DoNotOptimize() makes a value count as used
+ * and ClobberMemory() forces pending memory writes to be performed:
+ * @code
+ * #include "PerformanceCountersBench.h"
+ * auto& pc = PerformanceCounters::GetInstance();
+ * std::vector<int> v;
+ * auto result = pc.Bench("PushBack",
+ *   [&]()
+ *   {
+ *       v.reserve(1);
+ *       DoNotOptimize(v.data());
+ *       v.push_back(42);
+ *       ClobberMemory();
+ *       v.clear();
+ *   });
+ * @endcode
+ * Neither emits instructions; they only constrain the optimizer.
+ */
+
+#ifndef PERFORMANCECOUNTERS_BENCH_H
+#define PERFORMANCECOUNTERS_BENCH_H
+
+#include "PerformanceCounters.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+
+/// Treat @p value as read, so computing it cannot be optimized away.
+template <class T>
+inline void DoNotOptimize(const T& value)
+{
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+/// Treat @p value as read and modified, so it cannot be cached or folded.
+/// The value is kept in memory, which works for any type.
+template <class T>
+inline void DoNotOptimize(T& value)
+{
+    asm volatile("" : "+m"(value) : : "memory");
+}
+
+/// Make the compiler assume all memory may be read and written here.
+inline void ClobberMemory()
+{
+    asm volatile("" : : : "memory");
+}
+
+#elif defined(_MSC_VER)
+
+template <class T>
+inline void DoNotOptimize(const T& value)
+{
+    // A volatile read of the first byte anchors the computation of value.
+    (void)*reinterpret_cast<const volatile char*>(&value);
+    _ReadWriteBarrier();
+}
+
+inline void ClobberMemory()
+{
+    _ReadWriteBarrier();
+}
+
+#endif
+
+#endif // PERFORMANCECOUNTERS_BENCH_H
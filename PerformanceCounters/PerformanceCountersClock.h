@@ -0,0 +1,360 @@
+/**
+ * @file PerformanceCountersClock.h
+ * @brief Clock sources for timed scopes, selected at build time.
+ *
+ * A clock source is a struct with static members:
+ * - Name: printable name.
+ * - Now(): current time in the source's own ticks.
+ * - ToNanoseconds(ticks): convert a tick count (usually a sum of
+ *   differences) to nanoseconds.
+ * - FromNanoseconds(ns): the inverse, for times measured by another clock.
+ *
+ * Counters hold ticks; conversion happens when results are read, so the
+ * hot path of a scope is two Now() calls and a subtraction. Available:
+ * - SteadyClockSource: std::chrono::steady_clock, the portable default.
+ * - QpcClockSource: QueryPerformanceCounter, the default on Windows.
+ * - MonotonicRawClockSource: CLOCK_MONOTONIC_RAW (Linux), not slewed by NTP.
+ * - MonotonicCoarseClockSource: CLOCK_MONOTONIC_COARSE (Linux), a read of
+ *   the vDSO page without touching the hardware counter, at tick resolution
+ *   (typically 1-4 ms). Cheapest, for long scopes only.
+ * - TscClockSource: plain rdtsc (x86-64), converted with a rate calibrated
+ *   once against steady_clock. Needs an invariant TSC.
+ *
+ * TimerClock is the source chosen by the PerformanceCounters_CLOCK build
+ * option, which defines one of the PERFORMANCE_COUNTERS_CLOCK_* macros.
+ *
+ * Header-only so tests and benchmarks can compare the sources without
+ * exporting them.
+ *
+ * @internal Not part of public API. Do not include in user code.
+ */
+
+#ifndef PERFORMANCECOUNTERS_CLOCK_H
+#define PERFORMANCECOUNTERS_CLOCK_H
+
+#include <chrono>
+#include <cstdint>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#endif
+
+#ifdef __linux__
+#include <time.h>
+#define PERFORMANCE_COUNTERS_HAVE_POSIX_CLOCKS 1
+#endif
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define PERFORMANCE_COUNTERS_HAVE_TSC 1
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
+#endif
+
+//----------------------------------------------------------------------------
+// steady_clock
+//----------------------------------------------------------------------------
+
+struct SteadyClockSource
+{
+    static constexpr const char* Name = "steady_clock";
+
+    static int64_t Now()
+    {
+        return std::chrono::steady_clock::now().time_since_epoch().count();
+    }
+
+    static int64_t ToNanoseconds(int64_t ticks)
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::duration(ticks))
+          .count();
+    }
+
+    static int64_t FromNanoseconds(int64_t ns)
+    {
+        return std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+          std::chrono::nanoseconds(ns))
+          .count();
+    }
+};
+
+//----------------------------------------------------------------------------
+// QueryPerformanceCounter (Windows)
+//----------------------------------------------------------------------------
+
+#ifdef _WIN32
+
+struct QpcClockSource
+{
+    static constexpr const char* Name = "QueryPerformanceCounter";
+
+    static int64_t Now()
+    {
+        LARGE_INTEGER now;
+        QueryPerformanceCounter(&now);
+        return now.QuadPart;
+    }
+
+    static int64_t Frequency()
+    {
+        static const int64_t freq = []()
+        {
+            LARGE_INTEGER f;
+            QueryPerformanceFrequency(&f);
+            return f.QuadPart;
+        }();
+        return freq;
+    }
+
+    /// Split into seconds and remainder so large totals do not overflow.
+    static int64_t ToNanoseconds(int64_t ticks)
+    {
+        const int64_t freq = Frequency();
+        const int64_t seconds = ticks / freq;
+        const int64_t remainder = ticks % freq;
+        return seconds * 1000000000LL + (remainder * 1000000000LL) / freq;
+    }
+
+    static int64_t FromNanoseconds(int64_t ns)
+    {
+        const int64_t seconds = ns / 1000000000LL;
+        const int64_t remainder = ns % 1000000000LL;
+        return seconds * Frequency() + (remainder * Frequency()) / 1000000000LL;
+    }
+};
+
+#endif // _WIN32
+
+//----------------------------------------------------------------------------
+// clock_gettime (Linux)
+//----------------------------------------------------------------------------
+
+#ifdef PERFORMANCE_COUNTERS_HAVE_POSIX_CLOCKS
+
+/// clock_gettime() of @p Id in nanoseconds.
+template <clockid_t Id>
+struct PosixClockSource
+{
+    static int64_t Now()
+    {
+        timespec now;
+        clock_gettime(Id, &now);
+        return static_cast<int64_t>(now.tv_sec) * 1000000000LL + now.tv_nsec;
+    }
+
+    static int64_t ToNanoseconds(int64_t ticks) { return ticks; }
+    static int64_t FromNanoseconds(int64_t ns) { return ns; }
+};
+
+struct MonotonicRawClockSource : PosixClockSource<CLOCK_MONOTONIC_RAW>
+{
+    static constexpr const char* Name = "CLOCK_MONOTONIC_RAW";
+};
+
+struct MonotonicCoarseClockSource : PosixClockSource<CLOCK_MONOTONIC_COARSE>
+{
+    static constexpr const char* Name = "CLOCK_MONOTONIC_COARSE";
+};
+
+#endif // PERFORMANCE_COUNTERS_HAVE_POSIX_CLOCKS
+
+//----------------------------------------------------------------------------
+// Time stamp counter (x86-64)
+//----------------------------------------------------------------------------
+
+#ifdef PERFORMANCE_COUNTERS_HAVE_TSC
+
+/// Start read: earlier instructions retire before rdtsc, later ones do not
+/// begin before it.
+inline uint64_t ReadTscStart()
+{
+    _mm_lfence();
+    uint64_t ticks = __rdtsc();
+    _mm_lfence();
+    return ticks;
+}
+
+/// Stop read: rdtscp waits for earlier instructions, lfence holds back
+/// later ones. Without rdtscp, fence rdtsc on both sides.
+inline uint64_t ReadTscStop(bool rdtscp)
+{
+    uint64_t ticks;
+    if (rdtscp)
+    {
+        unsigned int aux;
+        ticks = __rdtscp(&aux);
+    }
+    else
+    {
+        _mm_lfence();
+        ticks = __rdtsc();
+    }
+    _mm_lfence();
+    return ticks;
+}
+
+/// A time stamp counter read and the steady_clock time it was taken at.
+struct TscSample
+{
+    uint64_t Ticks = 0;
+    int64_t Nanoseconds = 0;
+};
+
+/// Read the TSC between two adjacent steady_clock reads, keeping the try
+/// with the narrowest bracket: a thread preempted between the reads of one
+/// try gets a wide bracket and loses to the others.
+inline TscSample SampleTsc()
+{
+    TscSample best;
+    int64_t bestWidth = -1;
+    for (int i = 0; i < 64; ++i)
+    {
+        const int64_t before = SteadyClockSource::Now();
+        const uint64_t ticks = ReadTscStart();
+        const int64_t after = SteadyClockSource::Now();
+        if (bestWidth < 0 || after - before < bestWidth)
+        {
+            bestWidth = after - before;
+            best.Ticks = ticks;
+            best.Nanoseconds = SteadyClockSource::ToNanoseconds(before + bestWidth / 2);
+        }
+    }
+    return best;
+}
+
+#endif // PERFORMANCE_COUNTERS_HAVE_TSC
+
+/// Time stamp counter features and rate, probed once per process.
+struct TscInfo
+{
+    bool Invariant = false;  ///< Constant rate in all power states.
+    bool HasRdtscp = false;  ///< Stop reads may use rdtscp.
+    double NanosecondsPerTick = 1.0;
+
+    static const TscInfo& Get()
+    {
+        static const TscInfo info = []()
+        {
+            TscInfo probed;
+#ifdef PERFORMANCE_COUNTERS_HAVE_TSC
+            unsigned int extended[4] = {};
+            unsigned int power[4] = {};
+            unsigned int frequency[4] = {};
+#ifdef _MSC_VER
+            int regs[4];
+            __cpuid(regs, 0);
+            if (static_cast<unsigned int>(regs[0]) >= 0x15)
+            {
+                __cpuid(regs, 0x15);
+                for (int r = 0; r < 3; ++r)
+                {
+                    frequency[r] = static_cast<unsigned int>(regs[r]);
+                }
+            }
+            __cpuid(regs, 0x80000000);
+            unsigned int maxLeaf = static_cast<unsigned int>(regs[0]);
+            if (maxLeaf >= 0x80000007)
+            {
+                __cpuid(regs, 0x80000001);
+                extended[3] = static_cast<unsigned int>(regs[3]);
+                __cpuid(regs, 0x80000007);
+                power[3] = static_cast<unsigned int>(regs[3]);
+            }
+#else
+            if (__get_cpuid_max(0, nullptr) >= 0x15)
+            {
+                __get_cpuid(0x15, &frequency[0], &frequency[1], &frequency[2], &frequency[3]);
+            }
+            unsigned int maxLeaf = __get_cpuid_max(0x80000000, nullptr);
+            if (maxLeaf >= 0x80000007)
+            {
+                __get_cpuid(0x80000001, &extended[0], &extended[1], &extended[2], &extended[3]);
+                __get_cpuid(0x80000007, &power[0], &power[1], &power[2], &power[3]);
+            }
+#endif
+            probed.Invariant = (power[3] >> 8) & 1;
+            probed.HasRdtscp = (extended[3] >> 27) & 1;
+
+            // CPUID 0x15: TSC rate = crystal Hz (ECX) * EBX / EAX, when all
+            // are reported. Hypervisors and older CPUs often leave them zero.
+            if (frequency[0] != 0 && frequency[1] != 0 && frequency[2] != 0)
+            {
+                probed.NanosecondsPerTick = 1e9 * frequency[0] /
+                  (static_cast<double>(frequency[2]) * frequency[1]);
+                return probed;
+            }
+
+            // Otherwise calibrate against steady_clock over a few milliseconds.
+            const TscSample first = SampleTsc();
+            TscSample last = first;
+            while (last.Nanoseconds - first.Nanoseconds < 5000000)
+            {
+                last = SampleTsc();
+            }
+            probed.NanosecondsPerTick = static_cast<double>(last.Nanoseconds - first.Nanoseconds) /
+              static_cast<double>(last.Ticks - first.Ticks);
+#endif
+            return probed;
+        }();
+        return info;
+    }
+};
+
+#ifdef PERFORMANCE_COUNTERS_HAVE_TSC
+
+struct TscClockSource
+{
+    static constexpr const char* Name = "rdtsc";
+
+    static int64_t Now() { return static_cast<int64_t>(__rdtsc()); }
+
+    static int64_t ToNanoseconds(int64_t ticks)
+    {
+        return static_cast<int64_t>(
+          static_cast<double>(ticks) * TscInfo::Get().NanosecondsPerTick + 0.5);
+    }
+
+    static int64_t FromNanoseconds(int64_t ns)
+    {
+        return static_cast<int64_t>(
+          static_cast<double>(ns) / TscInfo::Get().NanosecondsPerTick + 0.5);
+    }
+};
+
+#endif // PERFORMANCE_COUNTERS_HAVE_TSC
+
+//----------------------------------------------------------------------------
+// Selection
+//----------------------------------------------------------------------------
+
+#if defined(PERFORMANCE_COUNTERS_CLOCK_STEADY)
+typedef SteadyClockSource TimerClock;
+#elif defined(PERFORMANCE_COUNTERS_CLOCK_MONOTONIC_RAW)
+#ifndef PERFORMANCE_COUNTERS_HAVE_POSIX_CLOCKS
+#error "CLOCK_MONOTONIC_RAW is only available on Linux"
+#endif
+typedef MonotonicRawClockSource TimerClock;
+#elif defined(PERFORMANCE_COUNTERS_CLOCK_MONOTONIC_COARSE)
+#ifndef PERFORMANCE_COUNTERS_HAVE_POSIX_CLOCKS
+#error "CLOCK_MONOTONIC_COARSE is only available on Linux"
+#endif
+typedef MonotonicCoarseClockSource TimerClock;
+#elif defined(PERFORMANCE_COUNTERS_CLOCK_TSC)
+#ifndef PERFORMANCE_COUNTERS_HAVE_TSC
+#error "The time stamp counter clock is only available on x86-64"
+#endif
+typedef TscClockSource TimerClock;
+#elif defined(_WIN32)
+typedef QpcClockSource TimerClock;
+#else
+typedef SteadyClockSource TimerClock;
+#endif
+
+#endif // PERFORMANCECOUNTERS_CLOCK_H
@@ -0,0 +1,77 @@
+/**
+ * @file PerformanceCountersKernels.h
+ * @brief Loops over counter arrays.
+ *
+ * Per-thread and global counters are stored per chunk as contiguous arrays
+ * (structure of arrays), so the loops of collection are straight array
+ * operations:
+ * - DiffCounters: delta = current - baseline, baseline = current, and a bit
+ *   mask of the lanes that changed. Flushes run it over the shared counters
+ *   of a chunk; the same operation yields the delta between two snapshots.
+ * - LoadCounters and ZeroCounters: copy and clear shared counters.
+ *
+ * Counters that other threads update are std::atomic<int64_t>, read and
+ * written here with relaxed operations one lane at a time. These are plain
+ * scalar loops: MergeBenchmark measured neither SIMD Diff kernels on a
+ * relaxed copy nor this layout ahead of the former per-function loop, for
+ * merge or for reset, so no instruction set specific code is kept.
+ *
+ * Header-only so benchmarks can run the loops without exporting them.
+ *
+ * @internal Not part of public API. Do not include in user code.
+ */
+
+#ifndef PERFORMANCECOUNTERS_KERNELS_H
+#define PERFORMANCECOUNTERS_KERNELS_H
+
+#include <atomic>
+#include <cstdint>
+
+/// delta[i] = current[i] - baseline[i] and baseline[i] = current[i], for
+/// count <= 64; returns a mask with bit i set if delta[i] is non-zero.
+inline uint64_t DiffCounters(const int64_t* current, int64_t* baseline, int64_t* delta, int count)
+{
+    uint64_t changed = 0;
+    for (int i = 0; i < count; ++i)
+    {
+        delta[i] = current[i] - baseline[i];
+        baseline[i] = current[i];
+        changed |= uint64_t(delta[i] != 0) << i;
+    }
+    return changed;
+}
+
+/// DiffCounters() of shared counters, each read with a relaxed load.
+inline uint64_t DiffCounters(
+  const std::atomic<int64_t>* current, int64_t* baseline, int64_t* delta, int count)
+{
+    uint64_t changed = 0;
+    for (int i = 0; i < count; ++i)
+    {
+        const int64_t value = current[i].load(std::memory_order_relaxed);
+        delta[i] = value - baseline[i];
+        baseline[i] = value;
+        changed |= uint64_t(delta[i] != 0) << i;
+    }
+    return changed;
+}
+
+/// copy[i] = values[i], each read with a relaxed load.
+inline void LoadCounters(const std::atomic<int64_t>* values, int64_t* copy, int count)
+{
+    for (int i = 0; i < count; ++i)
+    {
+        copy[i] = values[i].load(std::memory_order_relaxed);
+    }
+}
+
+/// values[i] = 0, each written with a relaxed store.
+inline void ZeroCounters(std::atomic<int64_t>* values, int count)
+{
+    for (int i = 0; i < count; ++i)
+    {
+        values[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+#endif // PERFORMANCECOUNTERS_KERNELS_H
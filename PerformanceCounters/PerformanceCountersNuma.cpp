@@ -0,0 +1,235 @@
+/**
+ * @file PerformanceCountersNuma.cpp
+ * @brief NUMA topology and placement helpers for accumulator storage.
+ */
+
+#include "PerformanceCountersNuma.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#ifdef PERFORMANCE_COUNTERS_USE_HUGE_PAGES
+#include <mutex>
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+#endif
+
+//----------------------------------------------------------------------------
+int NumaNodeCount()
+{
+    static const int count = []()
+    {
+        int nodes = 1;
+#ifdef __linux__
+        // Format is a CPU-list style range such as "0" or "0-3".
+        if (FILE* file = std::fopen("/sys/devices/system/node/possible", "r"))
+        {
+            int first = 0;
+            int last = 0;
+            int fields = std::fscanf(file, "%d-%d", &first, &last);
+            if (fields == 2)
+            {
+                nodes = last + 1;
+            }
+            else if (fields == 1)
+            {
+                nodes = first + 1;
+            }
+            std::fclose(file);
+        }
+#endif
+        return nodes < 1 ? 1 : (nodes > NumaMaxNodes ? NumaMaxNodes : nodes);
+    }();
+    return count;
+}
+
+//----------------------------------------------------------------------------
+int NumaCurrentNode()
+{
+    const int count = NumaNodeCount();
+    if (count == 1)
+    {
+        return 0;
+    }
+#ifdef __linux__
+    unsigned cpu = 0;
+    unsigned node = 0;
+    if (syscall(SYS_getcpu, &cpu, &node, nullptr) == 0)
+    {
+        return static_cast<int>(node % count);
+    }
+#endif
+    return 0;
+}
+
+#ifdef PERFORMANCE_COUNTERS_USE_HUGE_PAGES
+
+namespace
+{
+
+/// Bump allocator over 2 MiB regions with per-size free lists.
+///
+/// Regions are never returned to the system: the arena lives for the whole
+/// process, so threads exiting during shutdown can still free into it.
+class HugePageArena
+{
+  public:
+    void* Allocate(size_t bytes)
+    {
+        std::lock_guard<std::mutex> lock(this->Mutex);
+        if (FreeBlock** list = this->FindList(bytes))
+        {
+            if (FreeBlock* block = *list)
+            {
+                *list = block->Next;
+                return block;
+            }
+        }
+        if (bytes > RegionBytes)
+        {
+            return nullptr;
+        }
+        if (static_cast<size_t>(this->End - this->Cursor) < bytes)
+        {
+            void* region = nullptr;
+            if (posix_memalign(&region, RegionBytes, RegionBytes) != 0)
+            {
+                return nullptr;
+            }
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+            madvise(region, RegionBytes, MADV_HUGEPAGE);
+#endif
+            this->Cursor = static_cast<char*>(region);
+            this->End = this->Cursor + RegionBytes;
+        }
+        void* memory = this->Cursor;
+        this->Cursor += bytes;
+        return memory;
+    }
+
+    void Free(void* memory, size_t bytes)
+    {
+        std::lock_guard<std::mutex> lock(this->Mutex);
+        FreeBlock** list = this->FindList(bytes);
+        if (!list)
+        {
+            // More sizes than expected; the block stays in its region.
+            return;
+        }
+        auto* block = static_cast<FreeBlock*>(memory);
+        block->Next = *list;
+        *list = block;
+    }
+
+  private:
+    static constexpr size_t RegionBytes = size_t(2) << 20;
+    static constexpr int MaxSizes = 4;
+
+    struct FreeBlock
+    {
+        FreeBlock* Next;
+    };
+
+    /// Free list for @p bytes, created on first use; nullptr if out of lists.
+    FreeBlock** FindList(size_t bytes)
+    {
+        for (int i = 0; i < MaxSizes; ++i)
+        {
+            if (this->Sizes[i] == bytes)
+            {
+                return &this->Lists[i];
+            }
+            if (this->Sizes[i] == 0)
+            {
+                this->Sizes[i] = bytes;
+                return &this->Lists[i];
+            }
+        }
+        return nullptr;
+    }
+
+    std::mutex Mutex;
+    char* Cursor = nullptr;
+    char* End = nullptr;
+    size_t Sizes[MaxSizes] = {};
+    FreeBlock* Lists[MaxSizes] = {};
+};
+
+/// One arena per node, intentionally leaked (see HugePageArena).
+HugePageArena& GetArena(int node)
+{
+    static HugePageArena* arenas = new HugePageArena[NumaMaxNodes];
+    return arenas[node];
+}
+
+/// Arena blocks are cache-line aligned so neighbouring pages never share a line.
+size_t ArenaBlockBytes(size_t bytes)
+{
+    return (bytes + 63) & ~size_t(63);
+}
+
+/// Every block starts with a cache line holding the node of the arena it
+/// came from, or -1 for the heap, so it is freed to where it was placed.
+constexpr size_t BlockHeaderBytes = 64;
+constexpr int HeapNode = -1;
+
+} // namespace
+
+#endif // PERFORMANCE_COUNTERS_USE_HUGE_PAGES
+
+//----------------------------------------------------------------------------
+void* AccumulatorAllocate(size_t bytes)
+{
+    void* memory;
+#ifdef PERFORMANCE_COUNTERS_USE_HUGE_PAGES
+    const size_t blockBytes = BlockHeaderBytes + ArenaBlockBytes(bytes);
+    int node = NumaCurrentNode();
+    void* block = GetArena(node).Allocate(blockBytes);
+    if (!block)
+    {
+        block = ::operator new(blockBytes);
+        node = HeapNode;
+    }
+    *static_cast<int*>(block) = node;
+    memory = static_cast<char*>(block) + BlockHeaderBytes;
+#else
+    memory = ::operator new(bytes);
+#endif
+    // Written here, by the thread that will own the storage (first touch).
+    std::memset(memory, 0, bytes);
+    return memory;
+}
+
+//----------------------------------------------------------------------------
+void AccumulatorFree(void* memory, size_t bytes)
+{
+    if (!memory)
+    {
+        return;
+    }
+#ifdef PERFORMANCE_COUNTERS_USE_HUGE_PAGES
+    // Back to the arena of the node the block was placed on, whichever
+    // thread frees it, so the next owner there gets local memory.
+    void* block = static_cast<char*>(memory) - BlockHeaderBytes;
+    const int node = *static_cast<int*>(block);
+    if (node == HeapNode)
+    {
+        ::operator delete(block);
+    }
+    else
+    {
+        GetArena(node).Free(block, BlockHeaderBytes + ArenaBlockBytes(bytes));
+    }
+#else
+    ::operator delete(memory);
+    (void)bytes;
+#endif
+}
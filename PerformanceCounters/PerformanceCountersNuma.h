@@ -0,0 +1,68 @@
+/**
+ * @file PerformanceCountersNuma.h
+ * @brief NUMA topology and placement helpers for accumulator storage.
+ *
+ * Accumulator pages are allocated and zeroed by the thread that will write
+ * them, so the kernel's first-touch policy places them on that thread's
+ * node. Slot pools and global counters are kept per node (see
+ * FunctionRegistry::Impl) so a recycled slot or a flush does not pull
+ * memory across the interconnect.
+ *
+ * When built with PERFORMANCE_COUNTERS_USE_HUGE_PAGES, accumulator pages
+ * are carved from per-node 2 MiB arenas advised for transparent huge pages,
+ * which cuts TLB misses when collectors sweep many threads' tables.
+ *
+ * @internal Not part of public API. Do not include in user code.
+ */
+
+#ifndef PERFORMANCECOUNTERS_NUMA_H
+#define PERFORMANCECOUNTERS_NUMA_H
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+
+/// Nodes with their own slot pool and counter shard. Higher node numbers
+/// share shards modulo this.
+constexpr int NumaMaxNodes = 8;
+
+/// Number of NUMA nodes from /sys (1 where unknown), at most NumaMaxNodes.
+int NumaNodeCount();
+
+/// Node of the CPU the calling thread runs on, in [0, NumaNodeCount()).
+int NumaCurrentNode();
+
+/**
+ * @brief Allocate zeroed accumulator storage.
+ *
+ * The calling thread writes the zeroes, so fresh pages are placed on its
+ * node. Memory comes from the calling node's huge-page arena when that is
+ * built in, and from the heap otherwise.
+ */
+void* AccumulatorAllocate(size_t bytes);
+
+/// Return storage from AccumulatorAllocate(); @p bytes must match. Arena
+/// storage goes back to the arena it came from, not the caller's.
+void AccumulatorFree(void* memory, size_t bytes);
+
+/// Construct @p count value-initialized T in AccumulatorAllocate() storage.
+template <typename T>
+T* NewAccumulatorArray(int count)
+{
+    static_assert(std::is_trivially_destructible<T>::value, "freed without destruction");
+    T* items = static_cast<T*>(AccumulatorAllocate(sizeof(T) * count));
+    for (int i = 0; i < count; ++i)
+    {
+        new (&items[i]) T();
+    }
+    return items;
+}
+
+/// Free an array from NewAccumulatorArray(); @p count must match.
+template <typename T>
+void DeleteAccumulatorArray(T* items, int count)
+{
+    AccumulatorFree(items, sizeof(T) * count);
+}
+
+#endif // PERFORMANCECOUNTERS_NUMA_H
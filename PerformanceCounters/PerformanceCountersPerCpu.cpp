@@ -0,0 +1,78 @@
+/**
+ * @file PerformanceCountersPerCpu.cpp
+ * @brief Per-CPU counter tables for the rseq accumulation backend.
+ */
+
+#include "PerformanceCountersPerCpu.h"
+#include "PerformanceCountersNuma.h"
+
+#ifdef PERFORMANCE_COUNTERS_HAVE_RSEQ
+#include <unistd.h>
+#endif
+
+//----------------------------------------------------------------------------
+bool PerCpuCounters::IsSupported()
+{
+#ifdef PERFORMANCE_COUNTERS_HAVE_RSEQ
+    // glibc leaves __rseq_size at zero when registration is disabled or failed.
+    return __rseq_size > 0 && RseqCurrentCpu() >= 0;
+#else
+    return false;
+#endif
+}
+
+//----------------------------------------------------------------------------
+PerCpuCounters::PerCpuCounters()
+{
+#ifdef PERFORMANCE_COUNTERS_HAVE_RSEQ
+    // Configured rather than online CPUs, so hotplugged CPUs have a table too.
+    long cpus = sysconf(_SC_NPROCESSORS_CONF);
+    this->CpuCount = cpus > 0 ? static_cast<int>(cpus) : 1;
+#else
+    this->CpuCount = 1;
+#endif
+    const size_t directories = static_cast<size_t>(this->CpuCount) * AccumulatorMaxChunks;
+    this->Chunks.reset(new std::atomic<PerCpuCell*>[directories]);
+    this->Bytes.store(sizeof(PerCpuCounters) + directories * sizeof(std::atomic<PerCpuCell*>),
+      std::memory_order_relaxed);
+    for (size_t i = 0; i < directories; ++i)
+    {
+        this->Chunks[i].store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+//----------------------------------------------------------------------------
+PerCpuCounters::~PerCpuCounters()
+{
+    const size_t directories = static_cast<size_t>(this->CpuCount) * AccumulatorMaxChunks;
+    for (size_t i = 0; i < directories; ++i)
+    {
+        DeleteAccumulatorArray(
+          this->Chunks[i].load(std::memory_order_relaxed), AccumulatorChunkSize);
+    }
+}
+
+//----------------------------------------------------------------------------
+PerCpuCell* PerCpuCounters::AllocateChunk(int cpu, int chunk)
+{
+    // Any thread may get here first for a given CPU, so install with CAS. It
+    // runs on that CPU (or just left it), so first touch places the chunk
+    // on the CPU's NUMA node.
+    auto& slot = this->Chunks[cpu * AccumulatorMaxChunks + chunk];
+    auto* cells = NewAccumulatorArray<PerCpuCell>(AccumulatorChunkSize);
+    PerCpuCell* expected = nullptr;
+    if (!slot.compare_exchange_strong(
+          expected, cells, std::memory_order_acq_rel, std::memory_order_acquire))
+    {
+        DeleteAccumulatorArray(cells, AccumulatorChunkSize);
+        return expected;
+    }
+    this->Bytes.fetch_add(sizeof(PerCpuCell) * AccumulatorChunkSize, std::memory_order_relaxed);
+    return cells;
+}
+
+//----------------------------------------------------------------------------
+size_t PerCpuCounters::GetMemoryUsage() const
+{
+    return this->Bytes.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,211 @@
+/**
+ * @file PerformanceCountersPerCpu.h
+ * @brief Per-CPU counter tables updated with Linux restartable sequences.
+ *
+ * Each CPU owns a copy of the chunked counter table. A timed scope adds to
+ * the copy of the CPU it runs on inside an rseq critical section: the
+ * kernel restarts the section if the thread is preempted or migrated
+ * before the add commits, so a plain `add` suffices and no atomic
+ * read-modify-write is issued. Memory is O(CPUs x functions) instead of
+ * O(threads x functions), which matters for oversubscribed workloads with
+ * thousands of threads.
+ *
+ * Requires x86-64 Linux and a C library that registers rseq for every
+ * thread (glibc 2.35 or later). Elsewhere IsSupported() returns false and
+ * the per-thread accumulators are used.
+ *
+ * @internal Not part of public API. Do not include in user code.
+ */
+
+#ifndef PERFORMANCECOUNTERS_PERCPU_H
+#define PERFORMANCECOUNTERS_PERCPU_H
+
+#include "PerformanceCountersPrivate.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+#if defined(PERFORMANCE_COUNTERS_USE_RSEQ) && defined(__linux__) && defined(__x86_64__) &&     \
+  defined(__has_include)
+#if __has_include(<sys/rseq.h>)
+#include <sys/rseq.h>
+#define PERFORMANCE_COUNTERS_HAVE_RSEQ 1
+#endif
+#endif
+
+/**
+ * @struct PerCpuCell
+ * @brief One function's counters on one CPU.
+ *
+ * Value[] is written only inside rseq critical sections on the owning CPU
+ * and read by collectors with relaxed atomic loads. Flushed[] follows the
+ * LocalCounterChunk scheme and is guarded by PerCpuCounters::FlushMutex.
+ *
+ * @internal Not part of public API.
+ */
+struct PerCpuCell
+{
+    int64_t Value[2] = {};    ///< Indexed by PerCpuCounters::Field.
+    int64_t Flushed[2] = {};  ///< Part of Value[] already flushed.
+};
+
+/**
+ * @class PerCpuCounters
+ * @brief Registry-owned per-CPU counter tables.
+ *
+ * @internal Not part of public API.
+ */
+class PerCpuCounters
+{
+  public:
+    enum Field
+    {
+        Elapsed = 0,
+        Calls = 1
+    };
+
+    /// True if the calling thread has rseq registered and the backend is built in.
+    static bool IsSupported();
+
+    PerCpuCounters();
+    ~PerCpuCounters();
+
+    int GetCpuCount() const { return this->CpuCount; }
+
+    /// Heap bytes held by the directories and allocated chunks.
+    size_t GetMemoryUsage() const;
+
+    /// Chunk @p chunk of CPU @p cpu, or nullptr if never touched.
+    PerCpuCell* GetChunk(int cpu, int chunk) const
+    {
+        return this->Chunks[cpu * AccumulatorMaxChunks + chunk].load(std::memory_order_acquire);
+    }
+
+    /**
+     * @brief Add @p value to @p field of function @p id on the current CPU.
+     * @return false if rseq is unavailable to this thread; the caller must
+     * then record the value elsewhere.
+     */
+    bool Add(int id, Field field, int64_t value);
+
+    /// Read @p field of @p cell while other CPUs may be adding to it.
+    static int64_t Read(const PerCpuCell& cell, Field field);
+
+    /// Serializes collectors; see PerCpuCell::Flushed.
+    std::mutex FlushMutex;
+
+  private:
+    PerCpuCounters(const PerCpuCounters&) = delete;
+    void operator=(const PerCpuCounters&) = delete;
+
+    PerCpuCell* AllocateChunk(int cpu, int chunk);
+
+    int CpuCount = 0;
+    std::atomic<size_t> Bytes{ 0 };
+    /// CpuCount directories of AccumulatorMaxChunks chunk pointers each.
+    std::unique_ptr<std::atomic<PerCpuCell*>[]> Chunks;
+};
+
+#ifdef PERFORMANCE_COUNTERS_HAVE_RSEQ
+
+/// CPU the calling thread runs on, from its rseq area (negative if unregistered).
+inline int RseqCurrentCpu()
+{
+    int cpu;
+    // struct rseq::cpu_id lives at offset 4 of the area at %fs:__rseq_offset.
+    __asm__ __volatile__("movl %%fs:4(%1), %0" : "=r"(cpu) : "r"(__rseq_offset));
+    return cpu;
+}
+
+/**
+ * @brief Add @p value to @p *target if the thread is still on @p cpu.
+ *
+ * The critical section is the compare and the add; the add is the commit
+ * instruction. If the kernel preempts, migrates or signals the thread in
+ * between, it jumps to the abort handler (preceded by RSEQ_SIG as the
+ * kernel requires) and this returns false without having written.
+ */
+inline bool RseqAddOnCpu(int64_t* target, int64_t value, int cpu)
+{
+    __asm__ __volatile__ goto(
+      // struct rseq_cs descriptor: version, flags, start_ip, post_commit_offset, abort_ip.
+      ".pushsection __rseq_cs, \"aw\"\n\t"
+      ".balign 32\n\t"
+      "3:\n\t"
+      ".long 0x0, 0x0\n\t"
+      ".quad 1f, (2f - 1f), 4f\n\t"
+      ".popsection\n\t"
+      ".pushsection __rseq_cs_ptr_array, \"aw\"\n\t"
+      ".quad 3b\n\t"
+      ".popsection\n\t"
+      // Arm the critical section: rseq->rseq_cs = &descriptor.
+      "leaq 3b(%%rip), %%rax\n\t"
+      "movq %%rax, %%fs:8(%[offset])\n\t"
+      "1:\n\t"
+      "cmpl %[cpu], %%fs:4(%[offset])\n\t"
+      "jnz %l[abort]\n\t"
+      "addq %[value], %[target]\n\t"
+      "2:\n\t"
+      ".pushsection __rseq_failure, \"ax\"\n\t"
+      // ud1 with RSEQ_SIG as displacement, so the signature decodes as code.
+      ".byte 0x0f, 0xb9, 0x3d\n\t"
+      ".long 0x53053053\n\t"
+      "4:\n\t"
+      "jmp %l[abort]\n\t"
+      ".popsection\n\t"
+      :
+      : [cpu] "r"(cpu), [offset] "r"(__rseq_offset), [target] "m"(*target),
+      [value] "er"(value)
+      : "memory", "cc", "rax"
+      : abort);
+    return true;
+abort:
+    return false;
+}
+
+inline bool PerCpuCounters::Add(int id, Field field, int64_t value)
+{
+    const int chunk = id >> AccumulatorChunkBits;
+    for (;;)
+    {
+        int cpu = RseqCurrentCpu();
+        if (cpu < 0 || cpu >= this->CpuCount)
+        {
+            return false;
+        }
+        PerCpuCell* cells = this->GetChunk(cpu, chunk);
+        if (!cells)
+        {
+            cells = this->AllocateChunk(cpu, chunk);
+        }
+        if (RseqAddOnCpu(&cells[id & AccumulatorChunkMask].Value[field], value, cpu))
+        {
+            return true;
+        }
+    }
+}
+
+inline int64_t PerCpuCounters::Read(const PerCpuCell& cell, Field field)
+{
+    // Value[] is written by rseq critical sections rather than std::atomic.
+    return __atomic_load_n(&cell.Value[field], __ATOMIC_RELAXED);
+}
+
+#else
+
+inline bool PerCpuCounters::Add(int, Field, int64_t)
+{
+    return false;
+}
+
+inline int64_t PerCpuCounters::Read(const PerCpuCell& cell, Field field)
+{
+    // Nothing writes Value[] without rseq.
+    return cell.Value[field];
+}
+
+#endif // PERFORMANCE_COUNTERS_HAVE_RSEQ
+
+#endif // PERFORMANCECOUNTERS_PERCPU_H
@@ -13,38 +13,131 @@
 
 #include "performancecounters_export.h"
 
+#include <atomic>
 #include <cstdint>
-#include <vector>
+
+class FunctionRegistry;
+struct AccumulatorSlot;
+class RequestContext;
+struct TraceBuffer;
+
+/// Function IDs per accumulator chunk, as a power of two. Small chunks keep
+/// threads that touch a few functions of a large registry cheap.
+constexpr int AccumulatorChunkBits = 6;
+constexpr int AccumulatorChunkSize = 1 << AccumulatorChunkBits;
+constexpr int AccumulatorChunkMask = AccumulatorChunkSize - 1;
 
 /**
- * @struct LocalCounters
- * @brief Per-function timing data stored in thread-local accumulators.
+ * @struct LocalCounterChunk
+ * @brief Timing data of AccumulatorChunkSize consecutive function IDs.
+ *
+ * Elapsed and Calls are cumulative and written only by the owning thread,
+ * with relaxed loads and stores (plain moves on common targets, no
+ * read-modify-write). Collectors never write them; instead they remember
+ * how much has already been added to the global counters in the Flushed*
+ * arrays, which are guarded by the slot's flush mutex, and add the
+ * difference. This keeps collection concurrent with timing without losing
+ * updates.
+ *
+ * Fields are arrays indexed by ID within the chunk (structure of arrays),
+ * so a flush diffs a whole chunk in one loop of relaxed loads (see
+ * PerformanceCountersKernels.h).
+ *
+ * SlowThreshold holds the ticks a scope must exceed to be offered as a slow
+ * call (see PerformanceCountersSlowCalls.h); the maximum while capture is
+ * off. It is written under the slot's slow call mutex.
  *
  * @internal Not part of public API.
  */
-struct LocalCounters
+struct LocalCounterChunk
 {
-    int64_t Elapsed = 0;  ///< Accumulated elapsed time in nanoseconds.
-    int Calls = 0;        ///< Accumulated call count.
+    std::atomic<int64_t> Elapsed[AccumulatorChunkSize];        ///< Elapsed TimerClock ticks.
+    std::atomic<int64_t> Calls[AccumulatorChunkSize];          ///< Call counts.
+    int64_t FlushedElapsed[AccumulatorChunkSize];              ///< Part of Elapsed already flushed.
+    int64_t FlushedCalls[AccumulatorChunkSize];                ///< Part of Calls already flushed.
+    std::atomic<int64_t> SlowThreshold[AccumulatorChunkSize];  ///< See above.
 };
 
+/// Chunk pointers per directory page, as a power of two.
+constexpr int AccumulatorDirectoryBits = 6;
+constexpr int AccumulatorDirectorySize = 1 << AccumulatorDirectoryBits;
+constexpr int AccumulatorDirectoryMask = AccumulatorDirectorySize - 1;
+constexpr int AccumulatorDirectoryShift = AccumulatorChunkBits + AccumulatorDirectoryBits;
+
+/// Directory pages per accumulator. Bounds the number of distinct functions.
+constexpr int AccumulatorMaxDirectories = 64;
+constexpr int AccumulatorMaxChunks = AccumulatorMaxDirectories * AccumulatorDirectorySize;
+constexpr int AccumulatorMaxFunctions = AccumulatorMaxChunks * AccumulatorChunkSize;
+
 /**
  * @struct ThreadAccumulator
- * @brief Thread-local storage for per-function timing data.
+ * @brief Thread-local handle to per-function timing data.
  *
  * Accumulates timing data locally to avoid contention, then flushes
- * to global counters periodically.
+ * to global counters periodically. The counter storage is an
+ * AccumulatorSlot owned by the registry: it is claimed from a lock-free
+ * free list on construction and returned to it on thread exit, so
+ * short-lived threads reuse storage instead of registering new entries.
+ *
+ * Storage is a paged sparse array: a small fixed table of directory pages,
+ * each page holding AccumulatorDirectorySize chunk pointers, each chunk
+ * holding AccumulatorChunkSize counters. Pages and chunks are allocated the
+ * first time one of their IDs is touched and never move afterwards, so
+ * collectors can read them while the owning thread keeps timing, and a
+ * thread pays only for the neighbourhoods of the IDs it actually times
+ * rather than for the whole registry.
+ *
+ * Record() sends the scope to the registry's per-CPU tables instead when
+ * that backend is selected, falling back to the slot if rseq fails.
+ *
+ * ResetAllCounters() does not touch accumulators. It advances the
+ * registry's reset epoch instead; Record() compares it with the epoch of
+ * the slot and discards the data recorded before the reset when they
+ * differ, as does the next flush of a thread that records nothing more.
+ *
+ * While a trace runs, timed scopes also append an event to TraceEvents, a
+ * buffer of the registry's TraceSink that the thread owns until it is full.
+ * Flow records of PerformanceCounters::TraceFlowBegin() and TraceFlowEnd()
+ * go to the same buffer. Inside a request (PerformanceCounters::BeginRequest())
+ * timed scopes also add their time to the thread's RequestContext.
+ *
+ * Scopes longer than the SlowThreshold of their ID are kept as slow calls,
+ * tagged with SlowCallContext, in the slot; the per-CPU backend keeps the
+ * thresholds in slot chunks too, but only while slow call capture is on.
+ *
+ * Each recorded ID is also marked in a dirty bitmap, with an atomic
+ * read-modify-write only the first time the ID changes after a flush, so
+ * Flush() and CollectAll() visit the IDs that changed rather than the whole
+ * registry.
+ *
+ * The accumulator holds a reference on its registry, which therefore
+ * outlives the PerformanceCounters singleton if threads exit late.
  *
  * @internal Not part of public API.
  */
 struct PERFORMANCECOUNTERS_EXPORT ThreadAccumulator
 {
-    std::vector<LocalCounters> Counters;  ///< Per-function counters indexed by function ID.
+    FunctionRegistry* Registry;  ///< Registry this thread is bound to (referenced).
+    AccumulatorSlot* Slot;       ///< Counter storage claimed from the registry.
+    TraceBuffer* TraceEvents = nullptr;        ///< Trace buffer being filled, if any.
+    uint32_t TraceThread = 0;                  ///< Thread number in traces; 0 until assigned.
+    RequestContext* Request = nullptr;         ///< Set between BeginRequest() and EndRequest().
+    RequestContext* RequestStorage = nullptr;  ///< Owned; created by the first BeginRequest().
+    uint64_t SlowCallContext = 0;              ///< Set by SetSlowCallContext().
 
     ThreadAccumulator();
     ~ThreadAccumulator();
 
-    void EnsureCapacity(int size);
+    LocalCounterChunk& GetChunk(int id);
+    LocalCounterChunk& AllocateChunk(int id);
+    bool IsRecording() const;
+    bool IsTracing() const;
+    void Trace(int id, int64_t start, int64_t end, uint32_t flow = 0);
+    void Record(int id, int64_t elapsed, int64_t calls = 1);
+    void OfferSlowCall(LocalCounterChunk& chunk, int id, int64_t elapsed, int64_t calls);
+    void DiscardPending();
+    void MarkDirty(int id);
+    void SetDirty(int id);
     void Flush();
 };
 
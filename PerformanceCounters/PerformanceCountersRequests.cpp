@@ -0,0 +1,133 @@
+/**
+ * @file PerformanceCountersRequests.cpp
+ * @brief Per-request breakdowns and retention of the slowest ones.
+ */
+
+#include "PerformanceCountersRequests.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+/// Inverted for a min-heap: the fastest kept request is at the front.
+static bool FasterRequest(const PerformanceCounters::RequestBreakdown& a,
+  const PerformanceCounters::RequestBreakdown& b)
+{
+    return a.Nanoseconds > b.Nanoseconds;
+}
+
+//----------------------------------------------------------------------------
+// RequestContext
+//----------------------------------------------------------------------------
+
+RequestContext::RequestContext()
+{
+    this->Entries.reserve(64);
+    this->Breakdown.Functions.reserve(64);
+}
+
+void RequestContext::Begin(uint64_t request, int64_t start)
+{
+    this->Request = request;
+    this->Start = start;
+}
+
+const PerformanceCounters::RequestBreakdown& RequestContext::End(
+  int64_t end, int64_t (*toNanoseconds)(int64_t))
+{
+    this->Breakdown.Request = this->Request;
+    this->Breakdown.Nanoseconds = toNanoseconds(end - this->Start);
+    this->Breakdown.Functions.resize(this->Entries.size());
+    for (size_t i = 0; i < this->Entries.size(); ++i)
+    {
+        const Entry& entry = this->Entries[i];
+        PerformanceCounters::RequestFunction& function = this->Breakdown.Functions[i];
+        function.Id = entry.Id;
+        function.Calls = entry.Calls;
+        function.Nanoseconds = toNanoseconds(entry.Ticks);
+        this->Positions[entry.Id] = 0;
+    }
+    this->Entries.clear();
+    return this->Breakdown;
+}
+
+//----------------------------------------------------------------------------
+// RequestRetainer
+//----------------------------------------------------------------------------
+
+void RequestRetainer::SetRetention(const PerformanceCounters::RequestRetention& retention)
+{
+    std::lock_guard<std::mutex> lock(this->Mutex);
+    this->Retention = retention;
+    this->Retention.MaxRetained = std::max(0, retention.MaxRetained);
+    while (static_cast<int>(this->Heap.size()) > this->Retention.MaxRetained)
+    {
+        std::pop_heap(this->Heap.begin(), this->Heap.end(), FasterRequest);
+        this->Heap.pop_back();
+    }
+    this->UpdateThreshold();
+}
+
+PerformanceCounters::RequestRetention RequestRetainer::GetRetention()
+{
+    std::lock_guard<std::mutex> lock(this->Mutex);
+    return this->Retention;
+}
+
+std::vector<PerformanceCounters::RequestBreakdown> RequestRetainer::GetSlowest(
+  int64_t& completed)
+{
+    std::vector<PerformanceCounters::RequestBreakdown> slowest;
+    {
+        std::lock_guard<std::mutex> lock(this->Mutex);
+        completed = this->Completed.load(std::memory_order_relaxed);
+        slowest = this->Heap;
+        const double fraction = std::min(1.0, std::max(0.0, this->Retention.SlowestFraction));
+        const size_t wanted =
+          static_cast<size_t>(std::ceil(fraction * static_cast<double>(completed)));
+        std::sort(slowest.begin(), slowest.end(), FasterRequest);
+        slowest.resize(std::min(wanted, slowest.size()));
+    }
+    return slowest;
+}
+
+void RequestRetainer::Reset()
+{
+    std::lock_guard<std::mutex> lock(this->Mutex);
+    this->Heap.clear();
+    this->Completed.store(0, std::memory_order_relaxed);
+    this->UpdateThreshold();
+}
+
+void RequestRetainer::Retain(const PerformanceCounters::RequestBreakdown& breakdown)
+{
+    std::lock_guard<std::mutex> lock(this->Mutex);
+    if (static_cast<int>(this->Heap.size()) < this->Retention.MaxRetained)
+    {
+        this->Heap.push_back(breakdown);
+        std::push_heap(this->Heap.begin(), this->Heap.end(), FasterRequest);
+    }
+    else if (!this->Heap.empty() && breakdown.Nanoseconds > this->Heap.front().Nanoseconds)
+    {
+        // Reuse the storage of the displaced breakdown.
+        std::pop_heap(this->Heap.begin(), this->Heap.end(), FasterRequest);
+        this->Heap.back() = breakdown;
+        std::push_heap(this->Heap.begin(), this->Heap.end(), FasterRequest);
+    }
+    this->UpdateThreshold();
+}
+
+void RequestRetainer::UpdateThreshold()
+{
+    // Caller holds Mutex.
+    int64_t threshold = -1;
+    if (this->Retention.MaxRetained == 0)
+    {
+        threshold = std::numeric_limits<int64_t>::max();
+    }
+    else if (static_cast<int>(this->Heap.size()) == this->Retention.MaxRetained)
+    {
+        threshold = this->Heap.front().Nanoseconds;
+    }
+    this->Threshold.store(threshold, std::memory_order_relaxed);
+}
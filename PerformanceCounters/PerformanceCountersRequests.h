@@ -0,0 +1,119 @@
+/**
+ * @file PerformanceCountersRequests.h
+ * @brief Per-request breakdowns and retention of the slowest ones.
+ *
+ * A thread inside BeginRequest()/EndRequest() points its accumulator at its
+ * RequestContext, and every timed scope adds its time to the context's
+ * breakdown as well as to the counters. Breakdowns are built in storage the
+ * context keeps across requests, so steady-state requests do not allocate.
+ * Finished breakdowns are offered to the registry's RequestRetainer, which
+ * copies only those slower than the fastest one it keeps.
+ *
+ * @internal Not part of public API. Do not include in user code.
+ */
+
+#ifndef PERFORMANCECOUNTERS_REQUESTS_H
+#define PERFORMANCECOUNTERS_REQUESTS_H
+
+#include "PerformanceCounters.h"
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+/**
+ * @class RequestContext
+ * @brief Breakdown of the request running on one thread.
+ *
+ * Used by its thread only.
+ *
+ * @internal Not part of public API.
+ */
+class RequestContext
+{
+  public:
+    RequestContext();
+
+    void Begin(uint64_t request, int64_t start);
+
+    /// Add a scope of function @p id that took @p ticks.
+    void Add(int id, int64_t ticks)
+    {
+        if (static_cast<size_t>(id) >= this->Positions.size())
+        {
+            this->Positions.resize(static_cast<size_t>(id) + 1, 0);
+        }
+        uint32_t& position = this->Positions[id];
+        if (position == 0)
+        {
+            this->Entries.push_back({ id, 0, 0 });
+            position = static_cast<uint32_t>(this->Entries.size());
+        }
+        Entry& entry = this->Entries[position - 1];
+        entry.Calls += 1;
+        entry.Ticks += ticks;
+    }
+
+    /// Finish the request at @p end; the result stays valid until the next End().
+    const PerformanceCounters::RequestBreakdown& End(
+      int64_t end, int64_t (*toNanoseconds)(int64_t));
+
+  private:
+    struct Entry
+    {
+        int Id;
+        int64_t Calls;
+        int64_t Ticks;
+    };
+
+    uint64_t Request = 0;
+    int64_t Start = 0;
+    std::vector<Entry> Entries;       ///< Functions of the request, in order of first call.
+    std::vector<uint32_t> Positions;  ///< 1 + index in Entries by function ID; 0 if absent.
+    PerformanceCounters::RequestBreakdown Breakdown;
+};
+
+/**
+ * @class RequestRetainer
+ * @brief The slowest request breakdowns seen, up to a bound.
+ *
+ * Kept as a min-heap on latency. Offer() compares with the latency of the
+ * fastest kept breakdown, published in an atomic, and takes the lock only
+ * for requests that displace it.
+ *
+ * @internal Not part of public API.
+ */
+class RequestRetainer
+{
+  public:
+    void Offer(const PerformanceCounters::RequestBreakdown& breakdown)
+    {
+        this->Completed.fetch_add(1, std::memory_order_relaxed);
+        if (breakdown.Nanoseconds > this->Threshold.load(std::memory_order_relaxed))
+        {
+            this->Retain(breakdown);
+        }
+    }
+
+    void SetRetention(const PerformanceCounters::RequestRetention& retention);
+    PerformanceCounters::RequestRetention GetRetention();
+
+    /// The slowest SlowestFraction of the completed requests, slowest first.
+    std::vector<PerformanceCounters::RequestBreakdown> GetSlowest(int64_t& completed);
+
+    void Reset();
+
+  private:
+    void Retain(const PerformanceCounters::RequestBreakdown& breakdown);
+    void UpdateThreshold();
+
+    std::mutex Mutex;
+    PerformanceCounters::RequestRetention Retention;           ///< Under Mutex.
+    std::vector<PerformanceCounters::RequestBreakdown> Heap;  ///< Under Mutex.
+    /// Latency a request must exceed to be kept; -1 while there is room.
+    std::atomic<int64_t> Threshold{ -1 };
+    std::atomic<int64_t> Completed{ 0 };
+};
+
+#endif // PERFORMANCECOUNTERS_REQUESTS_H
@@ -0,0 +1,117 @@
+/**
+ * @file PerformanceCountersSlowCalls.cpp
+ * @brief The slowest invocations of each function, with their context.
+ */
+
+#include "PerformanceCountersSlowCalls.h"
+
+#include <algorithm>
+#include <functional>
+#include <thread>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#elif defined(__linux__)
+#include <sys/syscall.h>
+#include <unistd.h>
+#elif defined(__APPLE__)
+#include <pthread.h>
+#endif
+
+/// Inverted for a min-heap: the fastest kept call is at the front.
+static bool FasterCall(const SlowCallSample& a, const SlowCallSample& b)
+{
+    return a.Call.Nanoseconds > b.Call.Nanoseconds;
+}
+
+//----------------------------------------------------------------------------
+// SlowCallHeaps
+//----------------------------------------------------------------------------
+
+int64_t SlowCallHeaps::Offer(int id, const SlowCallSample& sample, int capacity)
+{
+    std::vector<SlowCallSample>& heap = this->Heaps[id];
+    if (static_cast<int>(heap.size()) < capacity ||
+      (!heap.empty() && sample.Call.Nanoseconds > heap.front().Call.Nanoseconds))
+    {
+        heap.push_back(sample);
+        std::push_heap(heap.begin(), heap.end(), FasterCall);
+    }
+    // Also shrinks heaps filled under a larger capacity.
+    while (static_cast<int>(heap.size()) > capacity)
+    {
+        std::pop_heap(heap.begin(), heap.end(), FasterCall);
+        heap.pop_back();
+    }
+    return capacity > 0 && static_cast<int>(heap.size()) == capacity ? heap.front().Ticks : -1;
+}
+
+void SlowCallHeaps::MoveTo(SlowCallHeaps& to, int capacity)
+{
+    for (auto& entry : this->Heaps)
+    {
+        for (const SlowCallSample& sample : entry.second)
+        {
+            to.Offer(entry.first, sample, capacity);
+        }
+        entry.second.clear();
+    }
+}
+
+void SlowCallHeaps::Trim(int capacity)
+{
+    for (auto& entry : this->Heaps)
+    {
+        std::vector<SlowCallSample>& heap = entry.second;
+        while (static_cast<int>(heap.size()) > capacity)
+        {
+            std::pop_heap(heap.begin(), heap.end(), FasterCall);
+            heap.pop_back();
+        }
+    }
+}
+
+std::vector<PerformanceCounters::SlowCall> SlowCallHeaps::Get(int id) const
+{
+    std::vector<PerformanceCounters::SlowCall> calls;
+    auto entry = this->Heaps.find(id);
+    if (entry == this->Heaps.end())
+    {
+        return calls;
+    }
+    std::vector<SlowCallSample> sorted = entry->second;
+    std::sort(sorted.begin(), sorted.end(), FasterCall);
+    calls.reserve(sorted.size());
+    for (const SlowCallSample& sample : sorted)
+    {
+        calls.push_back(sample.Call);
+    }
+    return calls;
+}
+
+void SlowCallHeaps::Clear()
+{
+    for (auto& entry : this->Heaps)
+    {
+        entry.second.clear();
+    }
+}
+
+//----------------------------------------------------------------------------
+uint64_t SlowCallThreadId()
+{
+#if defined(_WIN32)
+    return GetCurrentThreadId();
+#elif defined(__linux__)
+    return static_cast<uint64_t>(syscall(SYS_gettid));
+#elif defined(__APPLE__)
+    uint64_t id = 0;
+    pthread_threadid_np(nullptr, &id);
+    return id;
+#else
+    return std::hash<std::thread::id>()(std::this_thread::get_id());
+#endif
+}
@@ -0,0 +1,67 @@
+/**
+ * @file PerformanceCountersSlowCalls.h
+ * @brief The slowest invocations of each function, with their context.
+ *
+ * Every thread compares the duration of a timed scope with a threshold kept
+ * next to its counters (LocalCounterChunk::SlowThreshold): the duration of
+ * the fastest call it keeps for the function once it keeps the maximum, or
+ * -1 while there is room. Only longer scopes reach the slot's SlowCallHeaps.
+ * Flushes move those into the registry's heaps, which keep the slowest calls
+ * of all threads. A thread's threshold stays valid after its calls moved:
+ * the registry keeps at least as slow calls as the thread did.
+ *
+ * @internal Not part of public API. Do not include in user code.
+ */
+
+#ifndef PERFORMANCECOUNTERS_SLOWCALLS_H
+#define PERFORMANCECOUNTERS_SLOWCALLS_H
+
+#include "PerformanceCounters.h"
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+/// A kept call, with its duration in the ticks the threshold is compared in.
+struct SlowCallSample
+{
+    int64_t Ticks;
+    PerformanceCounters::SlowCall Call;
+};
+
+/**
+ * @class SlowCallHeaps
+ * @brief Per function ID, a min-heap of the slowest calls up to a capacity.
+ *
+ * Not synchronized; the owner of the heaps locks around every use.
+ *
+ * @internal Not part of public API.
+ */
+class SlowCallHeaps
+{
+  public:
+    /**
+     * @brief Keep @p sample if it is among the @p capacity slowest of @p id.
+     * @return Ticks of the fastest kept call once @p capacity are kept, else -1.
+     */
+    int64_t Offer(int id, const SlowCallSample& sample, int capacity);
+
+    /// Offer all calls to @p to, leaving these heaps empty but allocated.
+    void MoveTo(SlowCallHeaps& to, int capacity);
+
+    /// Drop the fastest calls of every ID beyond @p capacity.
+    void Trim(int capacity);
+
+    /// The calls kept for @p id, slowest first.
+    std::vector<PerformanceCounters::SlowCall> Get(int id) const;
+
+    void Clear();
+
+  private:
+    std::unordered_map<int, std::vector<SlowCallSample>> Heaps;
+};
+
+/// ID of the calling thread as the operating system reports it.
+uint64_t SlowCallThreadId();
+
+#endif // PERFORMANCECOUNTERS_SLOWCALLS_H
@@ -0,0 +1,452 @@
+/**
+ * @file PerformanceCountersTrace.cpp
+ * @brief Streaming of scope events to a trace file.
+ */
+
+#include "PerformanceCountersTrace.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/// Alignment and size granularity of direct I/O writes.
+static constexpr size_t DirectIoBlock = 4096;
+
+//----------------------------------------------------------------------------
+// TraceFile
+//----------------------------------------------------------------------------
+
+#ifdef _WIN32
+
+bool TraceFile::Open(const char* path, bool)
+{
+    this->Handle = std::fopen(path, "wb");
+    if (this->Handle)
+    {
+        // Writes are already large; skip the stdio buffer.
+        std::setvbuf(this->Handle, nullptr, _IONBF, 0);
+    }
+    this->Direct = false;
+    return this->Handle != nullptr;
+}
+
+bool TraceFile::Write(const char* data, size_t bytes)
+{
+    return std::fwrite(data, 1, bytes, this->Handle) == bytes;
+}
+
+void TraceFile::Close(uint64_t)
+{
+    if (this->Handle)
+    {
+        std::fclose(this->Handle);
+        this->Handle = nullptr;
+    }
+}
+
+#else
+
+bool TraceFile::Open(const char* path, bool direct)
+{
+    const int flags = O_WRONLY | O_CREAT | O_TRUNC;
+    this->Direct = false;
+#ifdef O_DIRECT
+    if (direct)
+    {
+        // Not every file system supports it (tmpfs does not).
+        this->Handle = open(path, flags | O_DIRECT, 0644);
+        this->Direct = this->Handle >= 0;
+    }
+#else
+    (void)direct;
+#endif
+    if (this->Handle < 0)
+    {
+        this->Handle = open(path, flags, 0644);
+    }
+    return this->Handle >= 0;
+}
+
+bool TraceFile::Write(const char* data, size_t bytes)
+{
+    while (bytes > 0)
+    {
+        ssize_t written = write(this->Handle, data, bytes);
+        if (written <= 0)
+        {
+            return false;
+        }
+        data += written;
+        bytes -= static_cast<size_t>(written);
+    }
+    return true;
+}
+
+void TraceFile::Close(uint64_t size)
+{
+    if (this->Handle < 0)
+    {
+        return;
+    }
+    if (this->Direct && size > 0 && ftruncate(this->Handle, static_cast<off_t>(size)) != 0)
+    {
+        // The padding stays; readers stop at the last complete chunk.
+    }
+    close(this->Handle);
+    this->Handle = -1;
+}
+
+#endif
+
+//----------------------------------------------------------------------------
+// TraceSink
+//----------------------------------------------------------------------------
+
+TraceSink::~TraceSink()
+{
+    this->Stop(std::vector<std::string>());
+}
+
+bool TraceSink::Start(
+  const char* path, const PerformanceCounters::TraceOptions& options, double nsPerTick)
+{
+    std::lock_guard<std::mutex> control(this->ControlMutex);
+    if (this->Active)
+    {
+        return false;
+    }
+    if (!this->File.Open(path, options.DirectIo))
+    {
+        return false;
+    }
+    this->Options = options;
+    this->Options.Buffers = std::max(2, options.Buffers);
+    this->Options.WriteBytes = std::max<size_t>(DirectIoBlock, options.WriteBytes);
+
+    // WriteBytes plus a block, for the padding of direct I/O, plus alignment.
+    this->StagingMemory.reset(new char[this->Options.WriteBytes + 2 * DirectIoBlock]);
+    uintptr_t address = reinterpret_cast<uintptr_t>(this->StagingMemory.get());
+    this->Staging = this->StagingMemory.get() +
+      (DirectIoBlock - address % DirectIoBlock) % DirectIoBlock;
+    this->Staged = 0;
+    this->FileBytes = 0;
+    this->EventsWritten.store(0, std::memory_order_relaxed);
+    this->EventsDropped.store(0, std::memory_order_relaxed);
+    this->BytesWritten.store(0, std::memory_order_relaxed);
+    this->WriteFailed.store(false, std::memory_order_relaxed);
+    this->Started = std::chrono::steady_clock::now();
+
+    this->DirectIo.store(this->File.IsDirect(), std::memory_order_relaxed);
+#ifndef PERFORMANCE_COUNTERS_HAVE_ZSTD
+    this->Options.Compress = false;
+#endif
+    this->Compressing.store(this->Options.Compress, std::memory_order_relaxed);
+
+    TraceFileHeader header = {};
+    std::memcpy(header.Magic, TraceMagic, sizeof(TraceMagic));
+    header.Version = TraceVersion;
+    header.NanosecondsPerTick = nsPerTick;
+    this->AppendBytes(&header, sizeof(header));
+
+    {
+        std::lock_guard<std::mutex> lock(this->Mutex);
+        // Buffers are kept: some may still be owned by threads that traced
+        // before and have not noticed that the trace changed. They do not
+        // count against the limit of this trace.
+        while (static_cast<int>(this->FreeBuffers.size()) < this->Options.Buffers)
+        {
+            this->Buffers.emplace_back(new TraceBuffer);
+            this->FreeBuffers.push_back(this->Buffers.back().get());
+        }
+        this->BufferLimit = this->Options.Buffers;
+        this->Lent = 0;
+        this->Session.fetch_add(1, std::memory_order_relaxed);
+        this->Active = true;
+    }
+    this->Writer = std::thread([this]() { this->Write(); });
+    return true;
+}
+
+bool TraceSink::Stop(const std::vector<std::string>& names)
+{
+    std::lock_guard<std::mutex> control(this->ControlMutex);
+    std::vector<std::pair<TraceBuffer*, uint32_t>> partial;
+    {
+        std::lock_guard<std::mutex> lock(this->Mutex);
+        if (!this->Active)
+        {
+            return false;
+        }
+        this->Active = false;
+        this->Stopping.store(true, std::memory_order_relaxed);
+        // Their owners may keep appending; the events published so far are
+        // part of this trace.
+        const uint64_t session = this->Session.load(std::memory_order_relaxed);
+        for (auto& buffer : this->Buffers)
+        {
+            if (buffer->State == TraceBuffer::Owned && buffer->Session == session)
+            {
+                partial.emplace_back(buffer.get(), buffer->Count.load(std::memory_order_acquire));
+            }
+        }
+    }
+    this->Wake.notify_all();
+    this->Writer.join();
+
+    // The writer has drained the queue and exited; the file is ours.
+    for (const auto& entry : partial)
+    {
+        if (entry.second > 0)
+        {
+            this->AppendEvents(entry.first->Thread, entry.first->Events, entry.second);
+        }
+    }
+
+    std::vector<char> payload;
+    for (size_t id = 0; id < names.size(); ++id)
+    {
+        uint32_t fields[2] = { static_cast<uint32_t>(id), static_cast<uint32_t>(names[id].size()) };
+        const char* bytes = reinterpret_cast<const char*>(fields);
+        payload.insert(payload.end(), bytes, bytes + sizeof(fields));
+        payload.insert(payload.end(), names[id].begin(), names[id].end());
+    }
+    TraceChunkHeader namesHeader = { TraceChunkNames, 0, static_cast<uint32_t>(names.size()),
+        static_cast<uint32_t>(payload.size()) };
+    this->AppendChunk(namesHeader, payload.data());
+
+    TraceStatisticsRecord statistics = {
+        static_cast<uint64_t>(this->EventsWritten.load(std::memory_order_relaxed)),
+        static_cast<uint64_t>(this->EventsDropped.load(std::memory_order_relaxed))
+    };
+    TraceChunkHeader statisticsHeader = { TraceChunkStatistics, 0, 1, sizeof(statistics) };
+    this->AppendChunk(statisticsHeader, &statistics);
+
+    this->WriteStaged(true);
+    this->File.Close(this->FileBytes);
+    this->Stopping.store(false, std::memory_order_relaxed);
+    return !this->WriteFailed.load(std::memory_order_relaxed);
+}
+
+PerformanceCounters::TraceStatistics TraceSink::GetStatistics()
+{
+    PerformanceCounters::TraceStatistics statistics;
+    {
+        std::lock_guard<std::mutex> lock(this->Mutex);
+        statistics.Active = this->Active;
+    }
+    statistics.DirectIo = this->DirectIo.load(std::memory_order_relaxed);
+    statistics.Compressed = this->Compressing.load(std::memory_order_relaxed);
+    statistics.EventsWritten = this->EventsWritten.load(std::memory_order_relaxed);
+    statistics.EventsDropped = this->EventsDropped.load(std::memory_order_relaxed);
+    statistics.BytesWritten = this->BytesWritten.load(std::memory_order_relaxed);
+    statistics.WriteFailed = this->WriteFailed.load(std::memory_order_relaxed);
+    return statistics;
+}
+
+TraceBuffer* TraceSink::Exchange(TraceBuffer* buffer, uint32_t& thread)
+{
+    // Held only to move pointers; the writer never does I/O under it.
+    std::lock_guard<std::mutex> lock(this->Mutex);
+    if (buffer)
+    {
+        // Handed out for an earlier trace, which has already written it.
+        this->Release(buffer);
+    }
+    if (!this->Active)
+    {
+        return nullptr;
+    }
+    if (this->Lent == this->BufferLimit)
+    {
+        this->EventsDropped.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    if (thread == 0)
+    {
+        thread = this->NextThread.fetch_add(1, std::memory_order_relaxed) + 1;
+    }
+    TraceBuffer* fresh = this->FreeBuffers.back();
+    this->FreeBuffers.pop_back();
+    ++this->Lent;
+    fresh->State = TraceBuffer::Owned;
+    fresh->Session = this->Session.load(std::memory_order_relaxed);
+    fresh->Thread = thread;
+    fresh->Count.store(0, std::memory_order_relaxed);
+    return fresh;
+}
+
+void TraceSink::Release(TraceBuffer* buffer)
+{
+    // Caller holds Mutex.
+    if (buffer->Session == this->Session.load(std::memory_order_relaxed))
+    {
+        --this->Lent;
+    }
+    buffer->State = TraceBuffer::Free;
+    this->FreeBuffers.push_back(buffer);
+}
+
+void TraceSink::Submit(TraceBuffer* buffer)
+{
+    {
+        std::lock_guard<std::mutex> lock(this->Mutex);
+        if (!this->Active || buffer->Session != this->Session.load(std::memory_order_relaxed))
+        {
+            // Stop() already wrote what the trace got from it.
+            this->Release(buffer);
+            return;
+        }
+        buffer->State = TraceBuffer::Queued;
+        this->Queue.push_back(buffer);
+    }
+    this->Wake.notify_one();
+}
+
+void TraceSink::Write()
+{
+    std::vector<TraceBuffer*> batch;
+    std::unique_lock<std::mutex> lock(this->Mutex);
+    for (;;)
+    {
+        this->Wake.wait(lock,
+          [this]()
+          { return !this->Queue.empty() || this->Stopping.load(std::memory_order_relaxed); });
+        if (this->Queue.empty())
+        {
+            return;
+        }
+        batch.swap(this->Queue);
+        lock.unlock();
+
+        for (TraceBuffer* buffer : batch)
+        {
+            this->AppendEvents(
+              buffer->Thread, buffer->Events, buffer->Count.load(std::memory_order_acquire));
+        }
+
+        lock.lock();
+        for (TraceBuffer* buffer : batch)
+        {
+            this->Release(buffer);
+        }
+        batch.clear();
+    }
+}
+
+void TraceSink::AppendEvents(uint32_t thread, const TraceEvent* events, uint32_t count)
+{
+    TraceChunkHeader header = { TraceChunkEvents, thread, count,
+        static_cast<uint32_t>(count * sizeof(TraceEvent)) };
+    const void* payload = events;
+    if (this->Options.Compact)
+    {
+        TraceEncodeCompact(events, count, this->Encoded);
+        header.Type = TraceChunkCompactEvents;
+        header.Bytes = static_cast<uint32_t>(this->Encoded.size());
+        payload = this->Encoded.data();
+    }
+    this->EventsWritten.fetch_add(count, std::memory_order_relaxed);
+#ifdef PERFORMANCE_COUNTERS_HAVE_ZSTD
+    if (this->Options.Compress)
+    {
+        // The fastest level: the writer has to keep up with the producers.
+        const size_t bound = ZSTD_compressBound(header.Bytes);
+        this->Compressed.resize(sizeof(header) + bound);
+        std::memcpy(this->Compressed.data(), &header, sizeof(header));
+        const size_t bytes = ZSTD_compress(
+          this->Compressed.data() + sizeof(header), bound, payload, header.Bytes, 1);
+        if (!ZSTD_isError(bytes))
+        {
+            TraceChunkHeader outer = { TraceChunkCompressed, thread, count,
+                static_cast<uint32_t>(sizeof(header) + bytes) };
+            this->AppendChunk(outer, this->Compressed.data());
+            return;
+        }
+    }
+#endif
+    this->AppendChunk(header, payload);
+}
+
+void TraceSink::AppendChunk(const TraceChunkHeader& header, const void* payload)
+{
+    this->AppendBytes(&header, sizeof(header));
+    this->AppendBytes(payload, header.Bytes);
+}
+
+void TraceSink::AppendBytes(const void* data, size_t bytes)
+{
+    const char* next = static_cast<const char*>(data);
+    this->FileBytes += bytes;
+    while (bytes > 0)
+    {
+        size_t n = std::min(bytes, this->Options.WriteBytes + DirectIoBlock - this->Staged);
+        std::memcpy(this->Staging + this->Staged, next, n);
+        this->Staged += n;
+        next += n;
+        bytes -= n;
+        if (this->Staged >= this->Options.WriteBytes)
+        {
+            this->WriteStaged(false);
+        }
+    }
+}
+
+void TraceSink::WriteStaged(bool last)
+{
+    size_t bytes = this->Staged;
+    if (this->File.IsDirect())
+    {
+        // Whole blocks only; the tail is padded once, at the end.
+        if (last)
+        {
+            size_t padded = (bytes + DirectIoBlock - 1) / DirectIoBlock * DirectIoBlock;
+            std::memset(this->Staging + bytes, 0, padded - bytes);
+            bytes = padded;
+        }
+        else
+        {
+            bytes -= bytes % DirectIoBlock;
+        }
+    }
+    if (bytes == 0)
+    {
+        return;
+    }
+
+    // Pace the writer to MaxBytesPerSecond; buffers pile up meanwhile and
+    // tracing threads drop events once the pool is empty. Stop() does not wait.
+    const double rate = this->Options.MaxBytesPerSecond;
+    if (rate > 0.0)
+    {
+        const double due =
+          static_cast<double>(this->BytesWritten.load(std::memory_order_relaxed)) / rate;
+        std::unique_lock<std::mutex> lock(this->Mutex);
+        this->Wake.wait_until(lock,
+          this->Started +
+            std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+              std::chrono::duration<double>(due)),
+          [this]() { return this->Stopping.load(std::memory_order_relaxed); });
+    }
+
+    if (!this->File.Write(this->Staging, bytes))
+    {
+        this->WriteFailed.store(true, std::memory_order_relaxed);
+    }
+    this->BytesWritten.fetch_add(static_cast<int64_t>(std::min(bytes, this->Staged)),
+      std::memory_order_relaxed);
+    if (bytes < this->Staged)
+    {
+        std::memmove(this->Staging, this->Staging + bytes, this->Staged - bytes);
+        this->Staged -= bytes;
+    }
+    else
+    {
+        this->Staged = 0;
+    }
+}
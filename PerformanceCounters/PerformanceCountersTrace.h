@@ -0,0 +1,190 @@
+/**
+ * @file PerformanceCountersTrace.h
+ * @brief Streaming of scope events to a trace file.
+ *
+ * Each tracing thread fills a buffer of TraceBufferEvents events taken from
+ * a fixed pool, and hands it to a background writer when it is full. The
+ * writer batches buffers into large sequential writes of the chunked format
+ * of PerformanceCountersTraceFormat.h, optionally delta-encoded and
+ * compressed, with O_DIRECT and a byte rate limit. Instrumented threads
+ * never wait for I/O: when no buffer is free, because the writer fell
+ * behind or is throttled, events are dropped and counted instead.
+ *
+ * @internal Not part of public API. Do not include in user code.
+ */
+
+#ifndef PERFORMANCECOUNTERS_TRACE_H
+#define PERFORMANCECOUNTERS_TRACE_H
+
+#include "PerformanceCounters.h"
+#include "PerformanceCountersTraceFormat.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/// Events per trace buffer.
+constexpr int TraceBufferEvents = 4096;
+
+/**
+ * @struct TraceBuffer
+ * @brief Events of one thread, owned by that thread until it is full.
+ *
+ * Only the owner writes Events; it publishes them by storing Count with
+ * release, so the trace can be stopped while the owner keeps appending.
+ *
+ * @internal Not part of public API.
+ */
+struct TraceBuffer
+{
+    enum BufferState
+    {
+        Free,
+        Owned,  ///< Held by a tracing thread.
+        Queued  ///< Waiting for or being written by the writer.
+    };
+
+    std::atomic<uint32_t> Count{ 0 };
+    uint64_t Session = 0;  ///< Trace the buffer was handed out for.
+    uint32_t Thread = 0;   ///< Trace thread number of the owner.
+    BufferState State = Free;  ///< Under TraceSink::Mutex.
+    TraceEvent Events[TraceBufferEvents];
+};
+
+/// Trace file written with plain or direct I/O.
+class TraceFile
+{
+  public:
+    TraceFile() = default;
+    ~TraceFile() { this->Close(0); }
+
+    /// Open @p path for writing. Direct I/O is used if requested and supported.
+    bool Open(const char* path, bool direct);
+    bool Write(const char* data, size_t bytes);
+    /// Close, cutting the file to @p size (if non-zero) after direct I/O padding.
+    void Close(uint64_t size);
+    bool IsDirect() const { return this->Direct; }
+
+  private:
+    TraceFile(const TraceFile&) = delete;
+    void operator=(const TraceFile&) = delete;
+
+#ifdef _WIN32
+    std::FILE* Handle = nullptr;
+#else
+    int Handle = -1;
+#endif
+    bool Direct = false;
+};
+
+/**
+ * @class TraceSink
+ * @brief Buffer pool, writer thread and file of the current trace.
+ *
+ * Created on first use and kept by the registry until it is destroyed, so
+ * tracing threads may hold buffers across traces. A buffer handed out for
+ * an earlier trace is returned to the pool the next time its owner traces.
+ *
+ * @internal Not part of public API.
+ */
+class TraceSink
+{
+  public:
+    TraceSink() = default;
+    ~TraceSink();
+
+    /// Start a trace to @p path; false if one is running or the file cannot be opened.
+    bool Start(
+      const char* path, const PerformanceCounters::TraceOptions& options, double nsPerTick);
+
+    /// Write what is buffered, the function @p names and the statistics, and close.
+    bool Stop(const std::vector<std::string>& names);
+
+    PerformanceCounters::TraceStatistics GetStatistics();
+
+    /**
+     * @brief Append an event to the calling thread's @p buffer.
+     *
+     * @p buffer and @p thread belong to the caller, which starts with
+     * nullptr and 0. Takes a new buffer when needed, and submits it when full.
+     */
+    void Append(TraceBuffer*& buffer, uint32_t& thread, int id, int64_t start, int64_t end,
+      uint32_t flow = 0)
+    {
+        if (!buffer || buffer->Session != this->Session.load(std::memory_order_relaxed))
+        {
+            buffer = this->Exchange(buffer, thread);
+            if (!buffer)
+            {
+                return;
+            }
+        }
+        uint32_t n = buffer->Count.load(std::memory_order_relaxed);
+        TraceEvent& event = buffer->Events[n];
+        event.Start = start;
+        event.End = end;
+        event.Id = id;
+        event.Flow = flow;
+        buffer->Count.store(n + 1, std::memory_order_release);
+        if (n + 1 == TraceBufferEvents)
+        {
+            this->Submit(buffer);
+            buffer = nullptr;
+        }
+    }
+
+    /// Queue @p buffer for writing, or return it to the pool if its trace is over.
+    void Submit(TraceBuffer* buffer);
+
+  private:
+    TraceSink(const TraceSink&) = delete;
+    void operator=(const TraceSink&) = delete;
+
+    TraceBuffer* Exchange(TraceBuffer* buffer, uint32_t& thread);
+    void Release(TraceBuffer* buffer);
+    void Write();
+    void AppendEvents(uint32_t thread, const TraceEvent* events, uint32_t count);
+    void AppendChunk(const TraceChunkHeader& header, const void* payload);
+    void AppendBytes(const void* data, size_t bytes);
+    void WriteStaged(bool last);
+
+    std::mutex ControlMutex;  ///< Serializes Start() and Stop().
+    std::mutex Mutex;         ///< Guards the buffer lists and states.
+    std::condition_variable Wake;
+    std::atomic<uint64_t> Session{ 0 };  ///< Incremented by every Start().
+    bool Active = false;
+    std::atomic<bool> Stopping{ false };
+    std::vector<std::unique_ptr<TraceBuffer>> Buffers;
+    std::vector<TraceBuffer*> FreeBuffers;
+    std::vector<TraceBuffer*> Queue;
+    int BufferLimit = 0;  ///< TraceOptions::Buffers of the current trace.
+    int Lent = 0;         ///< Buffers of the current trace owned or queued.
+    std::atomic<uint32_t> NextThread{ 0 };
+
+    std::atomic<int64_t> EventsWritten{ 0 };
+    std::atomic<int64_t> EventsDropped{ 0 };
+    std::atomic<int64_t> BytesWritten{ 0 };
+    std::atomic<bool> WriteFailed{ false };
+    std::atomic<bool> DirectIo{ false };
+    std::atomic<bool> Compressing{ false };
+
+    /// Used by the writer thread, or by Start() and Stop() while it is not running.
+    PerformanceCounters::TraceOptions Options;
+    TraceFile File;
+    std::thread Writer;
+    std::unique_ptr<char[]> StagingMemory;
+    char* Staging = nullptr;  ///< Aligned for direct I/O.
+    size_t Staged = 0;
+    uint64_t FileBytes = 0;  ///< Bytes of the trace, without padding.
+    std::chrono::steady_clock::time_point Started;
+    std::vector<char> Encoded;     ///< Compact payload of the chunk being written.
+    std::vector<char> Compressed;  ///< Compressed chunk being written.
+};
+
+#endif // PERFORMANCECOUNTERS_TRACE_H
@@ -0,0 +1,340 @@
+/**
+ * @file PerformanceCountersTraceFormat.h
+ * @brief Layout of trace files written by PerformanceCounters::StartTrace().
+ *
+ * A trace file is a TraceFileHeader followed by chunks. Every chunk is a
+ * TraceChunkHeader and Bytes of payload, so readers can skip chunk types
+ * they do not know:
+ * - TraceChunkEvents: Count TraceEvent records of one thread, in the order
+ *   the scopes ended. Written as buffers fill, so chunks of different
+ *   threads interleave.
+ * - TraceChunkCompactEvents: the same events delta-encoded, typically 5-8
+ *   bytes each instead of 24. The payload starts with an int64 base time,
+ *   followed per event by LEB128 varints of the function ID, of the
+ *   zigzag-encoded start minus the previous event's start (the base for the
+ *   first), and of the duration. Starts go backwards when nested scopes
+ *   end, hence the zigzag. Flow records (negative IDs) add a varint of Flow.
+ * - TraceChunkCompressed: a zstd frame holding another chunk's payload.
+ *   The payload starts with that chunk's TraceChunkHeader; Thread and Count
+ *   are repeated in the outer header. Readers built without zstd skip it.
+ * - TraceChunkNames: Count records of {uint32 id, uint32 length, name},
+ *   written once when the trace stops.
+ * - TraceChunkStatistics: one TraceStatisticsRecord, written last.
+ *
+ * Event records with a negative Id are flow records: points where a thread
+ * handed work to another (TraceFlowOut) or resumed work handed to it
+ * (TraceFlowIn), at Start == End and linked by Flow. They let offline
+ * tools follow requests and tasks across threads.
+ *
+ * Times are ticks of the library's clock; TraceFileHeader::NanosecondsPerTick
+ * converts them. All fields are in the byte order of the machine that
+ * wrote the file (little-endian on all supported targets).
+ *
+ * ReadTraceFile() loads a whole file, for tests and offline tools.
+ *
+ * @internal Not part of public API. Do not include in user code.
+ */
+
+#ifndef PERFORMANCECOUNTERS_TRACEFORMAT_H
+#define PERFORMANCECOUNTERS_TRACEFORMAT_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifdef PERFORMANCE_COUNTERS_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+/// First bytes of every trace file.
+constexpr char TraceMagic[8] = { 'P', 'C', 'T', 'R', 'A', 'C', 'E', '\0' };
+constexpr uint32_t TraceVersion = 1;
+
+struct TraceFileHeader
+{
+    char Magic[8];
+    uint32_t Version;
+    uint32_t Reserved;
+    double NanosecondsPerTick;
+};
+
+enum TraceChunkType : uint32_t
+{
+    TraceChunkEvents = 1,
+    TraceChunkNames = 2,
+    TraceChunkStatistics = 3,
+    TraceChunkCompactEvents = 4,
+    TraceChunkCompressed = 5
+};
+
+struct TraceChunkHeader
+{
+    uint32_t Type;    ///< A TraceChunkType.
+    uint32_t Thread;  ///< Trace thread number for event chunks, else 0.
+    uint32_t Count;   ///< Records in the payload.
+    uint32_t Bytes;   ///< Payload size.
+};
+
+/// One completed scope, or a flow record.
+struct TraceEvent
+{
+    int64_t Start;  ///< Clock ticks.
+    int64_t End;
+    int32_t Id;     ///< Function ID, named by the names chunk, or a TraceFlowType.
+    uint32_t Flow;  ///< Link of flow records, else 0.
+};
+
+enum TraceFlowType : int32_t
+{
+    TraceFlowOut = -2,  ///< Work leaves this thread, to resume where the same Flow comes in.
+    TraceFlowIn = -3
+};
+
+struct TraceStatisticsRecord
+{
+    uint64_t EventsWritten;
+    uint64_t EventsDropped;  ///< Lost because no buffer was free.
+};
+
+static_assert(sizeof(TraceFileHeader) == 24 && sizeof(TraceChunkHeader) == 16 &&
+    sizeof(TraceEvent) == 24 && sizeof(TraceStatisticsRecord) == 16,
+  "trace records are written as they are laid out in memory");
+
+//----------------------------------------------------------------------------
+// Compact events
+//----------------------------------------------------------------------------
+
+/// Largest compact encoding of one event: varints of up to 5, 10, 10 and 5 bytes.
+constexpr size_t TraceCompactEventBytes = 30;
+
+inline char* TraceWriteVarint(char* next, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        *next++ = static_cast<char>(value | 0x80);
+        value >>= 7;
+    }
+    *next++ = static_cast<char>(value);
+    return next;
+}
+
+/// False if the varint runs past @p end or is longer than 64 bits.
+inline bool TraceReadVarint(const char*& next, const char* end, uint64_t& value)
+{
+    value = 0;
+    for (int shift = 0; shift < 64 && next < end; shift += 7)
+    {
+        const uint8_t byte = static_cast<uint8_t>(*next++);
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/// Replace @p out with the TraceChunkCompactEvents payload of @p count events.
+inline void TraceEncodeCompact(const TraceEvent* events, uint32_t count, std::vector<char>& out)
+{
+    out.resize(sizeof(int64_t) + count * TraceCompactEventBytes);
+    int64_t previous = count > 0 ? events[0].Start : 0;
+    std::memcpy(out.data(), &previous, sizeof(previous));
+    char* next = out.data() + sizeof(previous);
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        // Differences wrap in unsigned arithmetic and wrap back when decoded.
+        const uint64_t delta =
+          static_cast<uint64_t>(events[i].Start) - static_cast<uint64_t>(previous);
+        const uint64_t zigzag = (delta << 1) ^ (0 - (delta >> 63));
+        next = TraceWriteVarint(next, static_cast<uint32_t>(events[i].Id));
+        next = TraceWriteVarint(next, zigzag);
+        next = TraceWriteVarint(
+          next, static_cast<uint64_t>(events[i].End) - static_cast<uint64_t>(events[i].Start));
+        if (events[i].Id < 0)
+        {
+            next = TraceWriteVarint(next, events[i].Flow);
+        }
+        previous = events[i].Start;
+    }
+    out.resize(static_cast<size_t>(next - out.data()));
+}
+
+/// Append the @p count events of a TraceChunkCompactEvents payload; false if it is malformed.
+inline bool TraceDecodeCompact(
+  const char* payload, size_t bytes, uint32_t count, std::vector<TraceEvent>& events)
+{
+    int64_t previous;
+    if (bytes < sizeof(previous))
+    {
+        return false;
+    }
+    std::memcpy(&previous, payload, sizeof(previous));
+    const char* next = payload + sizeof(previous);
+    const char* end = payload + bytes;
+    events.reserve(events.size() + count);
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        uint64_t id;
+        uint64_t zigzag;
+        uint64_t duration;
+        uint64_t flow = 0;
+        if (!TraceReadVarint(next, end, id) || !TraceReadVarint(next, end, zigzag) ||
+          !TraceReadVarint(next, end, duration) ||
+          (static_cast<int32_t>(id) < 0 && !TraceReadVarint(next, end, flow)))
+        {
+            return false;
+        }
+        const uint64_t delta = (zigzag >> 1) ^ (0 - (zigzag & 1));
+        TraceEvent event;
+        event.Start = static_cast<int64_t>(static_cast<uint64_t>(previous) + delta);
+        event.End = static_cast<int64_t>(static_cast<uint64_t>(event.Start) + duration);
+        event.Id = static_cast<int32_t>(static_cast<uint32_t>(id));
+        event.Flow = static_cast<uint32_t>(flow);
+        events.push_back(event);
+        previous = event.Start;
+    }
+    return next == end;
+}
+
+//----------------------------------------------------------------------------
+// Reading
+//----------------------------------------------------------------------------
+
+/// Events of one thread, as read back.
+struct TraceThread
+{
+    uint32_t Thread = 0;
+    std::vector<TraceEvent> Events;
+};
+
+/// A trace file loaded by ReadTraceFile().
+struct TraceFileContents
+{
+    double NanosecondsPerTick = 1.0;
+    std::vector<TraceThread> Threads;  ///< In order of first appearance.
+    std::vector<std::string> Names;    ///< Indexed by function ID.
+    TraceStatisticsRecord Statistics = {};
+    bool Complete = false;  ///< The statistics chunk was found.
+    uint32_t SkippedChunks = 0;  ///< Compressed chunks this build cannot decode.
+};
+
+/// The events of @p contents for trace thread @p thread, added if new.
+inline TraceThread& GetTraceThread(TraceFileContents& contents, uint32_t thread)
+{
+    for (TraceThread& known : contents.Threads)
+    {
+        if (known.Thread == thread)
+        {
+            return known;
+        }
+    }
+    contents.Threads.emplace_back();
+    contents.Threads.back().Thread = thread;
+    return contents.Threads.back();
+}
+
+/// Add the records of one chunk to @p contents; false if the chunk is malformed.
+inline bool ReadTraceChunk(
+  const TraceChunkHeader& chunk, const char* payload, TraceFileContents& contents)
+{
+    if (chunk.Type == TraceChunkEvents && chunk.Bytes == chunk.Count * sizeof(TraceEvent))
+    {
+        TraceThread& thread = GetTraceThread(contents, chunk.Thread);
+        size_t first = thread.Events.size();
+        thread.Events.resize(first + chunk.Count);
+        if (chunk.Count > 0)
+        {
+            std::memcpy(&thread.Events[first], payload, chunk.Bytes);
+        }
+    }
+    else if (chunk.Type == TraceChunkCompactEvents)
+    {
+        return TraceDecodeCompact(
+          payload, chunk.Bytes, chunk.Count, GetTraceThread(contents, chunk.Thread).Events);
+    }
+    else if (chunk.Type == TraceChunkCompressed)
+    {
+        TraceChunkHeader inner;
+        if (chunk.Bytes < sizeof(inner))
+        {
+            return false;
+        }
+        std::memcpy(&inner, payload, sizeof(inner));
+#ifdef PERFORMANCE_COUNTERS_HAVE_ZSTD
+        std::vector<char> decompressed(inner.Bytes);
+        const size_t bytes = ZSTD_decompress(decompressed.data(), decompressed.size(),
+          payload + sizeof(inner), chunk.Bytes - sizeof(inner));
+        if (ZSTD_isError(bytes) || bytes != inner.Bytes || inner.Type == TraceChunkCompressed)
+        {
+            return false;
+        }
+        return ReadTraceChunk(inner, decompressed.data(), contents);
+#else
+        ++contents.SkippedChunks;
+#endif
+    }
+    else if (chunk.Type == TraceChunkNames)
+    {
+        size_t offset = 0;
+        for (uint32_t i = 0; i < chunk.Count && offset + 8 <= chunk.Bytes; ++i)
+        {
+            uint32_t id;
+            uint32_t length;
+            std::memcpy(&id, payload + offset, 4);
+            std::memcpy(&length, payload + offset + 4, 4);
+            offset += 8;
+            if (offset + length > chunk.Bytes)
+            {
+                break;
+            }
+            if (contents.Names.size() <= id)
+            {
+                contents.Names.resize(id + 1);
+            }
+            contents.Names[id].assign(payload + offset, length);
+            offset += length;
+        }
+    }
+    else if (chunk.Type == TraceChunkStatistics && chunk.Bytes == sizeof(TraceStatisticsRecord))
+    {
+        std::memcpy(&contents.Statistics, payload, sizeof(TraceStatisticsRecord));
+        contents.Complete = true;
+    }
+    return true;
+}
+
+/// Load the trace file at @p path; false if it cannot be read or is not a trace.
+inline bool ReadTraceFile(const char* path, TraceFileContents& contents)
+{
+    contents = TraceFileContents();
+    std::FILE* file = std::fopen(path, "rb");
+    if (!file)
+    {
+        return false;
+    }
+    TraceFileHeader header;
+    bool ok = std::fread(&header, sizeof(header), 1, file) == 1 &&
+      std::memcmp(header.Magic, TraceMagic, sizeof(TraceMagic)) == 0 &&
+      header.Version == TraceVersion;
+    contents.NanosecondsPerTick = header.NanosecondsPerTick;
+
+    TraceChunkHeader chunk;
+    std::vector<char> payload;
+    while (ok && std::fread(&chunk, sizeof(chunk), 1, file) == 1)
+    {
+        payload.resize(chunk.Bytes);
+        if (chunk.Bytes && std::fread(payload.data(), chunk.Bytes, 1, file) != 1)
+        {
+            ok = false;
+            break;
+        }
+        ok = ReadTraceChunk(chunk, payload.data(), contents);
+    }
+    std::fclose(file);
+    return ok;
+}
+
+#endif // PERFORMANCECOUNTERS_TRACEFORMAT_H
@@ -0,0 +1,96 @@
+/**
+ * @file PerformanceCountersWorkers.cpp
+ * @brief Small thread pool for parallel collection and reporting.
+ */
+
+#include "PerformanceCountersWorkers.h"
+
+//----------------------------------------------------------------------------
+WorkerPool::WorkerPool(int threads)
+{
+    for (int t = 1; t < threads; ++t)
+    {
+        this->Threads.emplace_back([this]() { this->Work(); });
+    }
+}
+
+//----------------------------------------------------------------------------
+WorkerPool::~WorkerPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(this->Mutex);
+        this->Stop = true;
+    }
+    this->Wake.notify_all();
+    for (auto& thread : this->Threads)
+    {
+        thread.join();
+    }
+}
+
+//----------------------------------------------------------------------------
+void WorkerPool::Run(int parts, const std::function<void(int)>& task)
+{
+    std::unique_lock<std::mutex> running(this->RunMutex, std::try_to_lock);
+    if (!running || this->Threads.empty() || parts < 2)
+    {
+        for (int part = 0; part < parts; ++part)
+        {
+            task(part);
+        }
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(this->Mutex);
+        this->Task = &task;
+        this->Parts = parts;
+        this->NextPart.store(0, std::memory_order_relaxed);
+        this->Busy = static_cast<int>(this->Threads.size());
+        ++this->Generation;
+    }
+    this->Wake.notify_all();
+    this->RunParts();
+
+    std::unique_lock<std::mutex> lock(this->Mutex);
+    this->Done.wait(lock, [this]() { return this->Busy == 0; });
+    this->Task = nullptr;
+}
+
+//----------------------------------------------------------------------------
+void WorkerPool::RunParts()
+{
+    // Task and Parts were published under Mutex before any thread gets here.
+    for (;;)
+    {
+        int part = this->NextPart.fetch_add(1, std::memory_order_relaxed);
+        if (part >= this->Parts)
+        {
+            return;
+        }
+        (*this->Task)(part);
+    }
+}
+
+//----------------------------------------------------------------------------
+void WorkerPool::Work()
+{
+    uint64_t seen = 0;
+    std::unique_lock<std::mutex> lock(this->Mutex);
+    for (;;)
+    {
+        this->Wake.wait(lock, [this, seen]() { return this->Stop || this->Generation != seen; });
+        if (this->Stop)
+        {
+            return;
+        }
+        seen = this->Generation;
+        lock.unlock();
+        this->RunParts();
+        lock.lock();
+        if (--this->Busy == 0)
+        {
+            this->Done.notify_one();
+        }
+    }
+}
@@ -0,0 +1,69 @@
+/**
+ * @file PerformanceCountersWorkers.h
+ * @brief Small thread pool for parallel collection and reporting.
+ *
+ * CollectAll() hands one accumulator per task to the pool, and report
+ * generation one block of function IDs per task. The calling thread works
+ * too, so a pool of N threads runs N - 1 workers.
+ *
+ * @internal Not part of public API. Do not include in user code.
+ */
+
+#ifndef PERFORMANCECOUNTERS_WORKERS_H
+#define PERFORMANCECOUNTERS_WORKERS_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @class WorkerPool
+ * @brief Fixed set of threads that run the parts of one task at a time.
+ *
+ * Workers sleep on a condition variable between tasks. Parts are claimed
+ * from an atomic counter, so uneven parts balance themselves.
+ *
+ * @internal Not part of public API.
+ */
+class WorkerPool
+{
+  public:
+    /// Start @p threads - 1 workers; the caller of Run() is the last thread.
+    explicit WorkerPool(int threads);
+    ~WorkerPool();
+
+    int GetThreadCount() const { return static_cast<int>(this->Threads.size()) + 1; }
+
+    /**
+     * @brief Call @p task for every part in [0, @p parts) and wait for all.
+     *
+     * If another Run() is in progress, the calling thread does all parts
+     * itself rather than waiting for the pool.
+     */
+    void Run(int parts, const std::function<void(int)>& task);
+
+  private:
+    WorkerPool(const WorkerPool&) = delete;
+    void operator=(const WorkerPool&) = delete;
+
+    void Work();
+    void RunParts();
+
+    std::mutex RunMutex;  ///< Held by the thread whose task the pool runs.
+    std::mutex Mutex;     ///< Guards the fields below.
+    std::condition_variable Wake;
+    std::condition_variable Done;
+    const std::function<void(int)>* Task = nullptr;
+    int Parts = 0;
+    std::atomic<int> NextPart{ 0 };
+    int Busy = 0;             ///< Workers still running the current task.
+    uint64_t Generation = 0;  ///< Incremented for every task.
+    bool Stop = false;
+    std::vector<std::thread> Threads;
+};
+
+#endif // PERFORMANCECOUNTERS_WORKERS_H
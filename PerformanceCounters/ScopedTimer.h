@@ -26,6 +26,10 @@
  *     }
  * }
  * @endcode
+ *
+ * For scopes of a few tens of nanoseconds, ScopedTimerPrecise() and
+ * ScopedTimerPreciseNamed() trade a higher cost per scope for clock reads
+ * that the timed instructions cannot cross (see PreciseScopedTimerHelper).
  */
 
 #ifndef SCOPEDTIMER_H
@@ -33,6 +37,7 @@
 
 #include "performancecounters_export.h"
 
+#include <cstdint>
 #include <memory>
 
 // Include PerformanceCounters.h to ensure the Schwarz counter initializer
@@ -58,7 +63,8 @@ class PERFORMANCECOUNTERS_EXPORT FunctionRegistry
     /**
      * @brief Register a function name and get its ID.
      * @param name Function name (typically from __FUNCTION__).
-     * @return ID for the function.
+     * @return ID for the function; the shared "<overflow>" ID once the limit
+     * of PerformanceCounters::SetMaxFunctions() is reached.
      */
     int RegisterFunction(const char* name);
 
@@ -80,9 +86,13 @@ class PERFORMANCECOUNTERS_EXPORT FunctionRegistry
     FunctionRegistry(const FunctionRegistry&) = delete;
     FunctionRegistry& operator=(const FunctionRegistry&) = delete;
 
+    /// Reference counting: the singleton and every live thread accumulator
+    /// hold a reference, so late-exiting threads never flush into freed memory.
+    void Retain();
+    void Release();
+
     friend class PerformanceCounters;
     friend struct ThreadAccumulator;
-    friend struct std::default_delete<FunctionRegistry>;
 
     struct Impl;
     std::unique_ptr<Impl> pImpl;
@@ -95,11 +105,23 @@ class PERFORMANCECOUNTERS_EXPORT FunctionRegistry
  * Records the start time on construction and calculates elapsed time
  * on destruction, accumulating the result in thread-local storage.
  *
+ * Times are raw ticks of the clock selected by the PerformanceCounters_CLOCK
+ * build option (steady_clock by default, QueryPerformanceCounter on
+ * Windows), or virtual nanoseconds while PerformanceCounters::SetVirtualClock()
+ * is on, converted to nanoseconds only when results are read. The timer
+ * lives entirely on the stack.
+ *
  * @par Thread Safety
  * Thread-safe. Each instance operates only on thread-local data.
  *
  * @par Performance
- * - Overhead: ~30-50 ns per timed scope.
+ * - Overhead: the Scope/Empty case of PerformanceCountersBenchmark; on an
+ *   x86-64 Linux VM (Intel Xeon, default clock) about 85-90 ns per timed
+ *   scope in a static build and 90-115 ns in a shared one, where every use
+ *   of the thread-local accumulator is a call. The checks for regions of
+ *   interest, slow calls, requests and tracing, made even while they are
+ *   off, add about 15-25% to the shared build and nothing measurable to
+ *   the static one.
  * - Lock-free after registration.
  */
 class PERFORMANCECOUNTERS_EXPORT ScopedTimerHelper
@@ -120,8 +142,45 @@ class PERFORMANCECOUNTERS_EXPORT ScopedTimerHelper
     ScopedTimerHelper& operator=(const ScopedTimerHelper&) = delete;
 
   private:
-    struct Impl;
-    std::unique_ptr<Impl> pImpl;
+    int Id;
+    int64_t Start;  ///< Clock ticks.
+};
+
+/**
+ * @class PreciseScopedTimerHelper
+ * @brief ScopedTimerHelper with serialized clock reads, for short scopes.
+ *
+ * Out-of-order execution lets instructions of a scope of a few tens of
+ * nanoseconds start before or finish after plain clock reads. On x86-64
+ * with an invariant time stamp counter this timer reads the TSC with
+ * `lfence; rdtsc; lfence` at the start and `rdtscp; lfence` at the stop,
+ * so the timed instructions stay between the reads, and compiler barriers
+ * keep the compiler from moving memory accesses across them. Ticks are
+ * converted with a rate calibrated once against steady_clock. Elsewhere
+ * it uses the clock of ScopedTimerHelper with the compiler barriers only.
+ *
+ * @par Performance
+ * The fences drain the pipeline, so each scope costs more than with
+ * ScopedTimerHelper; compare Scope/Precise with Scope/Empty in
+ * PerformanceCountersBenchmark on the target machine. Use it where the
+ * timed code is short enough for the difference in accuracy to matter.
+ */
+class PERFORMANCECOUNTERS_EXPORT PreciseScopedTimerHelper
+{
+  public:
+    explicit PreciseScopedTimerHelper(int id);
+    ~PreciseScopedTimerHelper();
+
+    PreciseScopedTimerHelper(const PreciseScopedTimerHelper&) = delete;
+    PreciseScopedTimerHelper& operator=(const PreciseScopedTimerHelper&) = delete;
+
+    /// True if scopes are timed with the time stamp counter.
+    static bool UsesTimeStampCounter();
+
+  private:
+    int Id;
+    int64_t Start;  ///< Time stamp counter or clock ticks.
+    bool Tsc;       ///< Start is a time stamp counter read.
 };
 
 // ----------------------------------------------------------------------------
@@ -157,10 +216,33 @@ class PERFORMANCECOUNTERS_EXPORT ScopedTimerHelper
     static const int _pc_timer_id_ = ::FunctionRegistry::Instance().RegisterFunction(name);        \
     ::ScopedTimerHelper _pc_timer_(_pc_timer_id_)
 
+/**
+ * @def ScopedTimerPrecise
+ * @brief Time the current function with serialized clock reads.
+ *
+ * Like ScopedTimer(), using PreciseScopedTimerHelper.
+ */
+#define ScopedTimerPrecise()                                                                       \
+    static const int _pc_timer_id_ =                                                               \
+      ::FunctionRegistry::Instance().RegisterFunction(__FUNCTION__);                               \
+    ::PreciseScopedTimerHelper _pc_timer_(_pc_timer_id_)
+
+/**
+ * @def ScopedTimerPreciseNamed
+ * @brief Time a scope with a custom name and serialized clock reads.
+ *
+ * Like ScopedTimerNamed(), using PreciseScopedTimerHelper.
+ */
+#define ScopedTimerPreciseNamed(name)                                                              \
+    static const int _pc_timer_id_ = ::FunctionRegistry::Instance().RegisterFunction(name);        \
+    ::PreciseScopedTimerHelper _pc_timer_(_pc_timer_id_)
+
 #else
 
-#define ScopedTimer()          ((void)0)
-#define ScopedTimerNamed(name) ((void)0)
+#define ScopedTimer()                 ((void)0)
+#define ScopedTimerNamed(name)        ((void)0)
+#define ScopedTimerPrecise()          ((void)0)
+#define ScopedTimerPreciseNamed(name) ((void)0)
 
 #endif // PERFORMANCE_COUNTERS_DISABLE
 
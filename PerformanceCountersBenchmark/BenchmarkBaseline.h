@@ -0,0 +1,218 @@
+/**
+ * @file BenchmarkBaseline.h
+ * @brief Stored benchmark runs and noise-aware regression checks.
+ *
+ * Results written by BenchmarkHarness are kept one file per commit in a
+ * results directory. A new run is compared against a rolling baseline made
+ * of the most recent stored runs of other commits:
+ *
+ * - Baseline center: median of the stored medians.
+ * - Noise: the larger of the median stored MAD, the MAD of the stored
+ *   medians (run-to-run drift) and the MAD of the new run, scaled by 1.4826
+ *   to estimate a standard deviation.
+ *
+ * A benchmark regresses when its median exceeds the center by more than
+ * `threshold` noise units *and* by more than `tolerance` relative to the
+ * center, so neither a quiet benchmark with a tiny absolute change nor a
+ * noisy one with a large random swing fails the check.
+ */
+
+#ifndef BENCHMARKBASELINE_H
+#define BENCHMARKBASELINE_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+/// Summary statistics of one benchmark in a stored run.
+struct BenchmarkSummary
+{
+    double Median = 0.0;
+    double Mad = 0.0;
+};
+
+/// One stored run, as read back from its JSON file.
+struct BenchmarkRun
+{
+    std::string Commit;
+    std::string Date;
+    std::map<std::string, BenchmarkSummary> Benchmarks;
+};
+
+/// Outcome of comparing one benchmark against the baseline.
+struct BenchmarkComparison
+{
+    std::string Name;
+    double Current = 0.0;    ///< Median of the new run.
+    double Baseline = 0.0;   ///< Median of the stored medians.
+    double Noise = 0.0;      ///< Estimated standard deviation.
+    int BaselineRuns = 0;    ///< Stored runs containing this benchmark.
+    bool Regressed = false;
+
+    /// Relative change of the new run against the baseline.
+    double Change() const { return this->Baseline > 0.0 ? this->Current / this->Baseline - 1 : 0; }
+};
+
+namespace BenchmarkBaselineDetail
+{
+
+/// Return the string or number following `"key": ` on @p line, or empty.
+inline std::string Field(const std::string& line, const std::string& key)
+{
+    std::string pattern = "\"" + key + "\": ";
+    size_t pos = line.find(pattern);
+    if (pos == std::string::npos)
+    {
+        return std::string();
+    }
+    pos += pattern.size();
+    if (line[pos] == '"')
+    {
+        size_t end = line.find('"', pos + 1);
+        return line.substr(pos + 1, end - pos - 1);
+    }
+    size_t end = line.find_first_of(",}]", pos);
+    return line.substr(pos, end - pos);
+}
+
+inline double Median(std::vector<double> values)
+{
+    if (values.empty())
+    {
+        return 0.0;
+    }
+    std::sort(values.begin(), values.end());
+    size_t mid = values.size() / 2;
+    return values.size() % 2 ? values[mid] : 0.5 * (values[mid - 1] + values[mid]);
+}
+
+} // namespace BenchmarkBaselineDetail
+
+/**
+ * @brief Read a run written by BenchmarkHarness::WriteJson().
+ *
+ * This is not a general JSON parser: it relies on the harness writing the
+ * context fields and each benchmark on lines of their own.
+ */
+inline bool ReadBenchmarkRun(const std::filesystem::path& path, BenchmarkRun& run)
+{
+    using BenchmarkBaselineDetail::Field;
+
+    std::ifstream in(path);
+    if (!in)
+    {
+        return false;
+    }
+    std::string line;
+    while (std::getline(in, line))
+    {
+        std::string name = Field(line, "name");
+        if (!name.empty())
+        {
+            BenchmarkSummary summary;
+            summary.Median = std::atof(Field(line, "median").c_str());
+            summary.Mad = std::atof(Field(line, "mad").c_str());
+            run.Benchmarks[name] = summary;
+        }
+        else if (line.find("\"commit\"") != std::string::npos)
+        {
+            run.Commit = Field(line, "commit");
+        }
+        else if (line.find("\"date\"") != std::string::npos)
+        {
+            run.Date = Field(line, "date");
+        }
+    }
+    return !run.Benchmarks.empty();
+}
+
+/**
+ * @brief Load the most recent stored runs, oldest first.
+ * @param directory Results directory (one JSON file per commit).
+ * @param excludeCommit Runs of this commit are skipped.
+ * @param window Maximum number of runs to return.
+ */
+inline std::vector<BenchmarkRun> LoadBenchmarkRuns(
+  const std::string& directory, const std::string& excludeCommit, int window)
+{
+    std::vector<BenchmarkRun> runs;
+    std::error_code error;
+    for (const auto& entry : std::filesystem::directory_iterator(directory, error))
+    {
+        BenchmarkRun run;
+        if (entry.path().extension() == ".json" && ReadBenchmarkRun(entry.path(), run) &&
+          run.Commit != excludeCommit)
+        {
+            runs.push_back(std::move(run));
+        }
+    }
+
+    // ISO 8601 dates sort chronologically as strings.
+    std::sort(runs.begin(), runs.end(),
+      [](const BenchmarkRun& a, const BenchmarkRun& b) { return a.Date < b.Date; });
+    if (static_cast<int>(runs.size()) > window)
+    {
+        runs.erase(runs.begin(), runs.end() - window);
+    }
+    return runs;
+}
+
+/**
+ * @brief Compare a new run against stored runs.
+ * @param current Benchmarks of the new run.
+ * @param baseline Stored runs forming the rolling baseline.
+ * @param threshold Allowed slowdown in estimated standard deviations.
+ * @param tolerance Allowed relative slowdown regardless of noise.
+ */
+inline std::vector<BenchmarkComparison> CompareBenchmarkRuns(const BenchmarkRun& current,
+  const std::vector<BenchmarkRun>& baseline, double threshold, double tolerance)
+{
+    using BenchmarkBaselineDetail::Median;
+
+    std::vector<BenchmarkComparison> comparisons;
+    for (const auto& [name, summary] : current.Benchmarks)
+    {
+        std::vector<double> medians;
+        std::vector<double> mads;
+        for (const auto& run : baseline)
+        {
+            auto it = run.Benchmarks.find(name);
+            if (it != run.Benchmarks.end())
+            {
+                medians.push_back(it->second.Median);
+                mads.push_back(it->second.Mad);
+            }
+        }
+        if (medians.empty())
+        {
+            continue;
+        }
+
+        BenchmarkComparison comparison;
+        comparison.Name = name;
+        comparison.Current = summary.Median;
+        comparison.Baseline = Median(medians);
+        comparison.BaselineRuns = static_cast<int>(medians.size());
+
+        std::vector<double> drift;
+        for (double m : medians)
+        {
+            drift.push_back(std::fabs(m - comparison.Baseline));
+        }
+        double mad = std::max({ Median(mads), Median(drift), summary.Mad });
+        comparison.Noise = 1.4826 * mad;
+
+        double slowdown = comparison.Current - comparison.Baseline;
+        comparison.Regressed = slowdown > threshold * comparison.Noise &&
+          slowdown > tolerance * comparison.Baseline;
+        comparisons.push_back(comparison);
+    }
+    return comparisons;
+}
+
+#endif // BENCHMARKBASELINE_H
@@ -0,0 +1,419 @@
+/**
+ * @file BenchmarkHarness.h
+ * @brief Minimal offline benchmark harness with JSON output.
+ *
+ * Header-only, no dependencies beyond the standard library, so benchmarks
+ * build in the same environments as the library itself.
+ *
+ * Each benchmark is calibrated to run for at least the minimum time per
+ * repetition and is repeated several times. Every repetition contributes one
+ * sample in nanoseconds per operation; the median and the median absolute
+ * deviation (MAD) summarize them robustly against scheduler noise.
+ *
+ * @code
+ * int main(int argc, char* argv[])
+ * {
+ *     BenchmarkHarness harness(argc, argv);
+ *     harness.Run("EmptyScope",
+ *       [](int64_t iterations)
+ *       {
+ *           for (int64_t i = 0; i < iterations; ++i)
+ *           {
+ *               ScopedTimerHelper timer(id);
+ *           }
+ *       });
+ *     return harness.Finish();
+ * }
+ * @endcode
+ *
+ * Command line:
+ * - `--json <file>`        Write results as JSON.
+ * - `--filter <text>`      Only run benchmarks whose name contains text.
+ * - `--repetitions <n>`    Samples per benchmark (default 5).
+ * - `--min-time <ms>`      Minimum time per repetition (default 50 ms).
+ * - `--commit <id>`        Commit recorded in the JSON context.
+ *
+ * Regression tracking (see BenchmarkBaseline.h):
+ * - `--baseline-dir <dir>` Compare against stored runs of other commits and
+ *                          fail if any benchmark regressed.
+ * - `--baseline-window <n>` Number of most recent runs in the baseline (default 5).
+ * - `--threshold <k>`      Allowed slowdown in noise units (default 3).
+ * - `--tolerance <f>`      Allowed relative slowdown (default 0.10).
+ * - `--store-dir <dir>`    Store the run as `<dir>/<commit>.json` unless it regressed.
+ */
+
+#ifndef BENCHMARKHARNESS_H
+#define BENCHMARKHARNESS_H
+
+#include "BenchmarkBaseline.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+/// Summary of one benchmark.
+struct BenchmarkResult
+{
+    std::string Name;
+    int64_t Iterations = 0;       ///< Operations per repetition.
+    std::vector<double> Samples;  ///< Nanoseconds per operation, one per repetition.
+    double Median = 0.0;
+    double Mad = 0.0;  ///< Median absolute deviation from Median.
+    double Min = 0.0;
+
+    /// Operations per second at the median.
+    double ItemsPerSecond() const { return this->Median > 0.0 ? 1e9 / this->Median : 0.0; }
+};
+
+/// Median of @p values (taken by value, reordered).
+inline double BenchmarkMedian(std::vector<double> values)
+{
+    if (values.empty())
+    {
+        return 0.0;
+    }
+    std::sort(values.begin(), values.end());
+    size_t mid = values.size() / 2;
+    return values.size() % 2 ? values[mid] : 0.5 * (values[mid - 1] + values[mid]);
+}
+
+/// Median absolute deviation of @p values around @p median.
+inline double BenchmarkMad(const std::vector<double>& values, double median)
+{
+    std::vector<double> deviations;
+    deviations.reserve(values.size());
+    for (double v : values)
+    {
+        deviations.push_back(std::fabs(v - median));
+    }
+    return BenchmarkMedian(deviations);
+}
+
+/**
+ * @class BenchmarkHarness
+ * @brief Runs, summarizes and reports a set of benchmarks.
+ */
+class BenchmarkHarness
+{
+  public:
+    BenchmarkHarness(int argc, char* argv[])
+    {
+        for (int i = 1; i < argc; ++i)
+        {
+            std::string arg = argv[i];
+            const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+            if (arg == "--json" && value)
+            {
+                this->JsonPath = value;
+                ++i;
+            }
+            else if (arg == "--filter" && value)
+            {
+                this->Filter = value;
+                ++i;
+            }
+            else if (arg == "--repetitions" && value)
+            {
+                this->Repetitions = std::max(1, std::atoi(value));
+                ++i;
+            }
+            else if (arg == "--min-time" && value)
+            {
+                this->MinTimeNs = std::max(1.0, std::atof(value)) * 1e6;
+                ++i;
+            }
+            else if (arg == "--commit" && value)
+            {
+                this->Commit = value;
+                ++i;
+            }
+            else if (arg == "--baseline-dir" && value)
+            {
+                this->BaselineDir = value;
+                ++i;
+            }
+            else if (arg == "--baseline-window" && value)
+            {
+                this->BaselineWindow = std::max(1, std::atoi(value));
+                ++i;
+            }
+            else if (arg == "--threshold" && value)
+            {
+                this->Threshold = std::atof(value);
+                ++i;
+            }
+            else if (arg == "--tolerance" && value)
+            {
+                this->Tolerance = std::atof(value);
+                ++i;
+            }
+            else if (arg == "--store-dir" && value)
+            {
+                this->StoreDir = value;
+                ++i;
+            }
+            else
+            {
+                std::cerr << "Unknown argument: " << arg << "\n";
+                std::exit(EXIT_FAILURE);
+            }
+        }
+    }
+
+    /// True if @p name passes the --filter option.
+    bool Selected(const std::string& name) const
+    {
+        return this->Filter.empty() || name.find(this->Filter) != std::string::npos;
+    }
+
+    /**
+     * @brief Run a calibrated benchmark.
+     * @param body Callable taking the number of operations to perform.
+     */
+    template <class Body>
+    void Run(const std::string& name, Body&& body)
+    {
+        if (!this->Selected(name))
+        {
+            return;
+        }
+
+        // Grow the iteration count until one run is long enough to time reliably.
+        int64_t iterations = 1;
+        double elapsed = 0.0;
+        for (;;)
+        {
+            elapsed = Time(body, iterations);
+            if (elapsed >= this->MinTimeNs / 10 || iterations >= (int64_t(1) << 40))
+            {
+                break;
+            }
+            int64_t factor = 10;
+            if (elapsed > 0.0)
+            {
+                factor = static_cast<int64_t>(this->MinTimeNs / elapsed) + 1;
+            }
+            iterations *= std::min<int64_t>(10, std::max<int64_t>(2, factor));
+        }
+        iterations = std::max<int64_t>(
+          1, static_cast<int64_t>(iterations * this->MinTimeNs / std::max(elapsed, 1.0)));
+
+        BenchmarkResult result;
+        result.Name = name;
+        result.Iterations = iterations;
+        for (int r = 0; r < this->Repetitions; ++r)
+        {
+            result.Samples.push_back(Time(body, iterations) / iterations);
+        }
+        this->Add(std::move(result));
+    }
+
+    /**
+     * @brief Run a benchmark that does its own timing.
+     * @param operations Operations performed by one call of @p body.
+     * @param body Callable returning the elapsed nanoseconds for @p operations.
+     */
+    template <class Body>
+    void RunManual(const std::string& name, int64_t operations, Body&& body)
+    {
+        if (!this->Selected(name))
+        {
+            return;
+        }
+
+        BenchmarkResult result;
+        result.Name = name;
+        result.Iterations = operations;
+        for (int r = 0; r < this->Repetitions; ++r)
+        {
+            result.Samples.push_back(static_cast<double>(body()) / operations);
+        }
+        this->Add(std::move(result));
+    }
+
+    /// Results collected so far, in run order.
+    const std::vector<BenchmarkResult>& GetResults() const { return this->Results; }
+
+    /// Commit recorded in the JSON context.
+    const std::string& GetCommit() const { return this->Commit; }
+
+    /**
+     * @brief Write the JSON report, check for regressions and store the run.
+     * @return Process exit code; failure if any benchmark regressed.
+     */
+    int Finish()
+    {
+        if (!this->JsonPath.empty() && !this->WriteJsonFile(this->JsonPath))
+        {
+            return EXIT_FAILURE;
+        }
+
+        bool regressed = !this->BaselineDir.empty() && this->CheckBaseline();
+
+        if (!this->StoreDir.empty() && !regressed)
+        {
+            std::error_code error;
+            std::filesystem::create_directories(this->StoreDir, error);
+            std::string file = this->Commit;
+            auto unsafe = [](char c)
+            { return !std::isalnum(static_cast<unsigned char>(c)) && c != '-'; };
+            std::replace_if(file.begin(), file.end(), unsafe, '_');
+            auto path = std::filesystem::path(this->StoreDir) / (file + ".json");
+            if (!this->WriteJsonFile(path.string()))
+            {
+                return EXIT_FAILURE;
+            }
+        }
+        return regressed ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
+    /**
+     * @brief Compare against the rolling baseline and print the outcome.
+     * @return True if any benchmark regressed.
+     */
+    bool CheckBaseline() const
+    {
+        auto baseline =
+          LoadBenchmarkRuns(this->BaselineDir, this->Commit, this->BaselineWindow);
+        if (baseline.empty())
+        {
+            std::cout << "\nNo stored runs in " << this->BaselineDir
+                      << "; skipping regression check.\n";
+            return false;
+        }
+
+        BenchmarkRun current;
+        current.Commit = this->Commit;
+        for (const auto& r : this->Results)
+        {
+            current.Benchmarks[r.Name] = BenchmarkSummary{ r.Median, r.Mad };
+        }
+
+        auto comparisons =
+          CompareBenchmarkRuns(current, baseline, this->Threshold, this->Tolerance);
+        bool regressed = false;
+        std::cout << "\n=== Regression check against " << baseline.size()
+                  << " stored run(s) ===\n\n";
+        for (const auto& c : comparisons)
+        {
+            std::cout << std::left << std::setw(44) << c.Name << std::right << std::fixed
+                      << std::setprecision(2) << std::setw(14) << c.Baseline << " -> "
+                      << std::setw(14) << c.Current << " ns  " << std::showpos
+                      << std::setprecision(1) << 100.0 * c.Change() << "%" << std::noshowpos
+                      << (c.Regressed ? "  REGRESSION" : "") << "\n"
+                      << std::defaultfloat;
+            regressed = regressed || c.Regressed;
+        }
+        return regressed;
+    }
+
+    /// Write all results as a JSON document.
+    void WriteJson(std::ostream& out) const
+    {
+        char date[32];
+        std::time_t now = std::time(nullptr);
+        std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+
+        out << std::setprecision(10);
+        out << "{\n"
+            << "  \"context\": {\n"
+            << "    \"date\": \"" << date << "\",\n"
+            << "    \"commit\": \"" << Escape(this->Commit) << "\",\n"
+            << "    \"cpus\": " << std::thread::hardware_concurrency() << ",\n"
+            << "    \"repetitions\": " << this->Repetitions << "\n"
+            << "  },\n"
+            << "  \"benchmarks\": [\n";
+        for (size_t i = 0; i < this->Results.size(); ++i)
+        {
+            const BenchmarkResult& r = this->Results[i];
+            out << "    {\"name\": \"" << Escape(r.Name) << "\", \"unit\": \"ns\""
+                << ", \"iterations\": " << r.Iterations << ", \"median\": " << r.Median
+                << ", \"mad\": " << r.Mad << ", \"min\": " << r.Min
+                << ", \"items_per_second\": " << r.ItemsPerSecond() << ", \"samples\": [";
+            for (size_t s = 0; s < r.Samples.size(); ++s)
+            {
+                out << (s ? ", " : "") << r.Samples[s];
+            }
+            out << "]}" << (i + 1 < this->Results.size() ? "," : "") << "\n";
+        }
+        out << "  ]\n"
+            << "}\n";
+    }
+
+  private:
+    bool WriteJsonFile(const std::string& path) const
+    {
+        std::ofstream out(path);
+        if (!out)
+        {
+            std::cerr << "Cannot write " << path << "\n";
+            return false;
+        }
+        this->WriteJson(out);
+        std::cout << "\nWrote " << path << "\n";
+        return true;
+    }
+
+    template <class Body>
+    static double Time(Body& body, int64_t iterations)
+    {
+        auto start = std::chrono::steady_clock::now();
+        body(iterations);
+        auto end = std::chrono::steady_clock::now();
+        return std::chrono::duration<double, std::nano>(end - start).count();
+    }
+
+    static std::string Escape(const std::string& text)
+    {
+        std::string escaped;
+        for (char c : text)
+        {
+            if (c == '"' || c == '\\')
+            {
+                escaped += '\\';
+            }
+            escaped += c;
+        }
+        return escaped;
+    }
+
+    void Add(BenchmarkResult result)
+    {
+        result.Median = BenchmarkMedian(result.Samples);
+        result.Mad = BenchmarkMad(result.Samples, result.Median);
+        result.Min = *std::min_element(result.Samples.begin(), result.Samples.end());
+
+        std::cout << std::left << std::setw(44) << result.Name << std::right << std::fixed
+                  << std::setprecision(2) << std::setw(14) << result.Median << " ns"
+                  << "  +/- " << std::setw(8) << result.Mad << std::setw(16)
+                  << std::setprecision(0) << result.ItemsPerSecond() << " /s\n"
+                  << std::defaultfloat;
+        this->Results.push_back(std::move(result));
+    }
+
+    std::string JsonPath;
+    std::string Filter;
+    std::string Commit = "unknown";
+    int Repetitions = 5;
+    double MinTimeNs = 50e6;
+    std::string BaselineDir;
+    std::string StoreDir;
+    int BaselineWindow = 5;
+    double Threshold = 3.0;
+    double Tolerance = 0.10;
+    std::vector<BenchmarkResult> Results;
+};
+
+#endif // BENCHMARKHARNESS_H
@@ -0,0 +1,208 @@
+/**
+ * @file MergeBenchmark.cpp
+ * @brief Merge and reset of counter arrays: AoS loop against SoA chunks.
+ *
+ * Models the inner loop of a flush over a table of 10k functions. Before
+ * each merge an owner pass changes a quarter of the counters. The AoS case
+ * is the per-function loop over {Elapsed, Calls, FlushedElapsed,
+ * FlushedCalls} records the library used before its chunks became
+ * structure-of-arrays. The SoA case diffs 64-function chunks with
+ * DiffCounters(), one loop of relaxed loads, as a flush does. Both add the
+ * changed deltas to atomic global totals.
+ *
+ * Reset compares clearing the AoS global counters one atomic at a time with
+ * clearing SoA arrays by ZeroCounters(); both are relaxed stores.
+ *
+ * Accepts the options of BenchmarkHarness.h.
+ */
+
+#include "BenchmarkHarness.h"
+#include "PerformanceCountersKernels.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace
+{
+
+const int Functions = 10240;
+const int ChunkSize = 64;
+const int Chunks = Functions / ChunkSize;
+
+/// Per-function record of the former array-of-structures layout.
+struct AosCounters
+{
+    std::atomic<int64_t> Elapsed{ 0 };
+    std::atomic<int64_t> Calls{ 0 };
+    int64_t FlushedElapsed = 0;
+    int64_t FlushedCalls = 0;
+};
+
+struct AosGlobal
+{
+    std::atomic<int64_t> TotalNanoseconds{ 0 };
+    std::atomic<int64_t> CallCount{ 0 };
+};
+
+/// One chunk in the structure-of-arrays layout.
+struct SoaChunk
+{
+    std::atomic<int64_t> Elapsed[ChunkSize];
+    std::atomic<int64_t> Calls[ChunkSize];
+    int64_t FlushedElapsed[ChunkSize];
+    int64_t FlushedCalls[ChunkSize];
+};
+
+struct SoaGlobal
+{
+    std::atomic<int64_t> TotalNanoseconds[ChunkSize];
+    std::atomic<int64_t> CallCount[ChunkSize];
+};
+
+/// Owner pass: relaxed load + store on every fourth function, like Record().
+template <typename Bump>
+void TouchQuarter(int64_t round, Bump&& bump)
+{
+    for (int id = static_cast<int>(round & 3); id < Functions; id += 4)
+    {
+        bump(id);
+    }
+}
+
+int LowestBit(uint64_t bits)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, bits);
+    return static_cast<int>(index);
+#else
+    return __builtin_ctzll(bits);
+#endif
+}
+
+void Add(std::atomic<int64_t>& value, int64_t delta)
+{
+    value.store(value.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    BenchmarkHarness harness(argc, argv);
+
+    std::cout << "=== Merge Benchmark ===\n\n"
+              << "Functions: " << Functions << "\n\n";
+
+    // --- Merge --------------------------------------------------------------
+
+    {
+        std::unique_ptr<AosCounters[]> local(new AosCounters[Functions]);
+        std::unique_ptr<AosGlobal[]> global(new AosGlobal[Functions]);
+        int64_t round = 0;
+        harness.Run("Merge/AoS",
+          [&](int64_t iterations)
+          {
+              for (int64_t it = 0; it < iterations; ++it, ++round)
+              {
+                  TouchQuarter(round,
+                    [&](int id)
+                    {
+                        Add(local[id].Elapsed, 100);
+                        Add(local[id].Calls, 1);
+                    });
+                  for (int id = 0; id < Functions; ++id)
+                  {
+                      AosCounters& counters = local[id];
+                      int64_t elapsed = counters.Elapsed.load(std::memory_order_relaxed);
+                      int64_t calls = counters.Calls.load(std::memory_order_relaxed);
+                      if (elapsed != counters.FlushedElapsed || calls != counters.FlushedCalls)
+                      {
+                          global[id].TotalNanoseconds.fetch_add(
+                            elapsed - counters.FlushedElapsed, std::memory_order_relaxed);
+                          global[id].CallCount.fetch_add(
+                            calls - counters.FlushedCalls, std::memory_order_relaxed);
+                          counters.FlushedElapsed = elapsed;
+                          counters.FlushedCalls = calls;
+                      }
+                  }
+              }
+          });
+    }
+
+    {
+        std::unique_ptr<SoaChunk[]> local(new SoaChunk[Chunks]());
+        std::unique_ptr<SoaGlobal[]> global(new SoaGlobal[Chunks]());
+        int64_t round = 0;
+        harness.Run("Merge/SoA",
+          [&](int64_t iterations)
+          {
+              int64_t elapsed[ChunkSize];
+              int64_t calls[ChunkSize];
+              for (int64_t it = 0; it < iterations; ++it, ++round)
+              {
+                  TouchQuarter(round,
+                    [&](int id)
+                    {
+                        Add(local[id / ChunkSize].Elapsed[id % ChunkSize], 100);
+                        Add(local[id / ChunkSize].Calls[id % ChunkSize], 1);
+                    });
+                  for (int c = 0; c < Chunks; ++c)
+                  {
+                      SoaChunk& chunk = local[c];
+                      uint64_t changed =
+                        DiffCounters(chunk.Elapsed, chunk.FlushedElapsed, elapsed, ChunkSize);
+                      changed |= DiffCounters(chunk.Calls, chunk.FlushedCalls, calls, ChunkSize);
+                      for (; changed; changed &= changed - 1)
+                      {
+                          int i = LowestBit(changed);
+                          global[c].TotalNanoseconds[i].fetch_add(
+                            elapsed[i], std::memory_order_relaxed);
+                          global[c].CallCount[i].fetch_add(calls[i], std::memory_order_relaxed);
+                      }
+                  }
+              }
+          });
+    }
+
+    // --- Reset --------------------------------------------------------------
+
+    {
+        std::unique_ptr<AosGlobal[]> global(new AosGlobal[Functions]);
+        harness.Run("Reset/AoS",
+          [&](int64_t iterations)
+          {
+              for (int64_t it = 0; it < iterations; ++it)
+              {
+                  for (int id = 0; id < Functions; ++id)
+                  {
+                      global[id].TotalNanoseconds.store(0, std::memory_order_relaxed);
+                      global[id].CallCount.store(0, std::memory_order_relaxed);
+                  }
+              }
+          });
+    }
+
+    {
+        std::unique_ptr<SoaGlobal[]> global(new SoaGlobal[Chunks]());
+        harness.Run("Reset/SoA",
+          [&](int64_t iterations)
+          {
+              for (int64_t it = 0; it < iterations; ++it)
+              {
+                  for (int c = 0; c < Chunks; ++c)
+                  {
+                      ZeroCounters(global[c].TotalNanoseconds, ChunkSize);
+                      ZeroCounters(global[c].CallCount, ChunkSize);
+                  }
+              }
+          });
+    }
+
+    return harness.Finish();
+}
@@ -0,0 +1,269 @@
+/**
+ * @file NumaBenchmark.cpp
+ * @brief Timing and collection cost across NUMA nodes.
+ *
+ * For every node, pins a group of threads to that node's CPUs; each thread
+ * times scopes over a set of functions and then parks so its accumulator
+ * stays live. A collector pinned to each node in turn then runs CollectAll()
+ * over all groups, which shows how much collecting remote accumulators
+ * costs compared with local ones.
+ *
+ * Remote traffic is reported from the kernel's per-node numastat counters
+ * (/sys/devices/system/node/node<N>/numastat): `other_node` counts pages a
+ * process on that node obtained from another node, `numa_miss` and
+ * `numa_foreign` count allocations that missed their preferred node. These
+ * are page placements, not individual memory accesses, which would need
+ * hardware performance counters. On machines without /sys NUMA information
+ * the benchmark runs as a single node and skips the counters.
+ *
+ * Usage: NumaBenchmark [threads per node] [functions] [scopes per thread]
+ */
+
+#include "PerformanceCounters.h"
+#include "ScopedTimer.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+namespace
+{
+
+/// Online node numbers and their CPUs, from /sys; one pseudo node elsewhere.
+std::map<int, std::vector<int>> ReadNodes()
+{
+    std::map<int, std::vector<int>> nodes;
+#ifdef __linux__
+    for (int node = 0; node < 1024; ++node)
+    {
+        std::ifstream in("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+        if (!in)
+        {
+            continue;
+        }
+        // CPU list format: "0-3,8-11".
+        std::string ranges;
+        std::getline(in, ranges);
+        std::stringstream list(ranges);
+        std::string range;
+        while (std::getline(list, range, ','))
+        {
+            if (range.empty())
+            {
+                continue;
+            }
+            size_t dash = range.find('-');
+            int first = std::atoi(range.c_str());
+            int last = dash == std::string::npos ? first : std::atoi(range.c_str() + dash + 1);
+            for (int cpu = first; cpu <= last; ++cpu)
+            {
+                nodes[node].push_back(cpu);
+            }
+        }
+    }
+#endif
+    if (nodes.empty())
+    {
+        nodes[0] = {};
+    }
+    return nodes;
+}
+
+/// numastat counters of @p node, empty if unavailable.
+std::map<std::string, int64_t> ReadNumaStat(int node)
+{
+    std::map<std::string, int64_t> stats;
+    std::ifstream in("/sys/devices/system/node/node" + std::to_string(node) + "/numastat");
+    std::string key;
+    int64_t value = 0;
+    while (in >> key >> value)
+    {
+        stats[key] = value;
+    }
+    return stats;
+}
+
+/// Restrict the calling thread to @p cpus (no-op if empty or unsupported).
+void PinToCpus(const std::vector<int>& cpus)
+{
+#ifdef __linux__
+    if (cpus.empty())
+    {
+        return;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus)
+    {
+        if (cpu < CPU_SETSIZE)
+        {
+            CPU_SET(cpu, &set);
+        }
+    }
+    sched_setaffinity(0, sizeof(set), &set);
+#else
+    (void)cpus;
+#endif
+}
+
+/// Threads pinned to one node that time scopes and park until released.
+class NodeGroup
+{
+  public:
+    NodeGroup(const std::vector<int>& cpus, int numThreads, const std::vector<int>& ids,
+      int scopesPerThread)
+    {
+        auto start = std::chrono::steady_clock::now();
+        for (int t = 0; t < numThreads; ++t)
+        {
+            this->Threads.emplace_back(
+              [this, &cpus, &ids, scopesPerThread]()
+              {
+                  PinToCpus(cpus);
+                  const int n = static_cast<int>(ids.size());
+                  for (int i = 0; i < scopesPerThread; ++i)
+                  {
+                      ScopedTimerHelper timer(ids[i % n]);
+                  }
+                  std::unique_lock<std::mutex> lock(this->Mutex);
+                  ++this->Ready;
+                  this->Changed.notify_all();
+                  this->Changed.wait(lock, [this]() { return this->Released; });
+              });
+        }
+        std::unique_lock<std::mutex> lock(this->Mutex);
+        this->Changed.wait(lock, [this, numThreads]() { return this->Ready == numThreads; });
+        auto end = std::chrono::steady_clock::now();
+        this->TimingNs = std::chrono::duration<double, std::nano>(end - start).count() /
+          (static_cast<double>(numThreads) * scopesPerThread);
+    }
+
+    ~NodeGroup()
+    {
+        {
+            std::lock_guard<std::mutex> lock(this->Mutex);
+            this->Released = true;
+        }
+        this->Changed.notify_all();
+        for (auto& thread : this->Threads)
+        {
+            thread.join();
+        }
+    }
+
+    double TimingNs = 0.0;  ///< Wall time per scope while the group was timing.
+
+  private:
+    std::mutex Mutex;
+    std::condition_variable Changed;
+    int Ready = 0;
+    bool Released = false;
+    std::vector<std::thread> Threads;
+};
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    const int threadsPerNode = argc > 1 ? std::atoi(argv[1]) : 8;
+    const int numFunctions = argc > 2 ? std::atoi(argv[2]) : 4096;
+    const int scopesPerThread = argc > 3 ? std::atoi(argv[3]) : 100000;
+    const int collectRepetitions = 20;
+
+    auto& pc = PerformanceCounters::GetInstance();
+    auto& reg = FunctionRegistry::Instance();
+    std::vector<int> ids;
+    for (int i = 0; i < numFunctions; ++i)
+    {
+        ids.push_back(reg.RegisterFunction(("NumaFunction" + std::to_string(i)).c_str()));
+    }
+
+    const auto nodes = ReadNodes();
+    std::map<int, std::map<std::string, int64_t>> statsBefore;
+    for (const auto& node : nodes)
+    {
+        statsBefore[node.first] = ReadNumaStat(node.first);
+    }
+
+    std::cout << "=== NUMA Benchmark ===\n\n"
+              << "Nodes:              " << nodes.size() << "\n"
+              << "Threads per node:   " << threadsPerNode << "\n"
+              << "Functions:          " << numFunctions << "\n"
+              << "Scopes per thread:  " << scopesPerThread << "\n\n";
+
+    std::vector<std::unique_ptr<NodeGroup>> groups;
+    for (const auto& node : nodes)
+    {
+        groups.push_back(
+          std::make_unique<NodeGroup>(node.second, threadsPerNode, ids, scopesPerThread));
+        std::cout << "Timing on node " << node.first << ":   " << std::fixed
+                  << std::setprecision(2) << groups.back()->TimingNs << " ns/scope\n";
+    }
+    std::cout << "\n";
+
+    // Collect from each node in turn; the first pass also drains the
+    // pending counts, so time the steady-state passes only.
+    for (const auto& node : nodes)
+    {
+        double collectNs = 0.0;
+        std::thread(
+          [&]()
+          {
+              PinToCpus(node.second);
+              pc.CollectAll();
+              auto start = std::chrono::steady_clock::now();
+              for (int r = 0; r < collectRepetitions; ++r)
+              {
+                  pc.CollectAll();
+              }
+              auto end = std::chrono::steady_clock::now();
+              collectNs =
+                std::chrono::duration<double, std::nano>(end - start).count() / collectRepetitions;
+          })
+          .join();
+        std::cout << "CollectAll from node " << node.first << ": " << std::fixed
+                  << std::setprecision(0) << collectNs / 1000.0 << " us\n";
+    }
+    groups.clear();
+
+    std::cout << "\nnumastat deltas (pages):\n";
+    bool haveStats = false;
+    for (const auto& node : nodes)
+    {
+        auto after = ReadNumaStat(node.first);
+        if (after.empty())
+        {
+            continue;
+        }
+        haveStats = true;
+        auto& before = statsBefore[node.first];
+        std::cout << "  node " << node.first << ":  other_node "
+                  << after["other_node"] - before["other_node"] << "  numa_miss "
+                  << after["numa_miss"] - before["numa_miss"] << "  numa_foreign "
+                  << after["numa_foreign"] - before["numa_foreign"] << "  local_node "
+                  << after["local_node"] - before["local_node"] << "\n";
+    }
+    if (!haveStats)
+    {
+        std::cout << "  unavailable (no /sys NUMA information)\n";
+    }
+
+    auto usage = pc.GetMemoryUsage();
+    std::cout << "\nAccumulator memory: " << usage.Accumulators / 1024 << " KiB\n";
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,379 @@
+/**
+ * @file PerformanceCountersBenchmark.cpp
+ * @brief Overhead microbenchmarks for the PerformanceCounters library.
+ *
+ * Covers the costs users pay for instrumentation:
+ * - Empty and nested timed scopes (the per-scope overhead), empty scopes
+ *   with serialized clock reads, and empty scopes with the per-CPU backend
+ *   where rseq is available.
+ * - Function registration, new names and repeated lookups.
+ * - CollectAll() with N threads x M touched functions, serially and with
+ *   a pool of collect threads.
+ * - Thread start (first scope of a new thread) while idle and while
+ *   another thread runs CollectAll() in a loop.
+ * - Report generation for a registry of 10k functions, serial and parallel.
+ * - Multi-thread scaling of timed scopes from 1 to 64 threads.
+ * - CollectAll() on a 100k-function registry when only a few functions
+ *   changed since the last collect.
+ *
+ * Run with `--json results.json` to keep results for tracking over time;
+ * see BenchmarkHarness.h for the other options.
+ */
+
+#include "BenchmarkHarness.h"
+#include "PerformanceCounters.h"
+#include "ScopedTimer.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+const int ReportFunctions = 10000;
+
+/// Threads that touch a set of functions once and then park until released,
+/// so their accumulators stay live while the main thread collects.
+class ParkedThreads
+{
+  public:
+    ParkedThreads(int numThreads, const std::vector<int>& ids)
+    {
+        for (int t = 0; t < numThreads; ++t)
+        {
+            this->Threads.emplace_back(
+              [this, &ids]()
+              {
+                  for (int id : ids)
+                  {
+                      ScopedTimerHelper timer(id);
+                  }
+                  std::unique_lock<std::mutex> lock(this->Mutex);
+                  ++this->Ready;
+                  this->Changed.notify_all();
+                  this->Changed.wait(lock, [this]() { return this->Released; });
+              });
+        }
+        std::unique_lock<std::mutex> lock(this->Mutex);
+        this->Changed.wait(lock, [this, numThreads]() { return this->Ready == numThreads; });
+    }
+
+    ~ParkedThreads()
+    {
+        {
+            std::lock_guard<std::mutex> lock(this->Mutex);
+            this->Released = true;
+        }
+        this->Changed.notify_all();
+        for (auto& thread : this->Threads)
+        {
+            thread.join();
+        }
+    }
+
+  private:
+    std::mutex Mutex;
+    std::condition_variable Changed;
+    int Ready = 0;
+    bool Released = false;
+    std::vector<std::thread> Threads;
+};
+
+/// Wall time in nanoseconds for @p numThreads threads each timing @p scopes scopes.
+int64_t TimeScaling(int numThreads, int scopes, int id)
+{
+    std::atomic<bool> go{ false };
+    std::atomic<int> ready{ 0 };
+    std::vector<std::thread> threads;
+    for (int t = 0; t < numThreads; ++t)
+    {
+        threads.emplace_back(
+          [&go, &ready, scopes, id]()
+          {
+              ready.fetch_add(1);
+              while (!go.load(std::memory_order_acquire))
+              {
+                  std::this_thread::yield();
+              }
+              for (int i = 0; i < scopes; ++i)
+              {
+                  ScopedTimerHelper timer(id);
+              }
+          });
+    }
+    while (ready.load() != numThreads)
+    {
+        std::this_thread::yield();
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    go.store(true, std::memory_order_release);
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+}
+
+/// Wall time in nanoseconds to start @p numThreads threads one after the
+/// other, each timing one scope (which acquires its accumulator), and join them.
+int64_t TimeThreadStarts(int numThreads, int id)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (int t = 0; t < numThreads; ++t)
+    {
+        std::thread([id]() { ScopedTimerHelper timer(id); }).join();
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    BenchmarkHarness harness(argc, argv);
+    auto& pc = PerformanceCounters::GetInstance();
+    auto& reg = FunctionRegistry::Instance();
+
+    // A fixed registry shared by all benchmarks, registered before anything
+    // else so IDs and report size do not depend on --filter.
+    std::vector<int> ids;
+    for (int i = 0; i < ReportFunctions; ++i)
+    {
+        ids.push_back(reg.RegisterFunction(("BenchFunction" + std::to_string(i)).c_str()));
+    }
+
+    std::cout << "=== PerformanceCounters Benchmark ===\n\n";
+
+    // --- Scope overhead ---------------------------------------------------
+
+    harness.Run("Scope/Empty",
+      [&ids](int64_t iterations)
+      {
+          for (int64_t i = 0; i < iterations; ++i)
+          {
+              ScopedTimerHelper timer(ids[0]);
+          }
+      });
+
+    // Serialized TSC reads: the cost of precision for short scopes.
+    harness.Run("Scope/Precise",
+      [&ids](int64_t iterations)
+      {
+          for (int64_t i = 0; i < iterations; ++i)
+          {
+              PreciseScopedTimerHelper timer(ids[0]);
+          }
+      });
+
+    harness.Run("Scope/Macro",
+      [](int64_t iterations)
+      {
+          for (int64_t i = 0; i < iterations; ++i)
+          {
+              ScopedTimerNamed("BenchMacroScope");
+          }
+      });
+
+    harness.Run("Scope/Nested4",
+      [&ids](int64_t iterations)
+      {
+          for (int64_t i = 0; i < iterations; ++i)
+          {
+              ScopedTimerHelper outer(ids[1]);
+              ScopedTimerHelper middle(ids[2]);
+              ScopedTimerHelper inner(ids[3]);
+              ScopedTimerHelper innermost(ids[4]);
+          }
+      });
+
+    if (harness.Selected("Scope/PerCpu") &&
+      pc.SetAccumulationBackend(PerformanceCounters::AccumulationBackend::PerCpu) ==
+        PerformanceCounters::AccumulationBackend::PerCpu)
+    {
+        harness.Run("Scope/PerCpu",
+          [&ids](int64_t iterations)
+          {
+              for (int64_t i = 0; i < iterations; ++i)
+              {
+                  ScopedTimerHelper timer(ids[0]);
+              }
+          });
+        pc.SetAccumulationBackend(PerformanceCounters::AccumulationBackend::PerThread);
+    }
+
+    // --- Registration -----------------------------------------------------
+
+    harness.Run("Registration/Existing",
+      [&reg](int64_t iterations)
+      {
+          for (int64_t i = 0; i < iterations; ++i)
+          {
+              reg.RegisterFunction("BenchFunction42");
+          }
+      });
+
+    // --- Collection -------------------------------------------------------
+
+    for (int threads : { 1, 16, 64 })
+    {
+        for (int functions : { 100, 1000, 10000 })
+        {
+            for (int workers : { 1, 4 })
+            {
+                std::string name = "CollectAll/threads:" + std::to_string(threads) +
+                  "/functions:" + std::to_string(functions);
+                if (workers > 1)
+                {
+                    name += "/workers:" + std::to_string(workers);
+                }
+                if (!harness.Selected(name) || (workers > 1 && threads == 1))
+                {
+                    continue;
+                }
+
+                std::vector<int> touched(ids.begin(), ids.begin() + functions);
+                ParkedThreads parked(threads, touched);
+                pc.SetCollectThreads(workers);
+                harness.Run(name,
+                  [&pc](int64_t iterations)
+                  {
+                      for (int64_t i = 0; i < iterations; ++i)
+                      {
+                          pc.CollectAll();
+                      }
+                  });
+                pc.SetCollectThreads(1);
+            }
+        }
+    }
+
+    // --- Reporting --------------------------------------------------------
+
+    for (int workers : { 1, 4 })
+    {
+        std::string name = "Report/functions:10000";
+        if (workers > 1)
+        {
+            name += "/workers:" + std::to_string(workers);
+        }
+        pc.SetCollectThreads(workers);
+        harness.Run(name,
+          [&pc](int64_t iterations)
+          {
+              for (int64_t i = 0; i < iterations; ++i)
+              {
+                  std::string report = pc.GetResultsAsString();
+                  if (report.empty())
+                  {
+                      std::abort();
+                  }
+              }
+          });
+        pc.SetCollectThreads(1);
+    }
+
+    // --- Thread start during collection -----------------------------------
+
+    const int threadStarts = 1000;
+    if (harness.Selected("ThreadStart/idle") || harness.Selected("ThreadStart/collecting"))
+    {
+        std::vector<int> touched(ids.begin(), ids.begin() + 1000);
+        ParkedThreads parked(64, touched);
+        harness.RunManual("ThreadStart/idle", threadStarts,
+          [&ids]() { return TimeThreadStarts(threadStarts, ids[6]); });
+
+        std::atomic<bool> done{ false };
+        std::thread collector(
+          [&pc, &done]()
+          {
+              while (!done.load(std::memory_order_relaxed))
+              {
+                  pc.CollectAll();
+              }
+          });
+        harness.RunManual("ThreadStart/collecting", threadStarts,
+          [&ids]() { return TimeThreadStarts(threadStarts, ids[6]); });
+        done.store(true);
+        collector.join();
+    }
+
+    // --- Scaling ----------------------------------------------------------
+
+    const int scopesPerThread = 50000;
+    for (int threads : { 1, 2, 4, 8, 16, 32, 64 })
+    {
+        harness.RunManual("Scaling/threads:" + std::to_string(threads),
+          static_cast<int64_t>(threads) * scopesPerThread,
+          [threads, &ids]() { return TimeScaling(threads, scopesPerThread, ids[5]); });
+    }
+
+    // --- Registration of new names (grows the registry, so run last) ------
+
+    const int newNames = 10000;
+    harness.RunManual("Registration/New", newNames,
+      [&reg]()
+      {
+          static int generation = 0;
+          std::vector<std::string> names;
+          for (int i = 0; i < newNames; ++i)
+          {
+              names.push_back(
+                "BenchNew" + std::to_string(generation) + "_" + std::to_string(i));
+          }
+          ++generation;
+
+          auto start = std::chrono::steady_clock::now();
+          for (const auto& name : names)
+          {
+              reg.RegisterFunction(name.c_str());
+          }
+          auto end = std::chrono::steady_clock::now();
+          return std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+      });
+
+    // --- Collection proportional to touched functions (grows the registry) --
+
+    const int largeRegistry = 100000;
+    if (harness.Selected("CollectAll/registry:"))
+    {
+        for (int i = reg.GetFunctionCount(); i < largeRegistry; ++i)
+        {
+            reg.RegisterFunction(("BenchLarge" + std::to_string(i)).c_str());
+        }
+        std::vector<int> all;
+        for (int i = 0; i < largeRegistry; ++i)
+        {
+            all.push_back(i);
+        }
+        // Threads that timed every function once, then idle between collects.
+        ParkedThreads parked(16, all);
+        pc.CollectAll();
+        for (int touched : { 100, 10000 })
+        {
+            harness.Run("CollectAll/registry:100000/threads:16/touched:" + std::to_string(touched),
+              [&pc, touched](int64_t iterations)
+              {
+                  const int stride = largeRegistry / touched;
+                  for (int64_t i = 0; i < iterations; ++i)
+                  {
+                      for (int t = 0; t < touched; ++t)
+                      {
+                          ScopedTimerHelper timer(t * stride);
+                      }
+                      pc.CollectAll();
+                  }
+              });
+        }
+    }
+
+    return harness.Finish();
+}
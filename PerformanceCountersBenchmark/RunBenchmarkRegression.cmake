@@ -0,0 +1,48 @@
+# Run the benchmark suite against the stored baseline for the current commit.
+#
+# Expected variables:
+#   benchmark   - Path to the PerformanceCountersBenchmark executable
+#   source      - Source tree (used to determine the commit)
+#   results_dir - Directory holding one stored run per commit
+#   filter      - Benchmark name filter
+#   window      - Number of stored runs in the rolling baseline
+
+find_package(Git QUIET)
+set(commit "unknown")
+if(GIT_FOUND)
+  execute_process(
+    COMMAND ${GIT_EXECUTABLE} rev-parse --short HEAD
+    WORKING_DIRECTORY ${source}
+    OUTPUT_VARIABLE commit
+    OUTPUT_STRIP_TRAILING_WHITESPACE
+    RESULT_VARIABLE git_result
+    ERROR_QUIET)
+  if(NOT git_result EQUAL 0)
+    set(commit "unknown")
+  else()
+    # Uncommitted changes are tracked separately from the commit they modify.
+    execute_process(
+      COMMAND ${GIT_EXECUTABLE} diff --quiet HEAD
+      WORKING_DIRECTORY ${source}
+      RESULT_VARIABLE dirty
+      ERROR_QUIET)
+    if(NOT dirty EQUAL 0)
+      string(APPEND commit "-dirty")
+    endif()
+  endif()
+endif()
+
+message(STATUS "Benchmarking commit ${commit}, results in ${results_dir}")
+
+execute_process(
+  COMMAND ${benchmark}
+    --filter ${filter}
+    --commit ${commit}
+    --baseline-dir ${results_dir}
+    --baseline-window ${window}
+    --store-dir ${results_dir}
+  RESULT_VARIABLE result)
+
+if(NOT result EQUAL 0)
+  message(FATAL_ERROR "Benchmark regression detected (exit code ${result})")
+endif()
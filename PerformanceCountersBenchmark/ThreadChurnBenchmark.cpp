@@ -0,0 +1,105 @@
+/**
+ * @file ThreadChurnBenchmark.cpp
+ * @brief Thread churn with and without accumulator pooling.
+ *
+ * Models request-per-thread code: every thread starts, times a handful of
+ * scopes spread over a large registry, and exits. With pooling enabled the
+ * exiting thread hands its pre-sized counter table to the next thread; with
+ * pooling disabled every thread allocates and grows its own table.
+ *
+ * Usage: ThreadChurnBenchmark [threads] [functions]
+ */
+
+#include "PerformanceCounters.h"
+#include "ScopedTimer.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+/// Run @p numThreads short-lived threads, @p batchSize at a time.
+double RunChurn(const std::vector<int>& ids, int numThreads, int batchSize)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (int started = 0; started < numThreads; started += batchSize)
+    {
+        std::vector<std::thread> threads;
+        for (int t = 0; t < batchSize; ++t)
+        {
+            threads.emplace_back(
+              [&ids]()
+              {
+                  // Touch IDs in registration order, as a request handler would,
+                  // so an unpooled table grows step by step.
+                  for (int id : ids)
+                  {
+                      ScopedTimerHelper timer(id);
+                  }
+              });
+        }
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / numThreads;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    const int numThreads = argc > 1 ? std::atoi(argv[1]) : 20000;
+    const int numFunctions = argc > 2 ? std::atoi(argv[2]) : 16384;
+    const int batchSize = 8;
+    const int touchedPerThread = 32;
+
+    auto& pc = PerformanceCounters::GetInstance();
+    auto& reg = FunctionRegistry::Instance();
+
+    std::vector<int> allIds;
+    for (int i = 0; i < numFunctions; ++i)
+    {
+        allIds.push_back(reg.RegisterFunction(("ChurnFunction" + std::to_string(i)).c_str()));
+    }
+
+    std::vector<int> touched;
+    for (int i = 0; i < touchedPerThread; ++i)
+    {
+        touched.push_back(allIds[(i + 1) * (numFunctions / touchedPerThread) - 1]);
+    }
+
+    std::cout << "=== Thread Churn Benchmark ===\n\n"
+              << "Threads:            " << numThreads << "\n"
+              << "Registered IDs:     " << numFunctions << "\n"
+              << "Scopes per thread:  " << touchedPerThread << "\n\n";
+
+    // Warm up thread creation and the accumulator pool.
+    RunChurn(touched, batchSize * 16, batchSize);
+
+    pc.SetAccumulatorPooling(false);
+    double unpooled = RunChurn(touched, numThreads, batchSize);
+
+    pc.SetAccumulatorPooling(true);
+    RunChurn(touched, batchSize, batchSize);
+    double pooled = RunChurn(touched, numThreads, batchSize);
+
+    std::cout << "Unpooled:           " << unpooled << " ns/thread\n"
+              << "Pooled:             " << pooled << " ns/thread\n"
+              << "Speedup:            " << unpooled / pooled << "x\n"
+              << "Accumulators:       " << pc.GetAccumulatorCount() << "\n";
+
+    auto usage = pc.GetMemoryUsage();
+    std::cout << "Accumulator memory: " << usage.Accumulators / 1024 << " KiB (largest "
+              << usage.LargestAccumulator / 1024 << " KiB)\n"
+              << "Registry memory:    " << usage.Registry / 1024 << " KiB\n";
+
+    return EXIT_SUCCESS;
+}
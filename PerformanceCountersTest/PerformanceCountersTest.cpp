@@ -6,15 +6,54 @@
  * - Basic timing functionality
  * - Cross-module timing aggregation (main exe + DummyLib DLL)
  * - Thread-local accumulator functionality
+ * - Sparse accumulator storage and memory-usage reporting
+ * - Per-CPU accumulation backend
+ * - Parallel collection and report generation
+ * - Accumulator lifecycle under heavy thread churn
  */
 
 #include "PerformanceCounters.h"
 #include "DummyLib.h"
+#include "PerformanceCountersBench.h"
+#include "PerformanceCountersClock.h"
+#include "PerformanceCountersKernels.h"
+#include "PerformanceCountersTraceFormat.h"
 #include "ScopedTimer.h"
 #include <catch2/catch_test_macros.hpp>
 
+#include <atomic>
 #include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
 #include <thread>
+#include <type_traits>
+#include <vector>
+
+// ThreadSanitizer makes thread creation roughly 25x slower; scale churn tests down.
+#if defined(__SANITIZE_THREAD__)
+#define PC_TEST_UNDER_TSAN 1
+#elif defined(__has_feature)
+#if __has_feature(thread_sanitizer)
+#define PC_TEST_UNDER_TSAN 1
+#endif
+#endif
+#ifdef PC_TEST_UNDER_TSAN
+const int ChurnScale = 10;
+#else
+const int ChurnScale = 1;
+#endif
+
+// CLOCK_MONOTONIC_COARSE advances once per kernel tick (1-4 ms), so short
+// scopes may take no time; checks that they took some are skipped with it.
+#ifdef PERFORMANCE_COUNTERS_HAVE_POSIX_CLOCKS
+const bool TimesShortScopes = !std::is_same<TimerClock, MonotonicCoarseClockSource>::value;
+#else
+const bool TimesShortScopes = true;
+#endif
 
 // Function in main executable that uses the same timer key as DummyLib
 void MainExeTimedFunction()
@@ -43,7 +82,7 @@ TEST_CASE("PerformanceCounters::Timing::Basic", "[timing]")
         int id = pc.GetFunctionId("TestFunction");
         REQUIRE(id >= 0);
         REQUIRE(pc.GetFunctionCallCount(id) == 1);
-        REQUIRE(pc.GetFunctionTotalTime(id) > 0.0);
+        REQUIRE((pc.GetFunctionTotalTime(id) > 0.0 || !TimesShortScopes));
     }
 
     SECTION("Multiple calls accumulate")
@@ -62,6 +101,161 @@ TEST_CASE("PerformanceCounters::Timing::Basic", "[timing]")
         REQUIRE(id >= 0);
         REQUIRE(pc.GetFunctionCallCount(id) == 5);
     }
+
+    SECTION("Precise timers agree with the regular clock")
+    {
+        pc.ResetAllCounters();
+
+        auto start = std::chrono::steady_clock::now();
+        {
+            ScopedTimerPreciseNamed("PreciseFunction");
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        }
+        double wall =
+          std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        pc.CollectAll();
+
+        int id = pc.GetFunctionId("PreciseFunction");
+        REQUIRE(pc.GetFunctionCallCount(id) == 1);
+        // Within 5% of the enclosing wall time: the tick rate is calibrated.
+        REQUIRE(pc.GetFunctionTotalTime(id) <= wall * 1.05);
+        REQUIRE(pc.GetFunctionTotalTime(id) >= 0.02 * 0.95);
+    }
+}
+
+// Time a 20 ms sleep with a clock source; @p resolution bounds its error.
+template <typename Source>
+void CheckClockSource(double resolution)
+{
+    INFO(Source::Name);
+    auto start = std::chrono::steady_clock::now();
+    int64_t first = Source::Now();
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    int64_t last = Source::Now();
+    double wall =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    double measured = Source::ToNanoseconds(last - first) / 1e9;
+    REQUIRE(measured >= 0.02 * 0.95 - resolution);
+    REQUIRE(measured <= wall * 1.05 + resolution);
+
+    // Conversions round-trip to within a tick.
+    int64_t ticks = Source::FromNanoseconds(1000000000);
+    REQUIRE(ticks > 0);
+    REQUIRE(std::abs(Source::ToNanoseconds(ticks) - 1000000000) <=
+      Source::ToNanoseconds(1) + 1);
+}
+
+TEST_CASE("PerformanceCounters::Timing::Clocks", "[timing]")
+{
+    CheckClockSource<SteadyClockSource>(0.0);
+#ifdef _WIN32
+    CheckClockSource<QpcClockSource>(0.0);
+#endif
+#ifdef PERFORMANCE_COUNTERS_HAVE_POSIX_CLOCKS
+    CheckClockSource<MonotonicRawClockSource>(0.0);
+    CheckClockSource<MonotonicCoarseClockSource>(0.01);
+#endif
+#ifdef PERFORMANCE_COUNTERS_HAVE_TSC
+    if (TscInfo::Get().Invariant)
+    {
+        CheckClockSource<TscClockSource>(0.0);
+    }
+#endif
+}
+
+// Runs a test on the virtual clock, restoring the real one even if it fails.
+struct VirtualClockGuard
+{
+    VirtualClockGuard() { PerformanceCounters::GetInstance().SetVirtualClock(true); }
+    ~VirtualClockGuard() { PerformanceCounters::GetInstance().SetVirtualClock(false); }
+};
+
+TEST_CASE("PerformanceCounters::Timing::VirtualClock", "[timing]")
+{
+    auto& pc = PerformanceCounters::GetInstance();
+    VirtualClockGuard guard;
+    REQUIRE(pc.GetVirtualClock());
+
+    SECTION("Totals and averages are exact")
+    {
+        for (int i = 0; i < 10; ++i)
+        {
+            ScopedTimerNamed("VirtualOuter");
+            pc.AdvanceVirtualClock(100);
+            {
+                ScopedTimerNamed("VirtualInner");
+                pc.AdvanceVirtualClock(50);
+            }
+        }
+        // Threads that exit hand their data over exactly as well.
+        for (int t = 0; t < 3; ++t)
+        {
+            std::thread(
+              [&pc]()
+              {
+                  ScopedTimerNamed("VirtualInner");
+                  pc.AdvanceVirtualClock(1000);
+              })
+              .join();
+        }
+        {
+            ScopedTimerPreciseNamed("VirtualPrecise");
+            pc.AdvanceVirtualClock(7);
+        }
+        pc.CollectAll();
+
+        REQUIRE(pc.GetFunctionCallCount("VirtualOuter") == 10);
+        REQUIRE(pc.GetFunctionAverageTime("VirtualOuter") == 150.0);
+        REQUIRE(pc.GetFunctionCallCount("VirtualInner") == 13);
+        REQUIRE(pc.GetFunctionAverageTime("VirtualInner") == 3500.0 / 13);
+        REQUIRE(pc.GetFunctionAverageTime("VirtualPrecise") == 7.0);
+    }
+
+    SECTION("Region statistics are exact")
+    {
+        const int id = FunctionRegistry::Instance().RegisterFunction("VirtualRegionBody");
+        for (int rep = 1; rep <= 4; ++rep)
+        {
+            REQUIRE(pc.BeginROI("virtual"));
+            pc.AdvanceVirtualClock(10);
+            {
+                ScopedTimerHelper timer(id);
+                pc.AdvanceVirtualClock(100 * rep - 10);
+            }
+            REQUIRE(pc.EndROI("virtual"));
+            pc.AdvanceVirtualClock(1000);  // Between repetitions: not counted.
+        }
+
+        auto roi = pc.GetROISnapshot("virtual");
+        REQUIRE(roi.Repetitions == 4);
+        REQUIRE(roi.WallTime == 1000 / 1e9);
+        REQUIRE(roi.MinWallTime == 100 / 1e9);
+        REQUIRE(roi.MaxWallTime == 400 / 1e9);
+        // Wall times 100, 200, 300 and 400 ns: deviation sqrt(12500) ns.
+        REQUIRE(std::abs(roi.StdDevWallTime - std::sqrt(12500.0) / 1e9) < 1e-15);
+        REQUIRE(roi.Counters.GetTotalTime(id) == 960 / 1e9);
+        REQUIRE(roi.GetCallsPerIteration(id) == 1.0);
+        pc.RemoveSession("virtual");
+    }
+
+    SECTION("Bench measures the virtual time of the body")
+    {
+        PerformanceCounters::BenchOptions options;
+        options.WarmupTime = 1e-6;
+        options.MinTime = 1e-5;
+        options.Repetitions = 5;
+        auto result = pc.Bench(
+          "VirtualBench", [&pc]() { pc.AdvanceVirtualClock(40); }, options);
+
+        REQUIRE(result.Mean == 40.0);
+        REQUIRE(result.StdDev == 0.0);
+        REQUIRE(result.Outliers == 0);
+        pc.CollectAll();
+        REQUIRE(pc.GetFunctionCallCount(result.Id) == result.Iterations * 5);
+        REQUIRE(pc.GetFunctionAverageTime(result.Id) == 40.0);
+    }
 }
 
 TEST_CASE("PerformanceCounters::Timing::CrossModule", "[timing][cross-module]")
@@ -165,6 +359,772 @@ TEST_CASE("PerformanceCounters::API::Core", "[api]")
     }
 }
 
+TEST_CASE("PerformanceCounters::API::FunctionLimit", "[api]")
+{
+    auto& pc = PerformanceCounters::GetInstance();
+    auto& reg = FunctionRegistry::Instance();
+    // Restores the limit even if the test fails.
+    struct LimitGuard
+    {
+        int Max = PerformanceCounters::GetInstance().GetMaxFunctions();
+        ~LimitGuard() { PerformanceCounters::GetInstance().SetMaxFunctions(this->Max); }
+    } guard;
+    const int count = reg.GetFunctionCount();
+    pc.SetMaxFunctions(count + 3);
+    REQUIRE(pc.GetMaxFunctions() == count + 3);
+
+    REQUIRE(reg.RegisterFunction("LimitTestA") == count);
+    REQUIRE(reg.RegisterFunction("LimitTestB") == count + 1);
+    const int overflow = reg.RegisterFunction("LimitTestC");
+    REQUIRE(overflow == count + 2);
+    REQUIRE(pc.GetFunctionName(overflow) == "<overflow>");
+    REQUIRE(reg.RegisterFunction("LimitTestD") == overflow);
+    REQUIRE(reg.RegisterFunction("LimitTestA") == count);
+    REQUIRE(reg.GetFunctionCount() == count + 3);
+
+    // Names past the limit are found, and recorded, as the overflow entry.
+    REQUIRE(pc.GetFunctionId("LimitTestC") == overflow);
+    REQUIRE(pc.GetFunctionId("LimitTestD") == overflow);
+    {
+        ScopedTimerNamed("LimitTestE");
+    }
+    pc.CollectAll();
+    REQUIRE(pc.GetFunctionId("LimitTestE") == overflow);
+    REQUIRE(pc.GetFunctionCallCount(overflow) == 1);
+
+    pc.SetMaxFunctions(guard.Max);
+    REQUIRE(reg.RegisterFunction("LimitTestF") == count + 3);
+}
+
+TEST_CASE("PerformanceCounters::API::Sessions", "[api]")
+{
+    auto& pc = PerformanceCounters::GetInstance();
+    auto& reg = FunctionRegistry::Instance();
+    const int id = reg.RegisterFunction("SessionTestFunction");
+    auto time = [id](int calls)
+    {
+        for (int i = 0; i < calls; ++i)
+        {
+            ScopedTimerHelper timer(id);
+        }
+    };
+
+    SECTION("Overlapping sessions see the scopes of their own windows")
+    {
+        time(7);  // Before any session.
+        REQUIRE(pc.StartSession("A"));
+        REQUIRE_FALSE(pc.StartSession("A"));
+        time(3);
+        REQUIRE(pc.StartSession("B"));
+        time(2);
+        REQUIRE(pc.StopSession("A"));
+        time(1);
+
+        auto b = pc.GetSessionSnapshot("B");
+        REQUIRE(b.Active);
+        REQUIRE(b.GetCallCount(id) == 3);
+        auto a = pc.GetSessionSnapshot("A");
+        REQUIRE_FALSE(a.Active);
+        REQUIRE(a.GetCallCount(id) == 5);
+        REQUIRE((a.GetTotalTime(id) > 0.0 || !TimesShortScopes));
+
+        // Resuming adds to the stopped counters.
+        REQUIRE(pc.StartSession("A"));
+        time(1);
+        REQUIRE(pc.StopSession("A"));
+        REQUIRE(pc.StopSession("B"));
+        REQUIRE_FALSE(pc.StopSession("B"));
+        REQUIRE(pc.GetSessionSnapshot("A").GetCallCount(id) == 6);
+        REQUIRE(pc.GetSessionSnapshot("B").GetCallCount(id) == 4);
+        REQUIRE(pc.GetSessionResultsAsString("A").find("SessionTestFunction") !=
+          std::string::npos);
+
+        pc.RemoveSession("A");
+        pc.RemoveSession("B");
+        REQUIRE(pc.GetSessionSnapshot("A").CallCount.empty());
+    }
+
+    SECTION("A session keeps its counters across a global reset")
+    {
+        REQUIRE(pc.StartSession("Reset"));
+        time(2);
+        pc.CollectAll();
+        pc.ResetAllCounters();
+        time(1);
+        REQUIRE(pc.StopSession("Reset"));
+        REQUIRE(pc.GetSessionSnapshot("Reset").GetCallCount(id) == 3);
+        REQUIRE(pc.GetFunctionCallCount(id) == 1);
+        pc.RemoveSession("Reset");
+    }
+}
+
+TEST_CASE("PerformanceCounters::API::RegionsOfInterest", "[api]")
+{
+    auto& pc = PerformanceCounters::GetInstance();
+    auto& reg = FunctionRegistry::Instance();
+    const int id = reg.RegisterFunction("RoiTestFunction");
+    auto time = [id](int calls)
+    {
+        for (int i = 0; i < calls; ++i)
+        {
+            ScopedTimerHelper timer(id);
+        }
+    };
+
+    SECTION("Repetitions yield per-iteration statistics")
+    {
+        for (int rep = 0; rep < 4; ++rep)
+        {
+            REQUIRE(pc.BeginROI("loop"));
+            REQUIRE_FALSE(pc.BeginROI("loop"));
+            time(3);
+            REQUIRE(pc.EndROI("loop"));
+        }
+        REQUIRE_FALSE(pc.EndROI("loop"));
+
+        auto roi = pc.GetROISnapshot("loop");
+        REQUIRE(roi.Repetitions == 4);
+        REQUIRE(roi.GetCallsPerIteration(id) == 3.0);
+        REQUIRE((roi.GetTimePerIteration(id) > 0.0 || !TimesShortScopes));
+        REQUIRE((roi.WallTime > 0.0 || !TimesShortScopes));
+        REQUIRE(roi.MinWallTime <= roi.GetMeanWallTime());
+        REQUIRE(roi.GetMeanWallTime() <= roi.MaxWallTime);
+        REQUIRE(pc.GetROIResultsAsString("loop").find("Per iteration: 3 calls") !=
+          std::string::npos);
+        pc.RemoveSession("loop");
+    }
+
+    SECTION("Scopes outside regions can be ignored")
+    {
+        pc.CollectAll();
+        const int before = pc.GetFunctionCallCount(id);
+        pc.SetRecordOutsideROI(false);
+        time(5);
+        {
+            // Started outside the region, so never timed.
+            ScopedTimerHelper straddling(id);
+            REQUIRE(pc.BeginROI("gated"));
+        }
+        time(2);
+        {
+            PreciseScopedTimerHelper straddling(id);
+            REQUIRE(pc.EndROI("gated"));
+        }
+        time(5);
+        pc.SetRecordOutsideROI(true);
+        pc.CollectAll();
+        REQUIRE(pc.GetFunctionCallCount(id) == before + 2);
+        REQUIRE(pc.GetROISnapshot("gated").Counters.GetCallCount(id) == 2);
+        pc.RemoveSession("gated");
+    }
+}
+
+TEST_CASE("PerformanceCounters::API::Bench", "[api]")
+{
+    auto& pc = PerformanceCounters::GetInstance();
+
+    SECTION("Calibrated repetitions are summarized and recorded")
+    {
+        PerformanceCounters::BenchOptions options;
+        options.WarmupTime = 0.001;
+        options.MinTime = 0.002;
+        options.Repetitions = 7;
+        std::string text = "benchmark";
+        auto result = pc.Bench(
+          "BenchTestBody",
+          [&]()
+          {
+              DoNotOptimize(text);
+              DoNotOptimize(text.size());
+              ClobberMemory();
+          },
+          options);
+
+        REQUIRE(result.Id == pc.GetFunctionId("BenchTestBody"));
+        REQUIRE(result.Iterations > 1);
+        REQUIRE(result.Samples.size() == 7);
+        REQUIRE(result.Outliers < 7);
+        REQUIRE(result.Min <= result.Median);
+        REQUIRE(result.Median <= result.Max);
+        REQUIRE(result.ConfidenceLow <= result.Mean);
+        REQUIRE(result.Mean <= result.ConfidenceHigh);
+
+        pc.CollectAll();
+        REQUIRE(pc.GetFunctionCallCount(result.Id) ==
+          result.Iterations * (options.Repetitions - result.Outliers));
+    }
+
+    SECTION("Nothing is recorded outside regions when those are ignored")
+    {
+        PerformanceCounters::BenchOptions options;
+        options.WarmupTime = 0.0;
+        options.MinTime = 0.0005;
+        options.Repetitions = 3;
+        const int id = FunctionRegistry::Instance().RegisterFunction("BenchTestIgnored");
+        pc.CollectAll();
+        const int before = pc.GetFunctionCallCount(id);
+        pc.SetRecordOutsideROI(false);
+        auto result = pc.Bench("BenchTestIgnored", []() { ClobberMemory(); }, options);
+        pc.SetRecordOutsideROI(true);
+
+        REQUIRE(result.Samples.size() == 3);
+        pc.CollectAll();
+        REQUIRE(pc.GetFunctionCallCount(id) == before);
+    }
+
+    SECTION("A body that takes no time ends under the virtual clock")
+    {
+        VirtualClockGuard guard;
+        PerformanceCounters::BenchOptions options;
+        options.MaxIterations = 1 << 10;
+        auto result = pc.Bench("BenchTestEmpty", []() {}, options);
+
+        REQUIRE(result.Iterations == options.MaxIterations);
+        REQUIRE(result.Samples.size() == static_cast<size_t>(options.Repetitions));
+        REQUIRE(result.Outliers == 0);
+        REQUIRE(result.Mean == 0.0);
+        REQUIRE(result.Max == 0.0);
+    }
+}
+
+TEST_CASE("PerformanceCounters::API::Trace", "[api]")
+{
+    auto& pc = PerformanceCounters::GetInstance();
+    const char* path = "PerformanceCountersTest.trace";
+    const int id = FunctionRegistry::Instance().RegisterFunction("TracedFunction");
+    auto time = [&pc, id](int calls)
+    {
+        for (int i = 0; i < calls; ++i)
+        {
+            ScopedTimerHelper timer(id);
+            pc.AdvanceVirtualClock(10);
+        }
+    };
+
+    SECTION("Events of all threads reach the file")
+    {
+        VirtualClockGuard guard;
+        REQUIRE(pc.StartTrace(path));
+        REQUIRE_FALSE(pc.StartTrace(path));
+        time(10000);
+        std::thread(time, 3000).join();
+        std::thread other(time, 5000);
+        other.join();
+        REQUIRE(pc.GetTraceStatistics().Active);
+        REQUIRE(pc.StopTrace());
+        REQUIRE_FALSE(pc.StopTrace());
+
+        auto statistics = pc.GetTraceStatistics();
+        REQUIRE_FALSE(statistics.Active);
+        REQUIRE(statistics.EventsWritten == 18000);
+        REQUIRE(statistics.EventsDropped == 0);
+
+        TraceFileContents trace;
+        REQUIRE(ReadTraceFile(path, trace));
+        REQUIRE(trace.Complete);
+        REQUIRE(trace.NanosecondsPerTick == 1.0);
+        REQUIRE(trace.Statistics.EventsWritten == 18000);
+        REQUIRE(trace.Threads.size() == 3);
+        size_t events = 0;
+        size_t mismatches = 0;
+        for (const TraceThread& thread : trace.Threads)
+        {
+            for (const TraceEvent& event : thread.Events)
+            {
+                mismatches += event.Id != id || event.End - event.Start != 10;
+            }
+            events += thread.Events.size();
+        }
+        REQUIRE(events == 18000);
+        REQUIRE(mismatches == 0);
+        REQUIRE(trace.Names.at(id) == "TracedFunction");
+    }
+
+    SECTION("A throttled writer drops events instead of blocking")
+    {
+        PerformanceCounters::TraceOptions options;
+        options.Buffers = 2;
+        options.WriteBytes = 4096;
+        options.MaxBytesPerSecond = 1000.0;
+        REQUIRE(pc.StartTrace(path, options));
+        time(50000);
+        REQUIRE(pc.StopTrace());
+
+        auto statistics = pc.GetTraceStatistics();
+        REQUIRE(statistics.EventsDropped > 0);
+        REQUIRE(statistics.EventsWritten + statistics.EventsDropped == 50000);
+        TraceFileContents trace;
+        REQUIRE(ReadTraceFile(path, trace));
+        REQUIRE(static_cast<int64_t>(trace.Statistics.EventsDropped) == statistics.EventsDropped);
+    }
+
+    SECTION("Direct I/O output reads back like buffered output")
+    {
+        PerformanceCounters::TraceOptions options;
+        options.DirectIo = true;  // Falls back to buffered I/O where unsupported.
+        options.WriteBytes = 10000;
+        REQUIRE(pc.StartTrace(path, options));
+        time(9999);
+        REQUIRE(pc.StopTrace());
+
+        TraceFileContents trace;
+        REQUIRE(ReadTraceFile(path, trace));
+        REQUIRE(trace.Complete);
+        REQUIRE(trace.Statistics.EventsWritten == 9999);
+        REQUIRE(trace.Threads.size() == 1);
+        REQUIRE(trace.Threads[0].Events.size() == 9999);
+    }
+
+    SECTION("Compact and compressed encodings read back like raw events")
+    {
+        // Wrapping deltas, backward starts and negative IDs survive encoding.
+        const TraceEvent edges[] = { { INT64_MAX - 5, INT64_MAX, 7, 0 },
+            { INT64_MIN, INT64_MIN + 1, -1, 0 }, { 100, 90, 0, 0 }, { -3, 1000000000000, 2, 0 },
+            { 5, 5, TraceFlowIn, 0xFFFFFFFF } };
+        std::vector<char> encoded;
+        TraceEncodeCompact(edges, 5, encoded);
+        std::vector<TraceEvent> decoded;
+        REQUIRE(TraceDecodeCompact(encoded.data(), encoded.size(), 5, decoded));
+        REQUIRE(decoded.size() == 5);
+        for (int i = 0; i < 5; ++i)
+        {
+            REQUIRE(std::memcmp(&decoded[i], &edges[i], sizeof(TraceEvent)) == 0);
+        }
+        REQUIRE_FALSE(TraceDecodeCompact(encoded.data(), encoded.size() - 1, 5, decoded));
+
+        VirtualClockGuard guard;
+        auto nested = [&pc, id]()
+        {
+            for (int i = 0; i < 5000; ++i)
+            {
+                ScopedTimerHelper outer(id);
+                pc.AdvanceVirtualClock(3);
+                {
+                    ScopedTimerHelper inner(id);
+                    pc.AdvanceVirtualClock(i % 200);
+                }
+            }
+        };
+        TraceFileContents traces[3];
+        int64_t bytes[3];
+        for (int encoding = 0; encoding < 3; ++encoding)
+        {
+            PerformanceCounters::TraceOptions options;
+            options.Compact = encoding > 0;
+            options.Compress = encoding > 1;
+            REQUIRE(pc.StartTrace(path, options));
+            nested();
+            REQUIRE(pc.StopTrace());
+            bytes[encoding] = pc.GetTraceStatistics().BytesWritten;
+            REQUIRE(ReadTraceFile(path, traces[encoding]));
+            REQUIRE(traces[encoding].Complete);
+            REQUIRE(traces[encoding].Threads.size() == 1);
+        }
+        // Same durations and IDs; starts shift with the virtual clock between runs.
+        const auto& raw = traces[0].Threads[0].Events;
+        for (int encoding = 1; encoding < 3; ++encoding)
+        {
+            const auto& events = traces[encoding].Threads[0].Events;
+            REQUIRE(events.size() == raw.size());
+            size_t mismatches = 0;
+            for (size_t i = 0; i < raw.size(); ++i)
+            {
+                mismatches += events[i].Id != raw[i].Id ||
+                  events[i].End - events[i].Start != raw[i].End - raw[i].Start ||
+                  events[i].Start - events[0].Start != raw[i].Start - raw[0].Start;
+            }
+            REQUIRE(mismatches == 0);
+        }
+        REQUIRE(bytes[1] * 3 < bytes[0]);
+        if (pc.GetTraceStatistics().Compressed)
+        {
+            REQUIRE(bytes[2] < bytes[1]);
+        }
+    }
+
+    SECTION("Flows link the threads work passes through")
+    {
+        VirtualClockGuard guard;
+        REQUIRE(pc.TraceFlowBegin() != 0);  // Issued, not recorded, without a trace.
+        REQUIRE(pc.StartTrace(path));
+        uint32_t flow = 0;
+        {
+            ScopedTimerHelper producer(id);
+            flow = pc.TraceFlowBegin();
+        }
+        pc.AdvanceVirtualClock(7);
+        std::thread([&pc, flow, &time]() {
+            pc.TraceFlowEnd(flow);
+            time(1);
+        }).join();
+        REQUIRE(pc.StopTrace());
+
+        TraceFileContents trace;
+        REQUIRE(ReadTraceFile(path, trace));
+        REQUIRE(trace.Threads.size() == 2);
+        // Threads appear in the order their buffers were written.
+        const bool producerFirst = trace.Threads[0].Events.at(0).Id == TraceFlowOut;
+        const auto& out = trace.Threads[producerFirst ? 0 : 1].Events;
+        const auto& in = trace.Threads[producerFirst ? 1 : 0].Events;
+        REQUIRE(out.size() == 2);
+        REQUIRE(out[0].Id == TraceFlowOut);
+        REQUIRE(out[0].Flow == flow);
+        REQUIRE(out[1].Id == id);
+        REQUIRE(in.size() == 2);
+        REQUIRE(in[0].Id == TraceFlowIn);
+        REQUIRE(in[0].Flow == flow);
+        REQUIRE(in[0].Start - out[0].Start == 7);
+        REQUIRE(in[1].Id == id);
+    }
+    std::remove(path);
+}
+
+TEST_CASE("PerformanceCounters::API::Requests", "[api]")
+{
+    auto& pc = PerformanceCounters::GetInstance();
+    auto& reg = FunctionRegistry::Instance();
+    const int parse = reg.RegisterFunction("RequestParse");
+    const int lookup = reg.RegisterFunction("RequestLookup");
+    VirtualClockGuard guard;
+
+    // Request @p request runs lookup @p calls times, 10 ns each, inside a 5 ns parse.
+    auto handle = [&pc, parse, lookup](uint64_t request, int calls)
+    {
+        pc.BeginRequest(request);
+        {
+            ScopedTimerHelper timer(parse);
+            pc.AdvanceVirtualClock(5);
+            for (int i = 0; i < calls; ++i)
+            {
+                ScopedTimerHelper inner(lookup);
+                pc.AdvanceVirtualClock(10);
+            }
+        }
+        pc.AdvanceVirtualClock(1);
+        return pc.EndRequest();
+    };
+
+    SECTION("A breakdown lists the functions of one request")
+    {
+        REQUIRE(pc.EndRequest() == nullptr);
+        REQUIRE(pc.BeginRequest(1));
+        REQUIRE_FALSE(pc.BeginRequest(2));
+        REQUIRE(pc.EndRequest() != nullptr);
+
+        const auto* breakdown = handle(42, 3);
+        REQUIRE(breakdown != nullptr);
+        REQUIRE(breakdown->Request == 42);
+        REQUIRE(breakdown->Nanoseconds == 36);
+        REQUIRE(breakdown->Functions.size() == 2);
+        REQUIRE(breakdown->Functions[0].Id == lookup);
+        REQUIRE(breakdown->Functions[0].Calls == 3);
+        REQUIRE(breakdown->Functions[0].Nanoseconds == 30);
+        REQUIRE(breakdown->Functions[1].Id == parse);
+        REQUIRE(breakdown->Functions[1].Nanoseconds == 35);
+
+        // The per-thread storage is reused and starts empty.
+        breakdown = handle(43, 0);
+        REQUIRE(breakdown->Functions.size() == 1);
+        REQUIRE(breakdown->Functions[0].Id == parse);
+        REQUIRE(breakdown->Functions[0].Calls == 1);
+    }
+
+    SECTION("The slowest requests of all threads are kept")
+    {
+        PerformanceCounters::RequestRetention retention;
+        retention.SlowestFraction = 0.1;
+        retention.MaxRetained = 5;
+        pc.SetRequestRetention(retention);
+        pc.ResetAllCounters();
+
+        auto run = [&handle](int first)
+        {
+            for (int calls = first; calls < 100; calls += 2)
+            {
+                handle(static_cast<uint64_t>(calls), calls);
+            }
+        };
+        // One thread at a time: the virtual clock is shared.
+        std::thread(run, 1).join();
+        run(0);
+
+        // 10% of 100 requests, bounded by MaxRetained.
+        auto slowest = pc.GetSlowRequests();
+        REQUIRE(slowest.size() == 5);
+        for (size_t i = 0; i < slowest.size(); ++i)
+        {
+            REQUIRE(slowest[i].Request == 99 - i);
+            REQUIRE(slowest[i].Nanoseconds == 6 + 10 * static_cast<int64_t>(99 - i));
+        }
+        REQUIRE(pc.GetSlowRequestsAsString().find("Request 99: 996 ns") != std::string::npos);
+
+        retention.MaxRetained = 1000;
+        pc.SetRequestRetention(retention);
+        pc.ResetAllCounters();
+        std::thread(run, 1).join();
+        run(0);
+        slowest = pc.GetSlowRequests();
+        REQUIRE(slowest.size() == 10);
+        REQUIRE(slowest.back().Request == 90);
+
+        pc.ResetAllCounters();
+        REQUIRE(pc.GetSlowRequests().empty());
+        pc.SetRequestRetention(PerformanceCounters::RequestRetention());
+    }
+}
+
+TEST_CASE("PerformanceCounters::API::SlowCalls", "[api]")
+{
+    auto& pc = PerformanceCounters::GetInstance();
+    auto& reg = FunctionRegistry::Instance();
+    const int id = reg.RegisterFunction("SlowCallTarget");
+    VirtualClockGuard guard;
+
+    // Scopes of 1 to 50 ns, tagged with their length; odd ones on another thread.
+    auto run = [&pc, id](int first)
+    {
+        for (int ns = first; ns <= 50; ns += 2)
+        {
+            pc.SetSlowCallContext(static_cast<uint64_t>(ns));
+            ScopedTimerHelper timer(id);
+            pc.AdvanceVirtualClock(ns);
+        }
+    };
+
+    pc.SetSlowCallCapture(3);
+    REQUIRE(pc.GetSlowCallCapture() == 3);
+    pc.ResetAllCounters();
+    // One thread at a time: the virtual clock is shared.
+    std::thread(run, 1).join();
+    run(2);
+    pc.CollectAll();
+
+    auto calls = pc.GetSlowCalls(id);
+    REQUIRE(calls.size() == 3);
+    REQUIRE(calls[0].Nanoseconds == 50);
+    REQUIRE(calls[0].Context == 50);
+    REQUIRE(calls[1].Nanoseconds == 49);
+    REQUIRE(calls[1].Context == 49);
+    REQUIRE(calls[2].Nanoseconds == 48);
+    REQUIRE(calls[0].Thread == calls[2].Thread);
+    REQUIRE(calls[0].Thread != calls[1].Thread);
+    REQUIRE(calls[0].Timestamp - calls[2].Timestamp == 50);
+    REQUIRE(calls[1].Timestamp < calls[2].Timestamp);
+    REQUIRE(pc.GetResultsAsString().find("Slow call:     50 ns") != std::string::npos);
+
+    // Merges keep the slowest of all collects.
+    run(2);
+    pc.CollectAll();
+    calls = pc.GetSlowCalls(id);
+    REQUIRE(calls.size() == 3);
+    REQUIRE(calls[1].Nanoseconds == 50);
+    REQUIRE(calls[2].Nanoseconds == 49);
+
+    pc.SetSlowCallCapture(1);
+    REQUIRE(pc.GetSlowCalls(id).size() == 1);
+
+    pc.ResetAllCounters();
+    pc.CollectAll();
+    REQUIRE(pc.GetSlowCalls(id).empty());
+
+    pc.SetSlowCallCapture(0);
+    run(2);
+    pc.CollectAll();
+    REQUIRE(pc.GetSlowCalls(id).empty());
+    REQUIRE(pc.GetResultsAsString().find("Slow call:") == std::string::npos);
+    pc.SetSlowCallContext(0);
+}
+
+TEST_CASE("PerformanceCounters::Accumulator::Chunks", "[accumulator]")
+{
+    auto& pc = PerformanceCounters::GetInstance();
+    auto& reg = FunctionRegistry::Instance();
+    pc.ResetAllCounters();
+
+    SECTION("IDs spanning several chunks accumulate independently")
+    {
+        // Enough names to cross a few chunk boundaries wherever the registry starts.
+        std::vector<int> ids;
+        for (int i = 0; i < 1000; ++i)
+        {
+            ids.push_back(reg.RegisterFunction(("ChunkTestFunction" + std::to_string(i)).c_str()));
+        }
+
+        for (int i = 0; i < static_cast<int>(ids.size()); ++i)
+        {
+            for (int call = 0; call <= i % 3; ++call)
+            {
+                ScopedTimerHelper timer(ids[i]);
+            }
+        }
+        pc.CollectAll();
+
+        for (int i = 0; i < static_cast<int>(ids.size()); ++i)
+        {
+            REQUIRE(pc.GetFunctionCallCount(ids[i]) == i % 3 + 1);
+        }
+    }
+}
+
+TEST_CASE("PerformanceCounters::Accumulator::Kernels", "[accumulator]")
+{
+    std::mt19937_64 random(42);
+
+    SECTION("Diff of plain and shared counters gives deltas and changed lanes")
+    {
+        for (int count = 8; count <= 64; count += 8)
+        {
+            int64_t current[64];
+            std::atomic<int64_t> shared[64];
+            int64_t baseline[64];
+            int64_t sharedBaseline[64];
+            int64_t delta[64];
+            int64_t sharedDelta[64];
+            int64_t expectedDelta[64];
+            uint64_t expected = 0;
+            for (int i = 0; i < count; ++i)
+            {
+                // Every third lane unchanged; others differ in low or high bytes only.
+                int64_t old = static_cast<int64_t>(random());
+                int64_t change = i % 3 == 0 ? 0 : (i % 2 ? 1 : int64_t(1) << 40);
+                current[i] = old + change;
+                shared[i].store(current[i], std::memory_order_relaxed);
+                baseline[i] = sharedBaseline[i] = old;
+                expectedDelta[i] = change;
+                expected |= uint64_t(change != 0) << i;
+            }
+            REQUIRE(DiffCounters(current, baseline, delta, count) == expected);
+            REQUIRE(DiffCounters(shared, sharedBaseline, sharedDelta, count) == expected);
+            int mismatches = 0;
+            for (int i = 0; i < count; ++i)
+            {
+                mismatches += baseline[i] != current[i] || sharedBaseline[i] != current[i];
+                mismatches += delta[i] != expectedDelta[i] || sharedDelta[i] != expectedDelta[i];
+            }
+            REQUIRE(mismatches == 0);
+        }
+    }
+
+    SECTION("Shared counters are copied and cleared exactly count values")
+    {
+        std::atomic<int64_t> values[72];
+        for (auto& value : values)
+        {
+            value.store(static_cast<int64_t>(random()) | 1, std::memory_order_relaxed);
+        }
+        int64_t copy[72] = {};
+        LoadCounters(values, copy, 64);
+        ZeroCounters(values, 64);
+        int mismatches = 0;
+        for (int i = 0; i < 72; ++i)
+        {
+            const int64_t value = values[i].load(std::memory_order_relaxed);
+            mismatches += (value == 0) != (i < 64);
+            mismatches += i < 64 ? copy[i] == 0 : copy[i] != 0;
+        }
+        REQUIRE(mismatches == 0);
+    }
+}
+
+TEST_CASE("PerformanceCounters::Accumulator::Memory", "[accumulator][memory]")
+{
+    auto& pc = PerformanceCounters::GetInstance();
+    auto& reg = FunctionRegistry::Instance();
+
+    SECTION("A thread timing a few functions of a large registry stays small")
+    {
+        const int registered = 20000;
+        const int touched = 100;
+        std::vector<int> ids;
+        for (int i = 0; i < registered; ++i)
+        {
+            ids.push_back(reg.RegisterFunction(("MemoryTestFunction" + std::to_string(i)).c_str()));
+        }
+
+        size_t before = 0;
+        size_t after = 0;
+        std::thread(
+          [&]()
+          {
+              before = pc.GetMemoryUsage().CurrentThread;
+              for (int i = 0; i < touched; ++i)
+              {
+                  ScopedTimerHelper timer(ids[i * (registered / touched)]);
+              }
+              after = pc.GetMemoryUsage().CurrentThread;
+          })
+          .join();
+
+        // Less than a dense table of even 16-byte counters for every function.
+        REQUIRE(after > before);
+        REQUIRE(after - before < registered * size_t(16));
+    }
+
+    SECTION("Usage totals are consistent")
+    {
+        {
+            ScopedTimerNamed("MemoryUsageTotals");
+        }
+        auto usage = pc.GetMemoryUsage();
+        REQUIRE(usage.Registry > 0);
+        REQUIRE(usage.AccumulatorCount == pc.GetAccumulatorCount());
+        REQUIRE(usage.CurrentThread > 0);
+        REQUIRE(usage.LargestAccumulator >= usage.CurrentThread);
+        REQUIRE(usage.Accumulators >= usage.LargestAccumulator);
+        REQUIRE(usage.Total() == usage.Registry + usage.Accumulators + usage.PerCpu);
+    }
+}
+
+TEST_CASE("PerformanceCounters::Accumulator::PerCpu", "[accumulator][threading]")
+{
+    using Backend = PerformanceCounters::AccumulationBackend;
+    auto& pc = PerformanceCounters::GetInstance();
+    pc.ResetAllCounters();
+    REQUIRE(pc.GetAccumulationBackend() == Backend::PerThread);
+
+    SECTION("Per-CPU backend (or its fallback) counts every call from many threads")
+    {
+        Backend selected = pc.SetAccumulationBackend(Backend::PerCpu);
+        REQUIRE(pc.GetAccumulationBackend() == selected);
+
+        // More threads than cores, so threads migrate and preempt mid-scope.
+        const int numThreads = 64;
+        const int callsPerThread = 5000;
+        int id = FunctionRegistry::Instance().RegisterFunction("PerCpuBackendTest");
+        std::vector<std::thread> threads;
+        for (int t = 0; t < numThreads; ++t)
+        {
+            threads.emplace_back(
+              [id]()
+              {
+                  for (int i = 0; i < callsPerThread; ++i)
+                  {
+                      ScopedTimerHelper timer(id);
+                  }
+              });
+        }
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+
+        pc.CollectAll();
+        REQUIRE(pc.GetFunctionCallCount(id) == numThreads * callsPerThread);
+        REQUIRE((pc.GetFunctionTotalTime(id) > 0.0 || !TimesShortScopes));
+
+        // Switching back keeps what is already in the per-CPU tables.
+        {
+            ScopedTimerHelper timer(id);
+        }
+        REQUIRE(pc.SetAccumulationBackend(Backend::PerThread) == Backend::PerThread);
+        {
+            ScopedTimerHelper timer(id);
+        }
+        pc.CollectAll();
+        REQUIRE(pc.GetFunctionCallCount(id) == numThreads * callsPerThread + 2);
+    }
+}
+
 TEST_CASE("PerformanceCounters::Threading::Safety", "[threading]")
 {
     auto& pc = PerformanceCounters::GetInstance();
@@ -201,3 +1161,335 @@ TEST_CASE("PerformanceCounters::Threading::Safety", "[threading]")
         REQUIRE(pc.GetFunctionCallCount(id) == numThreads * callsPerThread);
     }
 }
+
+TEST_CASE("PerformanceCounters::Threading::Reset", "[threading]")
+{
+    auto& pc = PerformanceCounters::GetInstance();
+    auto& reg = FunctionRegistry::Instance();
+    const int id = reg.RegisterFunction("ResetEpochTest");
+    pc.ResetAllCounters();
+
+    SECTION("Uncollected data of the calling thread is discarded")
+    {
+        for (int i = 0; i < 3; ++i)
+        {
+            ScopedTimerHelper timer(id);
+        }
+        pc.ResetAllCounters();
+        for (int i = 0; i < 2; ++i)
+        {
+            ScopedTimerHelper timer(id);
+        }
+        pc.CollectAll();
+        REQUIRE(pc.GetFunctionCallCount(id) == 2);
+    }
+
+    SECTION("Uncollected data of an idle thread is discarded")
+    {
+        std::atomic<int> stage{ 0 };
+        std::thread thread(
+          [&]()
+          {
+              for (int i = 0; i < 5; ++i)
+              {
+                  ScopedTimerHelper timer(id);
+              }
+              stage.store(1);
+              while (stage.load() != 2)
+              {
+                  std::this_thread::yield();
+              }
+              // Recorded after the reset; flushed when the thread exits.
+              for (int i = 0; i < 2; ++i)
+              {
+                  ScopedTimerHelper timer(id);
+              }
+          });
+        while (stage.load() != 1)
+        {
+            std::this_thread::yield();
+        }
+        pc.ResetAllCounters();
+        pc.CollectAll();
+        REQUIRE(pc.GetFunctionCallCount(id) == 0);
+
+        stage.store(2);
+        thread.join();
+        REQUIRE(pc.GetFunctionCallCount(id) == 2);
+    }
+}
+
+TEST_CASE("PerformanceCounters::Threading::DirtyTracking", "[threading]")
+{
+    auto& pc = PerformanceCounters::GetInstance();
+    auto& reg = FunctionRegistry::Instance();
+    pc.ResetAllCounters();
+
+    SECTION("Collecting a live thread while it records misses nothing")
+    {
+        // The thread stays alive until checked, so its exit flush cannot
+        // make up for a change a collect failed to see.
+        const int callsPerId = 20000 / ChurnScale;
+        const int numIds = 4;
+        int ids[numIds];
+        for (int i = 0; i < numIds; ++i)
+        {
+            ids[i] = reg.RegisterFunction(("DirtyTrackingTest" + std::to_string(i)).c_str());
+            // Padding spreads the IDs over directories, exercising every bitmap level.
+            for (int pad = 0; pad < 5000; ++pad)
+            {
+                std::string name = "DirtyTrackingPad" + std::to_string(i * 5000 + pad);
+                reg.RegisterFunction(name.c_str());
+            }
+        }
+        std::atomic<bool> recorded{ false };
+        std::atomic<bool> release{ false };
+        std::thread owner(
+          [&]()
+          {
+              for (int call = 0; call < callsPerId; ++call)
+              {
+                  for (int id : ids)
+                  {
+                      ScopedTimerHelper timer(id);
+                  }
+              }
+              recorded.store(true);
+              while (!release.load())
+              {
+                  std::this_thread::yield();
+              }
+          });
+
+        int collects = 0;
+        while (!recorded.load())
+        {
+            pc.CollectAll();
+            ++collects;
+        }
+        pc.CollectAll();
+        for (int id : ids)
+        {
+            REQUIRE(pc.GetFunctionCallCount(id) == callsPerId);
+        }
+        release.store(true);
+        owner.join();
+        REQUIRE(collects > 0);
+    }
+}
+
+TEST_CASE("PerformanceCounters::Threading::ParallelCollect", "[threading]")
+{
+    auto& pc = PerformanceCounters::GetInstance();
+    auto& reg = FunctionRegistry::Instance();
+    pc.ResetAllCounters();
+
+    // Enough functions for the report to be formatted in several blocks.
+    std::vector<int> ids;
+    for (int i = 0; i < 5000; ++i)
+    {
+        ids.push_back(reg.RegisterFunction(("ParallelCollectTest" + std::to_string(i)).c_str()));
+    }
+
+    SECTION("Live accumulators are flushed exactly once by the worker pool")
+    {
+        const int numThreads = 16;
+        const int callsPerThread = 100;
+        std::atomic<int> ready{ 0 };
+        std::atomic<bool> release{ false };
+
+        pc.SetCollectThreads(4);
+        REQUIRE(pc.GetCollectThreads() == 4);
+        std::vector<std::thread> threads;
+        for (int t = 0; t < numThreads; ++t)
+        {
+            threads.emplace_back(
+              [&, t]()
+              {
+                  // Every thread touches a shared ID and a spread of its own.
+                  for (int i = 0; i < callsPerThread; ++i)
+                  {
+                      ScopedTimerHelper shared(ids[0]);
+                      ScopedTimerHelper own(ids[1 + (t * 311 + i * 37) % (ids.size() - 1)]);
+                  }
+                  ready.fetch_add(1);
+                  while (!release.load())
+                  {
+                      std::this_thread::yield();
+                  }
+              });
+        }
+        while (ready.load() != numThreads)
+        {
+            std::this_thread::yield();
+        }
+
+        pc.CollectAll();
+        pc.CollectAll();
+        REQUIRE(pc.GetFunctionCallCount(ids[0]) == numThreads * callsPerThread);
+        int total = 0;
+        for (int id : ids)
+        {
+            total += pc.GetFunctionCallCount(id);
+        }
+        REQUIRE(total == 2 * numThreads * callsPerThread);
+
+        release.store(true);
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+        pc.SetCollectThreads(1);
+        REQUIRE(pc.GetCollectThreads() == 1);
+    }
+
+    SECTION("Parallel report matches the serial one")
+    {
+        for (int i = 0; i < static_cast<int>(ids.size()); i += 7)
+        {
+            ScopedTimerHelper timer(ids[i]);
+        }
+        pc.CollectAll();
+
+        std::string serial = pc.GetResultsAsString();
+        pc.SetCollectThreads(3);
+        std::string parallel = pc.GetResultsAsString();
+        pc.SetCollectThreads(1);
+        REQUIRE(parallel == serial);
+    }
+}
+
+TEST_CASE("PerformanceCounters::Threading::Lifecycle", "[threading][stress]")
+{
+    auto& pc = PerformanceCounters::GetInstance();
+    pc.ResetAllCounters();
+
+    SECTION("Spawning and joining 100k threads flushes every exit")
+    {
+        const int totalThreads = 100000 / ChurnScale;
+        const int batchSize = 16;
+        const int countBefore = pc.GetAccumulatorCount();
+
+        for (int started = 0; started < totalThreads; started += batchSize)
+        {
+            std::vector<std::thread> threads;
+            for (int t = 0; t < batchSize; ++t)
+            {
+                threads.emplace_back([]() { ScopedTimerNamed("ThreadChurnTest"); });
+            }
+            for (auto& thread : threads)
+            {
+                thread.join();
+            }
+        }
+
+        // Exited threads flushed on their own; nothing is pending.
+        int id = pc.GetFunctionId("ThreadChurnTest");
+        REQUIRE(id >= 0);
+        REQUIRE(pc.GetFunctionCallCount(id) == totalThreads);
+
+        // Retired accumulators are reused rather than allocated per thread.
+        REQUIRE(pc.GetAccumulatorCount() < countBefore + 4 * batchSize);
+    }
+
+    SECTION("Collecting while threads start and exit loses nothing")
+    {
+        const int totalThreads = 20000 / ChurnScale;
+        const int batchSize = 8;
+        std::atomic<bool> done{ false };
+
+        std::thread collector(
+          [&pc, &done]()
+          {
+              while (!done.load())
+              {
+                  pc.CollectAll();
+              }
+          });
+
+        for (int started = 0; started < totalThreads; started += batchSize)
+        {
+            std::vector<std::thread> threads;
+            for (int t = 0; t < batchSize; ++t)
+            {
+                threads.emplace_back([]() { ScopedTimerNamed("ThreadChurnCollectTest"); });
+            }
+            for (auto& thread : threads)
+            {
+                thread.join();
+            }
+        }
+
+        done.store(true);
+        collector.join();
+        pc.CollectAll();
+
+        int id = pc.GetFunctionId("ThreadChurnCollectTest");
+        REQUIRE(id >= 0);
+        REQUIRE(pc.GetFunctionCallCount(id) == totalThreads);
+    }
+
+    SECTION("Unpooled accumulators release storage and still count")
+    {
+        const int totalThreads = 1000;
+
+        REQUIRE(pc.GetAccumulatorPooling());
+        pc.SetAccumulatorPooling(false);
+        for (int t = 0; t < totalThreads; ++t)
+        {
+            std::thread([]() { ScopedTimerNamed("UnpooledChurnTest"); }).join();
+        }
+        pc.SetAccumulatorPooling(true);
+
+        int id = pc.GetFunctionId("UnpooledChurnTest");
+        REQUIRE(id >= 0);
+        REQUIRE(pc.GetFunctionCallCount(id) == totalThreads);
+    }
+
+    SECTION("Unpooled accumulators are freed while collectors walk the list")
+    {
+        const int totalThreads = 4000 / ChurnScale;
+        const int batchSize = 8;
+        const int countBefore = pc.GetAccumulatorCount();
+        std::atomic<bool> done{ false };
+
+        pc.SetAccumulatorPooling(false);
+        std::vector<std::thread> collectors;
+        for (int c = 0; c < 2; ++c)
+        {
+            collectors.emplace_back(
+              [&pc, &done]()
+              {
+                  while (!done.load())
+                  {
+                      pc.CollectAll();
+                      pc.GetMemoryUsage();
+                  }
+              });
+        }
+        for (int started = 0; started < totalThreads; started += batchSize)
+        {
+            std::vector<std::thread> threads;
+            for (int t = 0; t < batchSize; ++t)
+            {
+                threads.emplace_back([]() { ScopedTimerNamed("UnpooledReclaimTest"); });
+            }
+            for (auto& thread : threads)
+            {
+                thread.join();
+            }
+        }
+        done.store(true);
+        for (auto& collector : collectors)
+        {
+            collector.join();
+        }
+        pc.SetAccumulatorPooling(true);
+        pc.CollectAll();
+
+        int id = pc.GetFunctionId("UnpooledReclaimTest");
+        REQUIRE(pc.GetFunctionCallCount(id) == totalThreads);
+        // Exited threads' accumulators were unlinked rather than kept.
+        REQUIRE(pc.GetAccumulatorCount() <= countBefore + 2);
+    }
+}
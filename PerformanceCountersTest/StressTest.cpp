@@ -0,0 +1,229 @@
+/**
+ * @file StressTest.cpp
+ * @brief Multi-thread stress tests for PerformanceCounters.
+ *
+ * Hundreds of threads time thousands of registered scopes while background
+ * threads collect, reset, render reports and register new functions. The
+ * tests are meant to be run under ThreadSanitizer as well (see the *-tsan
+ * presets), and report timing throughput in scopes/s per core so scaling
+ * regressions show up in the test log.
+ */
+
+#include "PerformanceCounters.h"
+#include "ScopedTimer.h"
+#include <catch2/catch_test_macros.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+const int StressThreads = 256;
+const int StressFunctions = 2000;
+const int ScopesPerThread = 20000;
+const int ResetRounds = 200;
+
+/// Runs each task in a loop on its own thread until destroyed.
+class BackgroundLoops
+{
+  public:
+    explicit BackgroundLoops(const std::vector<std::function<void()>>& tasks)
+    {
+        for (const auto& task : tasks)
+        {
+            this->Threads.emplace_back(
+              [this, task]()
+              {
+                  while (!this->Stop.load(std::memory_order_relaxed))
+                  {
+                      task();
+                  }
+              });
+        }
+    }
+
+    ~BackgroundLoops()
+    {
+        this->Stop.store(true);
+        for (auto& thread : this->Threads)
+        {
+            thread.join();
+        }
+    }
+
+  private:
+    std::atomic<bool> Stop{ false };
+    std::vector<std::thread> Threads;
+};
+
+/// Register @p count functions with names starting with @p prefix.
+std::vector<int> RegisterFunctions(const std::string& prefix, int count)
+{
+    std::vector<int> ids;
+    for (int i = 0; i < count; ++i)
+    {
+        std::string name = prefix + std::to_string(i);
+        ids.push_back(FunctionRegistry::Instance().RegisterFunction(name.c_str()));
+    }
+    return ids;
+}
+
+/// Time ScopesPerThread scopes on each of StressThreads threads.
+/// @return Wall time in seconds.
+double HammerScopes(const std::vector<int>& ids)
+{
+    std::atomic<bool> go{ false };
+    std::vector<std::thread> threads;
+    for (int t = 0; t < StressThreads; ++t)
+    {
+        threads.emplace_back(
+          [&go, &ids, t]()
+          {
+              while (!go.load(std::memory_order_acquire))
+              {
+                  std::this_thread::yield();
+              }
+              const int n = static_cast<int>(ids.size());
+              for (int i = 0; i < ScopesPerThread; ++i)
+              {
+                  ScopedTimerHelper timer(ids[(t * 7 + i) % n]);
+              }
+          });
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    go.store(true, std::memory_order_release);
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(end - start).count();
+}
+
+int64_t SumCalls(const std::vector<int>& ids)
+{
+    auto& pc = PerformanceCounters::GetInstance();
+    int64_t total = 0;
+    for (int id : ids)
+    {
+        total += pc.GetFunctionCallCount(id);
+    }
+    return total;
+}
+
+void ReportThroughput(const char* label, double seconds)
+{
+    const double scopes = static_cast<double>(StressThreads) * ScopesPerThread;
+    const unsigned cores =
+      std::max(1u, std::min<unsigned>(std::thread::hardware_concurrency(), StressThreads));
+    std::cout << label << ": " << StressThreads << " threads, " << scopes / seconds
+              << " scopes/s, " << scopes / seconds / cores << " scopes/s per core (" << cores
+              << " cores)\n";
+}
+
+} // namespace
+
+TEST_CASE("PerformanceCounters::Stress::ConcurrentCollect", "[stress][threading]")
+{
+    auto& pc = PerformanceCounters::GetInstance();
+    const std::vector<int> ids = RegisterFunctions("StressCollectFunction", StressFunctions);
+
+    SECTION("No calls are lost while collecting, reporting and registering")
+    {
+        double seconds = 0.0;
+        {
+            std::atomic<int> registered{ 0 };
+            BackgroundLoops background({
+              [&pc]() { pc.CollectAll(); },
+              [&pc]() { pc.GetResultsAsString(); },
+              [&registered]()
+              {
+                  int n = registered.fetch_add(1);
+                  if (n < 5000)
+                  {
+                      ScopedTimerHelper timer(FunctionRegistry::Instance().RegisterFunction(
+                        ("StressNewFunction" + std::to_string(n)).c_str()));
+                  }
+                  else
+                  {
+                      std::this_thread::yield();
+                  }
+              },
+            });
+
+            seconds = HammerScopes(ids);
+        }
+        pc.CollectAll();
+
+        ReportThroughput("ConcurrentCollect", seconds);
+        REQUIRE(SumCalls(ids) == static_cast<int64_t>(StressThreads) * ScopesPerThread);
+    }
+}
+
+TEST_CASE("PerformanceCounters::Stress::ConcurrentReset", "[stress][threading]")
+{
+    auto& pc = PerformanceCounters::GetInstance();
+    const std::vector<int> ids = RegisterFunctions("StressResetFunction", StressFunctions);
+
+    SECTION("Resetting while timing and collecting stays consistent")
+    {
+        double seconds = 0.0;
+        {
+            BackgroundLoops background({
+              [&pc]() { pc.CollectAll(); },
+              [&pc]()
+              {
+                  pc.ResetAllCounters();
+                  std::this_thread::sleep_for(std::chrono::microseconds(100));
+              },
+              [&pc]() { pc.GetResultsAsString(); },
+            });
+
+            seconds = HammerScopes(ids);
+        }
+        pc.CollectAll();
+
+        ReportThroughput("ConcurrentReset", seconds);
+        int64_t total = SumCalls(ids);
+        REQUIRE(total >= 0);
+        REQUIRE(total <= static_cast<int64_t>(StressThreads) * ScopesPerThread);
+    }
+
+    SECTION("Only scopes after the last reset count, with collects in flight")
+    {
+        // Every round leaves scopes pending on this thread for the
+        // collectors to flush while the reset runs; none of them may count.
+        int mismatches = 0;
+        {
+            BackgroundLoops collectors({
+              [&pc]() { pc.CollectAll(); },
+              [&pc]() { pc.CollectAll(); },
+            });
+            for (int round = 0; round < ResetRounds; ++round)
+            {
+                for (int id : ids)
+                {
+                    ScopedTimerHelper timer(id);
+                }
+                pc.ResetAllCounters();
+                const int after = round % 5;
+                for (int i = 0; i < after; ++i)
+                {
+                    ScopedTimerHelper timer(ids[i]);
+                }
+                pc.CollectAll();
+                mismatches += SumCalls(ids) != after;
+            }
+        }
+        REQUIRE(mismatches == 0);
+    }
+}
@@ -0,0 +1,136 @@
+/**
+ * @file TraceConvert.cpp
+ * @brief Convert a trace file to Chrome trace event JSON.
+ *
+ * Reads a trace written by PerformanceCounters::StartTrace(), in any of its
+ * encodings, and writes every scope as a complete ("X") event with thread
+ * name metadata. Flow records become flow ("s"/"f") events, drawn as
+ * arrows between the scopes they occur in. The output opens in Perfetto (ui.perfetto.dev) and in
+ * chrome://tracing. Times are microseconds from the earliest scope, with
+ * nanosecond decimals. Trace statistics go to "otherData".
+ *
+ * Usage: TraceConvert <trace file> [<JSON file>]   (JSON to stdout by default)
+ */
+
+#include "PerformanceCountersTraceFormat.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <limits>
+#include <string>
+#include <vector>
+
+/// @p text as a JSON string literal.
+static std::string JsonString(const std::string& text)
+{
+    std::string quoted = "\"";
+    for (char c : text)
+    {
+        if (c == '"' || c == '\\')
+        {
+            quoted += '\\';
+            quoted += c;
+        }
+        else if (static_cast<unsigned char>(c) < 0x20)
+        {
+            char escaped[8];
+            std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            quoted += escaped;
+        }
+        else
+        {
+            quoted += c;
+        }
+    }
+    return quoted + "\"";
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        std::fprintf(stderr, "Usage: %s <trace file> [<JSON file>]\n", argv[0]);
+        return 2;
+    }
+
+    TraceFileContents trace;
+    if (!ReadTraceFile(argv[1], trace))
+    {
+        std::fprintf(stderr, "%s: not a readable trace file\n", argv[1]);
+        return 1;
+    }
+    if (trace.SkippedChunks > 0)
+    {
+        std::fprintf(stderr, "%s: %u compressed chunks skipped; rebuild with zstd to read them\n",
+          argv[1], trace.SkippedChunks);
+    }
+
+    std::FILE* out = argc > 2 ? std::fopen(argv[2], "w") : stdout;
+    if (!out)
+    {
+        std::fprintf(stderr, "%s: cannot be created\n", argv[2]);
+        return 1;
+    }
+
+    int64_t origin = std::numeric_limits<int64_t>::max();
+    for (const TraceThread& thread : trace.Threads)
+    {
+        for (const TraceEvent& event : thread.Events)
+        {
+            origin = std::min(origin, event.Start);
+        }
+    }
+    const double usPerTick = trace.NanosecondsPerTick / 1000.0;
+
+    std::vector<std::string> names(trace.Names.size());
+    for (size_t id = 0; id < names.size(); ++id)
+    {
+        names[id] = JsonString(trace.Names[id]);
+    }
+
+    std::fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    const char* separator = "";
+    for (const TraceThread& thread : trace.Threads)
+    {
+        std::fprintf(out,
+          "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,"
+          "\"args\":{\"name\":\"Thread %u\"}}",
+          separator, thread.Thread, thread.Thread);
+        separator = ",\n";
+        for (const TraceEvent& event : thread.Events)
+        {
+            const double ts = static_cast<double>(event.Start - origin) * usPerTick;
+            if (event.Id == TraceFlowOut || event.Id == TraceFlowIn)
+            {
+                std::fprintf(out,
+                  ",\n{\"name\":\"flow\",\"cat\":\"flow\",\"ph\":\"%s\",\"id\":%u,"
+                  "\"pid\":1,\"tid\":%u,\"ts\":%.3f%s}",
+                  event.Id == TraceFlowOut ? "s" : "f", event.Flow, thread.Thread, ts,
+                  event.Id == TraceFlowIn ? ",\"bp\":\"e\"" : "");
+                continue;
+            }
+            const std::string name = event.Id >= 0 && static_cast<size_t>(event.Id) < names.size()
+              ? names[event.Id]
+              : "\"Function " + std::to_string(event.Id) + "\"";
+            std::fprintf(out,
+              ",\n{\"name\":%s,\"cat\":\"scope\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,"
+              "\"ts\":%.3f,\"dur\":%.3f}",
+              name.c_str(), thread.Thread, ts,
+              static_cast<double>(event.End - event.Start) * usPerTick);
+        }
+    }
+    std::fprintf(out,
+      "\n],\"otherData\":{\"eventsWritten\":%" PRIu64 ",\"eventsDropped\":%" PRIu64
+      ",\"complete\":%s}}\n",
+      trace.Statistics.EventsWritten, trace.Statistics.EventsDropped,
+      trace.Complete ? "true" : "false");
+
+    const bool ok = std::ferror(out) == 0;
+    if (out != stdout)
+    {
+        std::fclose(out);
+    }
+    return ok ? 0 : 1;
+}
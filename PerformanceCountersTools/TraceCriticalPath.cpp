@@ -0,0 +1,333 @@
+/**
+ * @file TraceCriticalPath.cpp
+ * @brief Critical path of requests or frames through the scopes of a trace.
+ *
+ * Every instance of a root function that is outermost on its thread is one
+ * request. Its critical path is found by walking back from the end of the
+ * root. Time on the current thread belongs to the innermost scope open at
+ * that time, back to the latest flow-in (TraceFlowEnd()) whose flow-out
+ * (TraceFlowBegin()) is known. The walk then continues on the thread of the
+ * flow-out, from its time, and the gap between the two is time spent
+ * waiting in a queue. It stops at the start of the root. Without a root
+ * function, the whole trace is one request ending with the last scope.
+ *
+ * Per function, the report lists the time on the critical paths and the
+ * time on all threads during the requests, both exclusive of nested scopes.
+ * Time on the path is the most that making the function free would save,
+ * as long as no other path becomes critical; time off the path saves
+ * nothing.
+ *
+ * Usage: TraceCriticalPath <trace file> [<root function>] [<rows>]
+ */
+
+#include "PerformanceCountersTraceFormat.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/// Time a thread spends in the innermost scope @p Id.
+struct Segment
+{
+    int64_t Begin;
+    int64_t End;
+    int32_t Id;
+};
+
+/// Scopes and incoming flows of one thread, sorted by time.
+struct Timeline
+{
+    uint32_t Thread = 0;
+    std::vector<TraceEvent> Scopes;
+    std::vector<Segment> Segments;  ///< Non-overlapping, covering the time inside scopes.
+    std::vector<TraceEvent> FlowsIn;
+};
+
+/// Where a flow left a thread.
+struct FlowOut
+{
+    int64_t Time;
+    size_t Timeline;
+};
+
+/// Ticks per function ID, plus time outside any scope and waiting for flows.
+struct Attribution
+{
+    std::vector<int64_t> Functions;
+    int64_t Untraced = 0;
+    int64_t Waiting = 0;
+
+    void Add(int32_t id, int64_t ticks)
+    {
+        if (id < 0)
+        {
+            return;
+        }
+        if (this->Functions.size() <= static_cast<size_t>(id))
+        {
+            this->Functions.resize(id + 1);
+        }
+        this->Functions[id] += ticks;
+    }
+};
+
+/// Split the properly nested scopes of @p timeline into innermost segments.
+static void BuildSegments(Timeline& timeline)
+{
+    std::sort(timeline.Scopes.begin(), timeline.Scopes.end(),
+      [](const TraceEvent& a, const TraceEvent& b)
+      { return a.Start != b.Start ? a.Start < b.Start : a.End > b.End; });
+
+    std::vector<const TraceEvent*> open;
+    int64_t cursor = std::numeric_limits<int64_t>::min();
+    auto emit = [&](int64_t end, int32_t id)
+    {
+        if (end > cursor)
+        {
+            timeline.Segments.push_back({ cursor, end, id });
+            cursor = end;
+        }
+    };
+    for (const TraceEvent& scope : timeline.Scopes)
+    {
+        while (!open.empty() && open.back()->End <= scope.Start)
+        {
+            emit(open.back()->End, open.back()->Id);
+            open.pop_back();
+        }
+        if (!open.empty())
+        {
+            emit(scope.Start, open.back()->Id);
+        }
+        cursor = std::max(cursor, scope.Start);
+        open.push_back(&scope);
+    }
+    while (!open.empty())
+    {
+        emit(open.back()->End, open.back()->Id);
+        open.pop_back();
+    }
+}
+
+/// Add the time of @p timeline in [begin, end) to the innermost scopes.
+static void Attribute(const Timeline& timeline, int64_t begin, int64_t end, Attribution& to)
+{
+    const auto& segments = timeline.Segments;
+    auto segment = std::lower_bound(segments.begin(), segments.end(), begin,
+      [](const Segment& s, int64_t time) { return s.End <= time; });
+    int64_t covered = 0;
+    for (; segment != segments.end() && segment->Begin < end; ++segment)
+    {
+        const int64_t overlap = std::min(end, segment->End) - std::max(begin, segment->Begin);
+        to.Add(segment->Id, overlap);
+        covered += overlap;
+    }
+    to.Untraced += end - begin - covered;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        std::fprintf(stderr, "Usage: %s <trace file> [<root function>] [<rows>]\n", argv[0]);
+        return 2;
+    }
+    TraceFileContents trace;
+    if (!ReadTraceFile(argv[1], trace))
+    {
+        std::fprintf(stderr, "%s: not a readable trace file\n", argv[1]);
+        return 1;
+    }
+    const int rows = argc > 3 ? std::atoi(argv[3]) : 20;
+
+    int32_t root = -1;
+    if (argc > 2)
+    {
+        auto name = std::find(trace.Names.begin(), trace.Names.end(), std::string(argv[2]));
+        if (name == trace.Names.end())
+        {
+            std::fprintf(stderr, "%s: no function named %s\n", argv[1], argv[2]);
+            return 1;
+        }
+        root = static_cast<int32_t>(name - trace.Names.begin());
+    }
+
+    std::vector<Timeline> timelines(trace.Threads.size());
+    std::unordered_map<uint32_t, std::vector<FlowOut>> flowsOut;
+    for (size_t i = 0; i < trace.Threads.size(); ++i)
+    {
+        Timeline& timeline = timelines[i];
+        timeline.Thread = trace.Threads[i].Thread;
+        for (const TraceEvent& event : trace.Threads[i].Events)
+        {
+            if (event.Id == TraceFlowOut)
+            {
+                flowsOut[event.Flow].push_back({ event.Start, i });
+            }
+            else if (event.Id == TraceFlowIn)
+            {
+                timeline.FlowsIn.push_back(event);
+            }
+            else if (event.Id >= 0)
+            {
+                timeline.Scopes.push_back(event);
+            }
+        }
+        std::sort(timeline.FlowsIn.begin(), timeline.FlowsIn.end(),
+          [](const TraceEvent& a, const TraceEvent& b) { return a.Start < b.Start; });
+        BuildSegments(timeline);
+    }
+    for (auto& entry : flowsOut)
+    {
+        std::sort(entry.second.begin(), entry.second.end(),
+          [](const FlowOut& a, const FlowOut& b) { return a.Time < b.Time; });
+    }
+
+    // Requests as (timeline, root scope); a recursive root counts once.
+    std::vector<std::pair<size_t, TraceEvent>> requests;
+    if (root >= 0)
+    {
+        for (size_t i = 0; i < timelines.size(); ++i)
+        {
+            int64_t covered = std::numeric_limits<int64_t>::min();
+            for (const TraceEvent& scope : timelines[i].Scopes)
+            {
+                if (scope.Id == root && scope.Start >= covered)
+                {
+                    requests.emplace_back(i, scope);
+                    covered = scope.End;
+                }
+            }
+        }
+    }
+    else
+    {
+        TraceEvent whole = { std::numeric_limits<int64_t>::max(),
+            std::numeric_limits<int64_t>::min(), -1, 0 };
+        size_t last = 0;
+        for (size_t i = 0; i < timelines.size(); ++i)
+        {
+            for (const TraceEvent& scope : timelines[i].Scopes)
+            {
+                whole.Start = std::min(whole.Start, scope.Start);
+                if (scope.End > whole.End)
+                {
+                    whole.End = scope.End;
+                    last = i;
+                }
+            }
+        }
+        if (whole.Start < whole.End)
+        {
+            requests.emplace_back(last, whole);
+        }
+    }
+    if (requests.empty())
+    {
+        std::fprintf(stderr, "%s: no requests found\n", argv[1]);
+        return 1;
+    }
+
+    Attribution critical;
+    Attribution all;
+    int64_t endToEnd = 0;
+    size_t hops = 0;
+    for (const auto& request : requests)
+    {
+        const int64_t begin = request.second.Start;
+        size_t current = request.first;
+        int64_t time = request.second.End;
+        endToEnd += time - begin;
+        for (const Timeline& timeline : timelines)
+        {
+            Attribute(timeline, begin, time, all);
+        }
+
+        while (time > begin)
+        {
+            // Latest flow-in on this thread before the current time, with a
+            // flow-out at or before it.
+            const auto& flowsIn = timelines[current].FlowsIn;
+            auto in = std::lower_bound(flowsIn.begin(), flowsIn.end(), time,
+              [](const TraceEvent& event, int64_t t) { return event.Start < t; });
+            const FlowOut* out = nullptr;
+            while (!out && in != flowsIn.begin() && (in - 1)->Start > begin)
+            {
+                --in;
+                auto sources = flowsOut.find(in->Flow);
+                if (sources == flowsOut.end())
+                {
+                    continue;
+                }
+                for (const FlowOut& source : sources->second)
+                {
+                    if (source.Time <= in->Start)
+                    {
+                        out = &source;
+                    }
+                }
+            }
+            if (!out)
+            {
+                Attribute(timelines[current], begin, time, critical);
+                break;
+            }
+            Attribute(timelines[current], in->Start, time, critical);
+            const int64_t from = std::max(out->Time, begin);
+            critical.Waiting += in->Start - from;
+            current = out->Timeline;
+            time = from;
+            ++hops;
+        }
+    }
+
+    const double nsPerTick = trace.NanosecondsPerTick;
+    const double requestCount = static_cast<double>(requests.size());
+    std::printf("Requests:        %zu%s%s\n", requests.size(), root >= 0 ? " of " : "",
+      root >= 0 ? argv[2] : "");
+    std::printf("End to end:      %.3f ms total, %.3f us per request\n",
+      static_cast<double>(endToEnd) * nsPerTick / 1e6,
+      static_cast<double>(endToEnd) * nsPerTick / 1e3 / requestCount);
+    std::printf("Thread hops:     %.2f per request\n\n", static_cast<double>(hops) / requestCount);
+
+    struct Row
+    {
+        std::string Name;
+        int64_t Critical;
+        int64_t All;
+    };
+    std::vector<Row> table;
+    for (size_t id = 0; id < critical.Functions.size() || id < all.Functions.size(); ++id)
+    {
+        const int64_t onPath = id < critical.Functions.size() ? critical.Functions[id] : 0;
+        const int64_t anywhere = id < all.Functions.size() ? all.Functions[id] : 0;
+        if (onPath > 0 || anywhere > 0)
+        {
+            table.push_back({ id < trace.Names.size() ? trace.Names[id]
+                                                      : "Function " + std::to_string(id),
+              onPath, anywhere });
+        }
+    }
+    table.push_back({ "(waiting for flow)", critical.Waiting, 0 });
+    table.push_back({ "(outside scopes)", critical.Untraced, 0 });
+    std::stable_sort(table.begin(), table.end(),
+      [](const Row& a, const Row& b) { return a.Critical > b.Critical; });
+
+    std::printf("%-40s %14s %8s %14s %14s\n", "Function", "Path [us]", "Share",
+      "Save/req [us]", "All [us]");
+    for (int i = 0; i < rows && i < static_cast<int>(table.size()); ++i)
+    {
+        const Row& row = table[i];
+        std::printf("%-40.40s %14.3f %7.1f%% %14.3f %14.3f\n", row.Name.c_str(),
+          static_cast<double>(row.Critical) * nsPerTick / 1e3,
+          100.0 * static_cast<double>(row.Critical) / static_cast<double>(endToEnd),
+          static_cast<double>(row.Critical) * nsPerTick / 1e3 / requestCount,
+          static_cast<double>(row.All) * nsPerTick / 1e3);
+    }
+    return 0;
+}